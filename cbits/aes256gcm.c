@@ -0,0 +1,173 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+
+#include "aes256gcm.h"
+
+#define MAX_MSG_LEN 65533
+
+static const uint8_t padding[256] = {
+#define PAD4 '#', '#', '#', '#'
+#define PAD32 PAD4, PAD4, PAD4, PAD4, PAD4, PAD4, PAD4, PAD4
+  PAD32, PAD32, PAD32, PAD32, PAD32, PAD32, PAD32, PAD32
+#undef PAD32
+#undef PAD4
+};
+
+static int
+update_ad (EVP_CIPHER_CTX *ctx, int enc, const uint8_t *ad, size_t ad_len)
+{
+  int len;
+  if (ad_len == 0)
+    return 1;
+  return enc ? EVP_EncryptUpdate (ctx, NULL, &len, ad, (int) ad_len)
+             : EVP_DecryptUpdate (ctx, NULL, &len, ad, (int) ad_len);
+}
+
+static int
+encrypt_padded (EVP_CIPHER_CTX *ctx, uint8_t *out, uint8_t *tag,
+                const uint8_t *key, const uint8_t *iv, size_t iv_len,
+                const uint8_t *ad1, size_t ad1_len, const uint8_t *ad2, size_t ad2_len,
+                const uint8_t *msg, size_t msg_len, size_t padded_len)
+{
+  const uint8_t msg_len_be[2] = { (uint8_t) (msg_len >> 8), (uint8_t) msg_len };
+  size_t pad_len = padded_len - msg_len - 2, n;
+  int len;
+
+  if (EVP_EncryptInit_ex (ctx, EVP_aes_256_gcm (), NULL, NULL, NULL) != 1
+      || EVP_CIPHER_CTX_ctrl (ctx, EVP_CTRL_GCM_SET_IVLEN, (int) iv_len, NULL) != 1
+      || EVP_EncryptInit_ex (ctx, NULL, NULL, key, iv) != 1
+      || update_ad (ctx, 1, ad1, ad1_len) != 1
+      || update_ad (ctx, 1, ad2, ad2_len) != 1
+      || EVP_EncryptUpdate (ctx, out, &len, msg_len_be, 2) != 1
+      || (msg_len > 0 && EVP_EncryptUpdate (ctx, out + 2, &len, msg, (int) msg_len) != 1))
+    return 0;
+  out += 2 + msg_len;
+  while (pad_len > 0)
+    {
+      n = pad_len < sizeof padding ? pad_len : sizeof padding;
+      if (EVP_EncryptUpdate (ctx, out, &len, padding, (int) n) != 1)
+        return 0;
+      out += n;
+      pad_len -= n;
+    }
+  return EVP_EncryptFinal_ex (ctx, out, &len) == 1
+         && EVP_CIPHER_CTX_ctrl (ctx, EVP_CTRL_GCM_GET_TAG, AES256GCM_TAG_SIZE, tag) == 1;
+}
+
+int
+aes256gcm_encrypt_padded (uint8_t *out, uint8_t *tag,
+                          const uint8_t *key,
+                          const uint8_t *iv, size_t iv_len,
+                          const uint8_t *ad1, size_t ad1_len,
+                          const uint8_t *ad2, size_t ad2_len,
+                          const uint8_t *msg, size_t msg_len,
+                          size_t padded_len)
+{
+  EVP_CIPHER_CTX *ctx;
+  int r;
+
+  if (msg_len > MAX_MSG_LEN || padded_len < msg_len + 2)
+    return -1;
+  if (padded_len > INT_MAX || iv_len == 0 || iv_len > INT_MAX || ad1_len > INT_MAX || ad2_len > INT_MAX)
+    return -2;
+  if ((ctx = EVP_CIPHER_CTX_new ()) == NULL)
+    return -2;
+  r = encrypt_padded (ctx, out, tag, key, iv, iv_len, ad1, ad1_len, ad2, ad2_len, msg, msg_len, padded_len);
+  EVP_CIPHER_CTX_free (ctx);
+  return r ? 0 : -2;
+}
+
+/* 1 if authenticated, 0 if not, -1 on error; key schedule and GHASH key are set up per key */
+static int
+decrypt (EVP_CIPHER_CTX *ctx, uint8_t *out, const uint8_t *key, const uint8_t *iv,
+         const uint8_t *ad1, size_t ad1_len, const uint8_t *ad2, size_t ad2_len,
+         const uint8_t *ct, size_t ct_len, const uint8_t *tag)
+{
+  int len;
+
+  if (EVP_DecryptInit_ex (ctx, NULL, NULL, key, iv) != 1
+      || update_ad (ctx, 0, ad1, ad1_len) != 1
+      || update_ad (ctx, 0, ad2, ad2_len) != 1
+      || EVP_DecryptUpdate (ctx, out, &len, ct, (int) ct_len) != 1
+      || EVP_CIPHER_CTX_ctrl (ctx, EVP_CTRL_GCM_SET_TAG, AES256GCM_TAG_SIZE, (void *) tag) != 1)
+    return -1;
+  return EVP_DecryptFinal_ex (ctx, out + len, &len) == 1;
+}
+
+int
+aes256gcm_decrypt (uint8_t *out,
+                   const uint8_t *key,
+                   const uint8_t *iv, size_t iv_len,
+                   const uint8_t *ad1, size_t ad1_len,
+                   const uint8_t *ad2, size_t ad2_len,
+                   const uint8_t *ct, size_t ct_len,
+                   const uint8_t *tag)
+{
+  EVP_CIPHER_CTX *ctx;
+  int r = -2;
+
+  if (iv_len == 0 || iv_len > INT_MAX || ad1_len > INT_MAX || ad2_len > INT_MAX || ct_len > INT_MAX)
+    return -2;
+  if ((ctx = EVP_CIPHER_CTX_new ()) == NULL)
+    return -2;
+  if (EVP_DecryptInit_ex (ctx, EVP_aes_256_gcm (), NULL, NULL, NULL) == 1
+      && EVP_CIPHER_CTX_ctrl (ctx, EVP_CTRL_GCM_SET_IVLEN, (int) iv_len, NULL) == 1)
+    {
+      r = decrypt (ctx, out, key, iv, ad1, ad1_len, ad2, ad2_len, ct, ct_len, tag);
+      if (r < 0)
+        r = -2;
+    }
+  EVP_CIPHER_CTX_free (ctx);
+  return r;
+}
+
+int
+aes256gcm_decrypt_any (uint8_t *out,
+                       const uint8_t *keys, size_t n_keys,
+                       const uint8_t *iv, size_t iv_len,
+                       const uint8_t *ad, size_t ad_len,
+                       const uint8_t *ct, size_t ct_len,
+                       const uint8_t *tag)
+{
+  EVP_CIPHER_CTX *ctx;
+  uint8_t *buf;
+  int found = -1, r, i;
+  size_t k, j;
+  uint8_t mask;
+
+  if (n_keys > INT_MAX || iv_len == 0 || iv_len > INT_MAX || ad_len > INT_MAX || ct_len > INT_MAX)
+    return -2;
+  if ((ctx = EVP_CIPHER_CTX_new ()) == NULL)
+    return -2;
+  /* one extra byte so that malloc does not return NULL for empty message */
+  if ((buf = malloc (ct_len + 1)) == NULL)
+    {
+      EVP_CIPHER_CTX_free (ctx);
+      return -2;
+    }
+  if (EVP_DecryptInit_ex (ctx, EVP_aes_256_gcm (), NULL, NULL, NULL) != 1
+      || EVP_CIPHER_CTX_ctrl (ctx, EVP_CTRL_GCM_SET_IVLEN, (int) iv_len, NULL) != 1)
+    found = -2;
+  for (k = 0; k < n_keys && found != -2; ++k)
+    {
+      r = decrypt (ctx, buf, keys + k * AES256GCM_KEY_SIZE, iv, ad, ad_len, NULL, 0, ct, ct_len, tag);
+      if (r < 0)
+        {
+          found = -2;
+          break;
+        }
+      /* mask is 0xff only for the first matching key */
+      i = r & (found == -1);
+      mask = (uint8_t) - i;
+      for (j = 0; j < ct_len; ++j)
+        out[j] ^= mask & (out[j] ^ buf[j]);
+      found ^= (-i) & (found ^ (int) k);
+    }
+  OPENSSL_cleanse (buf, ct_len);
+  free (buf);
+  EVP_CIPHER_CTX_free (ctx);
+  return found;
+}
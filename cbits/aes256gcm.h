@@ -0,0 +1,45 @@
+#ifndef AES256GCM_H
+#define AES256GCM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define AES256GCM_KEY_SIZE 32
+#define AES256GCM_TAG_SIZE 16
+
+/* AES-256-GCM decryption of one message with each of n_keys candidate keys
+   (concatenated in keys, AES256GCM_KEY_SIZE bytes each).
+   All keys are always tried, so the time depends on the number of keys and not on which key matches.
+   The plaintext decrypted with the first matching key is written to out (ct_len bytes).
+   returns the index of the first matching key, -1 if no key matches, -2 on internal error */
+int aes256gcm_decrypt_any (uint8_t *out,
+                           const uint8_t *keys, size_t n_keys,
+                           const uint8_t *iv, size_t iv_len,
+                           const uint8_t *ad, size_t ad_len,
+                           const uint8_t *ct, size_t ct_len,
+                           const uint8_t *tag);
+
+/* AES-256-GCM encryption of the message padded in the same way as in Simplex.Messaging.Crypto.pad:
+   2-byte big-endian message length, the message and '#' characters up to padded_len bytes.
+   The padded message is not allocated, the ciphertext (padded_len bytes) is written to out and the tag to tag.
+   The associated data is ad1 || ad2, so that it can include the part of the output buffer.
+   returns 0 on success, -1 if the message does not fit in padded_len, -2 on internal error */
+int aes256gcm_encrypt_padded (uint8_t *out, uint8_t *tag,
+                              const uint8_t *key,
+                              const uint8_t *iv, size_t iv_len,
+                              const uint8_t *ad1, size_t ad1_len,
+                              const uint8_t *ad2, size_t ad2_len,
+                              const uint8_t *msg, size_t msg_len,
+                              size_t padded_len);
+
+/* AES-256-GCM decryption with associated data ad1 || ad2, the plaintext (ct_len bytes) is written to out.
+   returns 1 if the message is authenticated, 0 if not, -2 on internal error */
+int aes256gcm_decrypt (uint8_t *out,
+                       const uint8_t *key,
+                       const uint8_t *iv, size_t iv_len,
+                       const uint8_t *ad1, size_t ad1_len,
+                       const uint8_t *ad2, size_t ad2_len,
+                       const uint8_t *ct, size_t ct_len,
+                       const uint8_t *tag);
+
+#endif /* AES256GCM_H */
@@ -0,0 +1,224 @@
+#include "base64url.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BASE64URL_AVX2 1
+#include <immintrin.h>
+#endif
+
+static const uint8_t enc_table[64] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+/* 0xFF for invalid characters */
+static const uint8_t dec_table[256] = {
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 62,   0xFF, 0xFF,
+  52,   53,   54,   55,   56,   57,   58,   59,   60,   61,   0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0,    1,    2,    3,    4,    5,    6,    7,    8,    9,    10,   11,   12,   13,   14,
+  15,   16,   17,   18,   19,   20,   21,   22,   23,   24,   25,   0xFF, 0xFF, 0xFF, 0xFF, 63,
+  0xFF, 26,   27,   28,   29,   30,   31,   32,   33,   34,   35,   36,   37,   38,   39,   40,
+  41,   42,   43,   44,   45,   46,   47,   48,   49,   50,   51,   0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+#ifdef BASE64URL_AVX2
+
+static int
+has_avx2 (void)
+{
+  static int avx2 = -1;
+  if (avx2 < 0)
+    {
+      __builtin_cpu_init ();
+      avx2 = __builtin_cpu_supports ("avx2") ? 1 : 0;
+    }
+  return avx2;
+}
+
+/* encodes 24 bytes to 32 characters per iteration, reading 28 bytes,
+ * returns the number of processed input bytes */
+__attribute__ ((target ("avx2"))) static size_t
+encode_avx2 (uint8_t *out, const uint8_t *in, size_t len)
+{
+  const __m256i shuf = _mm256_setr_epi8 (1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                                         1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+  /* offsets from 6-bit values to characters, indexed by reduced value */
+  const __m256i offsets = _mm256_setr_epi8 ('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '-' - 62,
+                                            '_' - 63, 'A', 0, 0,
+                                            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '-' - 62,
+                                            '_' - 63, 'A', 0, 0);
+  size_t i = 0;
+  for (; len - i >= 28; i += 24, out += 32)
+    {
+      __m256i v = _mm256_set_m128i (_mm_loadu_si128 ((const __m128i *) (in + i + 12)),
+                                    _mm_loadu_si128 ((const __m128i *) (in + i)));
+      v = _mm256_shuffle_epi8 (v, shuf);
+      /* split each 3 bytes into 4 6-bit values */
+      const __m256i t0 = _mm256_and_si256 (v, _mm256_set1_epi32 (0x0fc0fc00));
+      const __m256i t1 = _mm256_mulhi_epu16 (t0, _mm256_set1_epi32 (0x04000040));
+      const __m256i t2 = _mm256_and_si256 (v, _mm256_set1_epi32 (0x003f03f0));
+      const __m256i t3 = _mm256_mullo_epi16 (t2, _mm256_set1_epi32 (0x01000010));
+      const __m256i idx = _mm256_or_si256 (t1, t3);
+      /* 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12 */
+      __m256i r = _mm256_subs_epu8 (idx, _mm256_set1_epi8 (51));
+      const __m256i less = _mm256_cmpgt_epi8 (_mm256_set1_epi8 (26), idx);
+      r = _mm256_or_si256 (r, _mm256_and_si256 (less, _mm256_set1_epi8 (13)));
+      r = _mm256_add_epi8 (_mm256_shuffle_epi8 (offsets, r), idx);
+      _mm256_storeu_si256 ((__m256i *) out, r);
+    }
+  return i;
+}
+
+__attribute__ ((target ("avx2"))) static inline __m256i
+in_range (__m256i v, char lo, char hi)
+{
+  return _mm256_and_si256 (_mm256_cmpgt_epi8 (v, _mm256_set1_epi8 (lo - 1)),
+                           _mm256_cmpgt_epi8 (_mm256_set1_epi8 (hi + 1), v));
+}
+
+/* decodes 32 characters to 24 bytes per iteration, writing 28 bytes,
+ * returns the number of processed characters or -1 if there are invalid characters */
+__attribute__ ((target ("avx2"))) static int64_t
+decode_avx2 (uint8_t *out, const uint8_t *in, size_t len)
+{
+  const __m256i shuf = _mm256_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                         2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  size_t i = 0;
+  for (; len - i >= 40; i += 32, out += 24)
+    {
+      const __m256i v = _mm256_loadu_si256 ((const __m256i *) (in + i));
+      /* bytes >= 0x80 are negative and do not match any range */
+      const __m256i upper = in_range (v, 'A', 'Z');
+      const __m256i lower = in_range (v, 'a', 'z');
+      const __m256i digit = in_range (v, '0', '9');
+      const __m256i dash = _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('-'));
+      const __m256i uscore = _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('_'));
+      const __m256i valid = _mm256_or_si256 (_mm256_or_si256 (upper, lower),
+                                             _mm256_or_si256 (digit, _mm256_or_si256 (dash, uscore)));
+      if (_mm256_movemask_epi8 (valid) != -1)
+        return -1;
+      __m256i offset = _mm256_and_si256 (upper, _mm256_set1_epi8 (-65));
+      offset = _mm256_or_si256 (offset, _mm256_and_si256 (lower, _mm256_set1_epi8 (-71)));
+      offset = _mm256_or_si256 (offset, _mm256_and_si256 (digit, _mm256_set1_epi8 (4)));
+      offset = _mm256_or_si256 (offset, _mm256_and_si256 (dash, _mm256_set1_epi8 (17)));
+      offset = _mm256_or_si256 (offset, _mm256_and_si256 (uscore, _mm256_set1_epi8 (-32)));
+      const __m256i idx = _mm256_add_epi8 (v, offset);
+      /* join 4 6-bit values into 3 bytes */
+      const __m256i ab = _mm256_maddubs_epi16 (idx, _mm256_set1_epi32 (0x01400140));
+      __m256i r = _mm256_madd_epi16 (ab, _mm256_set1_epi32 (0x00011000));
+      r = _mm256_shuffle_epi8 (r, shuf);
+      _mm_storeu_si128 ((__m128i *) out, _mm256_castsi256_si128 (r));
+      _mm_storeu_si128 ((__m128i *) (out + 12), _mm256_extracti128_si256 (r, 1));
+    }
+  return (int64_t) i;
+}
+
+#endif /* BASE64URL_AVX2 */
+
+size_t
+base64url_encoded_len (size_t len, int pad)
+{
+  return pad ? (len + 2) / 3 * 4 : len / 3 * 4 + (len % 3 ? len % 3 + 1 : 0);
+}
+
+void
+base64url_encode (uint8_t *out, const uint8_t *in, size_t len, int pad)
+{
+  size_t i = 0;
+#ifdef BASE64URL_AVX2
+  if (len >= 28 && has_avx2 ())
+    {
+      i = encode_avx2 (out, in, len);
+      out += i / 3 * 4;
+    }
+#endif
+  for (; len - i >= 3; i += 3, out += 4)
+    {
+      const uint32_t w = (uint32_t) in[i] << 16 | (uint32_t) in[i + 1] << 8 | in[i + 2];
+      out[0] = enc_table[w >> 18];
+      out[1] = enc_table[(w >> 12) & 63];
+      out[2] = enc_table[(w >> 6) & 63];
+      out[3] = enc_table[w & 63];
+    }
+  if (len - i == 1)
+    {
+      out[0] = enc_table[in[i] >> 2];
+      out[1] = enc_table[(in[i] & 3) << 4];
+      if (pad)
+        out[2] = out[3] = '=';
+    }
+  else if (len - i == 2)
+    {
+      out[0] = enc_table[in[i] >> 2];
+      out[1] = enc_table[(in[i] & 3) << 4 | in[i + 1] >> 4];
+      out[2] = enc_table[(in[i + 1] & 15) << 2];
+      if (pad)
+        out[3] = '=';
+    }
+}
+
+int64_t
+base64url_decode (uint8_t *out, const uint8_t *in, size_t len)
+{
+  /* as in base64-bytestring, unpadded input is padded to the multiple of 4 characters */
+  if (len % 4 == 1)
+    return -1;
+  size_t n = len;
+  while (n > 0 && in[n - 1] == '=')
+    n--;
+  /* padding characters are only allowed when the length is a multiple of 4 */
+  if (n < len && len % 4 != 0)
+    return -1;
+  const size_t pad = len - n + (4 - len % 4) % 4;
+  if (pad > 2)
+    return -1;
+
+  uint8_t *const start = out;
+  size_t i = 0;
+#ifdef BASE64URL_AVX2
+  if (n >= 40 && has_avx2 ())
+    {
+      const int64_t r = decode_avx2 (out, in, n);
+      if (r < 0)
+        return -1;
+      i = (size_t) r;
+      out += i / 4 * 3;
+    }
+#endif
+  for (; n - i >= 4; i += 4, out += 3)
+    {
+      const uint8_t a = dec_table[in[i]], b = dec_table[in[i + 1]],
+                    c = dec_table[in[i + 2]], d = dec_table[in[i + 3]];
+      if ((a | b | c | d) & 0x80)
+        return -1;
+      const uint32_t w = (uint32_t) a << 18 | (uint32_t) b << 12 | (uint32_t) c << 6 | d;
+      out[0] = (uint8_t) (w >> 16);
+      out[1] = (uint8_t) (w >> 8);
+      out[2] = (uint8_t) w;
+    }
+  if (n - i == 2)
+    {
+      const uint8_t a = dec_table[in[i]], b = dec_table[in[i + 1]];
+      if ((a | b) & 0x80 || b & 15)
+        return -1;
+      *out++ = (uint8_t) (a << 2 | b >> 4);
+    }
+  else if (n - i == 3)
+    {
+      const uint8_t a = dec_table[in[i]], b = dec_table[in[i + 1]], c = dec_table[in[i + 2]];
+      if ((a | b | c) & 0x80 || c & 3)
+        return -1;
+      *out++ = (uint8_t) (a << 2 | b >> 4);
+      *out++ = (uint8_t) (b << 4 | c >> 2);
+    }
+  return (int64_t) (out - start);
+}
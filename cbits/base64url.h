@@ -0,0 +1,25 @@
+/*
+ * base64url (RFC 4648, section 5) encoding and decoding,
+ * using AVX2 when it is supported by CPU, with scalar fallback.
+ *
+ * Decoding is strict and compatible with Data.ByteString.Base64.URL.decode:
+ * padding is optional, but if present it must be correct,
+ * and unused bits of the last character must be zero.
+ */
+
+#ifndef BASE64URL_H
+#define BASE64URL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+size_t base64url_encoded_len (size_t len, int pad);
+
+/* the output must have base64url_encoded_len (len, pad) bytes */
+void base64url_encode (uint8_t *out, const uint8_t *in, size_t len, int pad);
+
+/* the output must have len / 4 * 3 + 2 bytes,
+ * returns decoded length or -1 if the input is invalid */
+int64_t base64url_decode (uint8_t *out, const uint8_t *in, size_t len);
+
+#endif /* BASE64URL_H */
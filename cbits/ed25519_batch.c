@@ -0,0 +1,693 @@
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/bn.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include "ed25519_batch.h"
+
+#ifdef __SIZEOF_INT128__
+
+/* Field arithmetic modulo p = 2^255 - 19 in radix 2^51 (as in ed25519-donna),
+   group operations in extended coordinates (as in ref10).
+   Everything here is variable time: batch verification only handles public data. */
+
+typedef unsigned __int128 u128;
+
+typedef struct
+{
+  uint64_t v[5];
+} fe;
+
+#define MASK51 0x7ffffffffffffULL
+
+static const uint8_t d_bytes[32] = {
+  0xa3, 0x78, 0x59, 0x13, 0xca, 0x4d, 0xeb, 0x75, 0xab, 0xd8, 0x41, 0x41, 0x4d, 0x0a, 0x70, 0x00,
+  0x98, 0xe8, 0x79, 0x77, 0x79, 0x40, 0xc7, 0x8c, 0x73, 0xfe, 0x6f, 0x2b, 0xee, 0x6c, 0x03, 0x52};
+
+static const uint8_t d2_bytes[32] = {
+  0x59, 0xf1, 0xb2, 0x26, 0x94, 0x9b, 0xd6, 0xeb, 0x56, 0xb1, 0x83, 0x82, 0x9a, 0x14, 0xe0, 0x00,
+  0x30, 0xd1, 0xf3, 0xee, 0xf2, 0x80, 0x8e, 0x19, 0xe7, 0xfc, 0xdf, 0x56, 0xdc, 0xd9, 0x06, 0x24};
+
+static const uint8_t sqrtm1_bytes[32] = {
+  0xb0, 0xa0, 0x0e, 0x4a, 0x27, 0x1b, 0xee, 0xc4, 0x78, 0xe4, 0x2f, 0xad, 0x06, 0x18, 0x43, 0x2f,
+  0xa7, 0xd7, 0xfb, 0x3d, 0x99, 0x00, 0x4d, 0x2b, 0x0b, 0xdf, 0xc1, 0x4f, 0x80, 0x24, 0x83, 0x2b};
+
+/* base point, x is positive */
+static const uint8_t base_bytes[32] = {
+  0x58, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+  0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66};
+
+/* group order L = 2^252 + 27742317777372353535851937790883648493 */
+static const uint8_t order_bytes[32] = {
+  0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58, 0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10};
+
+static inline uint64_t
+load64 (const uint8_t *s)
+{
+  uint64_t r = 0;
+  int i;
+  for (i = 7; i >= 0; --i)
+    r = (r << 8) | s[i];
+  return r;
+}
+
+static inline void
+store64 (uint8_t *s, uint64_t x)
+{
+  int i;
+  for (i = 0; i < 8; ++i, x >>= 8)
+    s[i] = (uint8_t) x;
+}
+
+/* the top bit is ignored */
+static void
+fe_frombytes (fe *h, const uint8_t *s)
+{
+  h->v[0] = load64 (s) & MASK51;
+  h->v[1] = (load64 (s + 6) >> 3) & MASK51;
+  h->v[2] = (load64 (s + 12) >> 6) & MASK51;
+  h->v[3] = (load64 (s + 19) >> 1) & MASK51;
+  h->v[4] = (load64 (s + 24) >> 12) & MASK51;
+}
+
+static inline void
+fe_carry (fe *h)
+{
+  uint64_t c;
+  c = h->v[0] >> 51, h->v[0] &= MASK51, h->v[1] += c;
+  c = h->v[1] >> 51, h->v[1] &= MASK51, h->v[2] += c;
+  c = h->v[2] >> 51, h->v[2] &= MASK51, h->v[3] += c;
+  c = h->v[3] >> 51, h->v[3] &= MASK51, h->v[4] += c;
+  c = h->v[4] >> 51, h->v[4] &= MASK51, h->v[0] += c * 19;
+}
+
+/* canonical encoding */
+static void
+fe_tobytes (uint8_t *s, const fe *f)
+{
+  fe h = *f;
+  uint64_t q;
+
+  fe_carry (&h);
+  fe_carry (&h);
+  /* now h < 2^255 + 2^52, q = floor((h + 19) / 2^255) is 1 iff h >= p */
+  q = (h.v[0] + 19) >> 51;
+  q = (h.v[1] + q) >> 51;
+  q = (h.v[2] + q) >> 51;
+  q = (h.v[3] + q) >> 51;
+  q = (h.v[4] + q) >> 51;
+  /* h - q p = h + 19 q - q 2^255, 2^255 is dropped by the final mask */
+  h.v[0] += 19 * q;
+  h.v[1] += h.v[0] >> 51, h.v[0] &= MASK51;
+  h.v[2] += h.v[1] >> 51, h.v[1] &= MASK51;
+  h.v[3] += h.v[2] >> 51, h.v[2] &= MASK51;
+  h.v[4] += h.v[3] >> 51, h.v[3] &= MASK51;
+  h.v[4] &= MASK51;
+  store64 (s, h.v[0] | (h.v[1] << 51));
+  store64 (s + 8, (h.v[1] >> 13) | (h.v[2] << 38));
+  store64 (s + 16, (h.v[2] >> 26) | (h.v[3] << 25));
+  store64 (s + 24, (h.v[3] >> 39) | (h.v[4] << 12));
+}
+
+static inline void
+fe_0 (fe *h)
+{
+  memset (h, 0, sizeof (fe));
+}
+
+static inline void
+fe_1 (fe *h)
+{
+  memset (h, 0, sizeof (fe));
+  h->v[0] = 1;
+}
+
+static inline void
+fe_add (fe *h, const fe *f, const fe *g)
+{
+  int i;
+  for (i = 0; i < 5; ++i)
+    h->v[i] = f->v[i] + g->v[i];
+  fe_carry (h);
+}
+
+/* adds 4p to avoid underflow, g limbs must be < 2^53 */
+static inline void
+fe_sub (fe *h, const fe *f, const fe *g)
+{
+  h->v[0] = f->v[0] + 0x1fffffffffffb4ULL - g->v[0];
+  h->v[1] = f->v[1] + 0x1ffffffffffffcULL - g->v[1];
+  h->v[2] = f->v[2] + 0x1ffffffffffffcULL - g->v[2];
+  h->v[3] = f->v[3] + 0x1ffffffffffffcULL - g->v[3];
+  h->v[4] = f->v[4] + 0x1ffffffffffffcULL - g->v[4];
+  fe_carry (h);
+}
+
+static inline void
+fe_neg (fe *h, const fe *f)
+{
+  fe z;
+  fe_0 (&z);
+  fe_sub (h, &z, f);
+}
+
+static inline void
+fe_reduce (fe *h, u128 t0, u128 t1, u128 t2, u128 t3, u128 t4)
+{
+  uint64_t c;
+  c = (uint64_t) (t0 >> 51), h->v[0] = (uint64_t) t0 & MASK51, t1 += c;
+  c = (uint64_t) (t1 >> 51), h->v[1] = (uint64_t) t1 & MASK51, t2 += c;
+  c = (uint64_t) (t2 >> 51), h->v[2] = (uint64_t) t2 & MASK51, t3 += c;
+  c = (uint64_t) (t3 >> 51), h->v[3] = (uint64_t) t3 & MASK51, t4 += c;
+  c = (uint64_t) (t4 >> 51), h->v[4] = (uint64_t) t4 & MASK51;
+  h->v[0] += c * 19;
+  c = h->v[0] >> 51, h->v[0] &= MASK51, h->v[1] += c;
+}
+
+static void
+fe_mul (fe *h, const fe *f, const fe *g)
+{
+  const uint64_t f0 = f->v[0], f1 = f->v[1], f2 = f->v[2], f3 = f->v[3], f4 = f->v[4];
+  const uint64_t g0 = g->v[0], g1 = g->v[1], g2 = g->v[2], g3 = g->v[3], g4 = g->v[4];
+  const uint64_t g1_19 = g1 * 19, g2_19 = g2 * 19, g3_19 = g3 * 19, g4_19 = g4 * 19;
+  u128 t0, t1, t2, t3, t4;
+
+  t0 = (u128) f0 * g0 + (u128) f1 * g4_19 + (u128) f2 * g3_19 + (u128) f3 * g2_19 + (u128) f4 * g1_19;
+  t1 = (u128) f0 * g1 + (u128) f1 * g0 + (u128) f2 * g4_19 + (u128) f3 * g3_19 + (u128) f4 * g2_19;
+  t2 = (u128) f0 * g2 + (u128) f1 * g1 + (u128) f2 * g0 + (u128) f3 * g4_19 + (u128) f4 * g3_19;
+  t3 = (u128) f0 * g3 + (u128) f1 * g2 + (u128) f2 * g1 + (u128) f3 * g0 + (u128) f4 * g4_19;
+  t4 = (u128) f0 * g4 + (u128) f1 * g3 + (u128) f2 * g2 + (u128) f3 * g1 + (u128) f4 * g0;
+  fe_reduce (h, t0, t1, t2, t3, t4);
+}
+
+static void
+fe_sq (fe *h, const fe *f)
+{
+  const uint64_t f0 = f->v[0], f1 = f->v[1], f2 = f->v[2], f3 = f->v[3], f4 = f->v[4];
+  const uint64_t d0 = f0 * 2, d1 = f1 * 2, d2 = f2 * 2 * 19, d419 = f4 * 19, d4 = d419 * 2;
+  u128 t0, t1, t2, t3, t4;
+
+  t0 = (u128) f0 * f0 + (u128) d4 * f1 + (u128) d2 * f3;
+  t1 = (u128) d0 * f1 + (u128) d4 * f2 + (u128) f3 * (f3 * 19);
+  t2 = (u128) d0 * f2 + (u128) f1 * f1 + (u128) d4 * f3;
+  t3 = (u128) d0 * f3 + (u128) d1 * f2 + (u128) f4 * d419;
+  t4 = (u128) d0 * f4 + (u128) d1 * f3 + (u128) f2 * f2;
+  fe_reduce (h, t0, t1, t2, t3, t4);
+}
+
+static void
+fe_sqn (fe *h, const fe *f, int n)
+{
+  fe_sq (h, f);
+  while (--n > 0)
+    fe_sq (h, h);
+}
+
+/* z^((p - 5) / 8) = z^(2^252 - 3) */
+static void
+fe_pow22523 (fe *out, const fe *z)
+{
+  fe t0, t1, t2, t3;
+
+  fe_sq (&t0, z);          /* 2 */
+  fe_sqn (&t1, &t0, 2);    /* 8 */
+  fe_mul (&t1, z, &t1);    /* 9 */
+  fe_mul (&t0, &t0, &t1);  /* 11 */
+  fe_sq (&t2, &t0);        /* 22 */
+  fe_mul (&t1, &t1, &t2);  /* 2^5 - 1 */
+  fe_sqn (&t2, &t1, 5);
+  fe_mul (&t1, &t2, &t1);  /* 2^10 - 1 */
+  fe_sqn (&t2, &t1, 10);
+  fe_mul (&t2, &t2, &t1);  /* 2^20 - 1 */
+  fe_sqn (&t3, &t2, 20);
+  fe_mul (&t2, &t3, &t2);  /* 2^40 - 1 */
+  fe_sqn (&t2, &t2, 10);
+  fe_mul (&t1, &t2, &t1);  /* 2^50 - 1 */
+  fe_sqn (&t2, &t1, 50);
+  fe_mul (&t2, &t2, &t1);  /* 2^100 - 1 */
+  fe_sqn (&t3, &t2, 100);
+  fe_mul (&t2, &t3, &t2);  /* 2^200 - 1 */
+  fe_sqn (&t2, &t2, 50);
+  fe_mul (&t1, &t2, &t1);  /* 2^250 - 1 */
+  fe_sqn (&t1, &t1, 2);    /* 2^252 - 4 */
+  fe_mul (out, &t1, z);    /* 2^252 - 3 */
+}
+
+static int
+fe_iszero (const fe *f)
+{
+  uint8_t s[32];
+  int i, r = 0;
+  fe_tobytes (s, f);
+  for (i = 0; i < 32; ++i)
+    r |= s[i];
+  return r == 0;
+}
+
+static int
+fe_isnegative (const fe *f)
+{
+  uint8_t s[32];
+  fe_tobytes (s, f);
+  return s[0] & 1;
+}
+
+typedef struct
+{
+  fe X, Y, Z;
+} ge_p2;
+
+typedef struct
+{
+  fe X, Y, Z, T;
+} ge_p3;
+
+typedef struct
+{
+  fe X, Y, Z, T;
+} ge_p1p1;
+
+typedef struct
+{
+  fe YplusX, YminusX, Z, T2d;
+} ge_cached;
+
+typedef struct
+{
+  fe d, d2, sqrtm1;
+} curve_consts;
+
+static void
+ge_p1p1_to_p2 (ge_p2 *r, const ge_p1p1 *p)
+{
+  fe_mul (&r->X, &p->X, &p->T);
+  fe_mul (&r->Y, &p->Y, &p->Z);
+  fe_mul (&r->Z, &p->Z, &p->T);
+}
+
+static void
+ge_p1p1_to_p3 (ge_p3 *r, const ge_p1p1 *p)
+{
+  fe_mul (&r->X, &p->X, &p->T);
+  fe_mul (&r->Y, &p->Y, &p->Z);
+  fe_mul (&r->Z, &p->Z, &p->T);
+  fe_mul (&r->T, &p->X, &p->Y);
+}
+
+static void
+ge_p3_to_cached (ge_cached *r, const ge_p3 *p, const curve_consts *c)
+{
+  fe_add (&r->YplusX, &p->Y, &p->X);
+  fe_sub (&r->YminusX, &p->Y, &p->X);
+  r->Z = p->Z;
+  fe_mul (&r->T2d, &p->T, &c->d2);
+}
+
+static void
+ge_p2_dbl (ge_p1p1 *r, const ge_p2 *p)
+{
+  fe t0;
+
+  fe_sq (&r->X, &p->X);
+  fe_sq (&r->Z, &p->Y);
+  fe_sq (&r->T, &p->Z);
+  fe_add (&r->T, &r->T, &r->T);
+  fe_add (&r->Y, &p->X, &p->Y);
+  fe_sq (&t0, &r->Y);
+  fe_add (&r->Y, &r->Z, &r->X);
+  fe_sub (&r->Z, &r->Z, &r->X);
+  fe_sub (&r->X, &t0, &r->Y);
+  fe_sub (&r->T, &r->T, &r->Z);
+}
+
+static void
+ge_p3_dbl (ge_p1p1 *r, const ge_p3 *p)
+{
+  ge_p2 q;
+  q.X = p->X;
+  q.Y = p->Y;
+  q.Z = p->Z;
+  ge_p2_dbl (r, &q);
+}
+
+static void
+ge_add (ge_p1p1 *r, const ge_p3 *p, const ge_cached *q)
+{
+  fe t0;
+
+  fe_add (&r->X, &p->Y, &p->X);
+  fe_sub (&r->Y, &p->Y, &p->X);
+  fe_mul (&r->Z, &r->X, &q->YplusX);
+  fe_mul (&r->Y, &r->Y, &q->YminusX);
+  fe_mul (&r->T, &q->T2d, &p->T);
+  fe_mul (&r->X, &p->Z, &q->Z);
+  fe_add (&t0, &r->X, &r->X);
+  fe_sub (&r->X, &r->Z, &r->Y);
+  fe_add (&r->Y, &r->Z, &r->Y);
+  fe_add (&r->Z, &t0, &r->T);
+  fe_sub (&r->T, &t0, &r->T);
+}
+
+static void
+ge_sub (ge_p1p1 *r, const ge_p3 *p, const ge_cached *q)
+{
+  fe t0;
+
+  fe_add (&r->X, &p->Y, &p->X);
+  fe_sub (&r->Y, &p->Y, &p->X);
+  fe_mul (&r->Z, &r->X, &q->YminusX);
+  fe_mul (&r->Y, &r->Y, &q->YplusX);
+  fe_mul (&r->T, &q->T2d, &p->T);
+  fe_mul (&r->X, &p->Z, &q->Z);
+  fe_add (&t0, &r->X, &r->X);
+  fe_sub (&r->X, &r->Z, &r->Y);
+  fe_add (&r->Y, &r->Z, &r->Y);
+  fe_sub (&r->Z, &t0, &r->T);
+  fe_add (&r->T, &t0, &r->T);
+}
+
+/* RFC 8032 decoding: rejects non-canonical y and x = 0 with the sign bit set.
+   returns 1 on success, 0 if the encoding is invalid */
+static int
+ge_frombytes (ge_p3 *h, const uint8_t *s, const curve_consts *c)
+{
+  uint8_t y_bytes[32], check[32];
+  fe u, v, v3, vxx, t;
+  int sign = s[31] >> 7;
+
+  memcpy (y_bytes, s, 32);
+  y_bytes[31] &= 0x7f;
+  fe_frombytes (&h->Y, y_bytes);
+  fe_tobytes (check, &h->Y);
+  if (memcmp (check, y_bytes, 32) != 0)
+    return 0;
+
+  fe_1 (&h->Z);
+  fe_sq (&u, &h->Y);
+  fe_mul (&v, &u, &c->d);
+  fe_sub (&u, &u, &h->Z); /* u = y^2 - 1 */
+  fe_add (&v, &v, &h->Z); /* v = d y^2 + 1 */
+
+  fe_sq (&v3, &v);
+  fe_mul (&v3, &v3, &v); /* v^3 */
+  fe_sq (&h->X, &v3);
+  fe_mul (&h->X, &h->X, &v);
+  fe_mul (&h->X, &h->X, &u); /* u v^7 */
+  fe_pow22523 (&h->X, &h->X);
+  fe_mul (&h->X, &h->X, &v3);
+  fe_mul (&h->X, &h->X, &u); /* x = u v^3 (u v^7)^((p - 5) / 8) */
+
+  fe_sq (&vxx, &h->X);
+  fe_mul (&vxx, &vxx, &v);
+  fe_sub (&t, &vxx, &u);
+  if (!fe_iszero (&t))
+    {
+      fe_add (&t, &vxx, &u);
+      if (!fe_iszero (&t))
+        return 0;
+      fe_mul (&h->X, &h->X, &c->sqrtm1);
+    }
+
+  if (fe_iszero (&h->X) && sign)
+    return 0;
+  if (fe_isnegative (&h->X) != sign)
+    fe_neg (&h->X, &h->X);
+  fe_mul (&h->T, &h->X, &h->Y);
+  return 1;
+}
+
+/* signed window-5 NAF of a 256-bit scalar, digits are odd and in [-15, 15] (ref10) */
+static void
+slide (int8_t *r, const uint8_t *a)
+{
+  int i, b, k;
+
+  for (i = 0; i < 256; ++i)
+    r[i] = 1 & (a[i >> 3] >> (i & 7));
+  for (i = 0; i < 256; ++i)
+    if (r[i])
+      for (b = 1; b <= 6 && i + b < 256; ++b)
+        if (r[i + b])
+          {
+            if (r[i] + (r[i + b] << b) <= 15)
+              {
+                r[i] += r[i + b] << b;
+                r[i + b] = 0;
+              }
+            else if (r[i] - (r[i + b] << b) >= -15)
+              {
+                r[i] -= r[i + b] << b;
+                for (k = i + b; k < 256; ++k)
+                  {
+                    if (!r[k])
+                      {
+                        r[k] = 1;
+                        break;
+                      }
+                    r[k] = 0;
+                  }
+              }
+            else
+              break;
+          }
+}
+
+#define MULTIPLES 8 /* P, 3P, ..., 15P */
+
+static void
+precompute (ge_cached *t, const ge_p3 *p, const curve_consts *c)
+{
+  ge_p1p1 r;
+  ge_p3 p2, u;
+  int i;
+
+  ge_p3_to_cached (&t[0], p, c);
+  ge_p3_dbl (&r, p);
+  ge_p1p1_to_p3 (&p2, &r);
+  for (i = 1; i < MULTIPLES; ++i)
+    {
+      ge_add (&r, &p2, &t[i - 1]);
+      ge_p1p1_to_p3 (&u, &r);
+      ge_p3_to_cached (&t[i], &u, c);
+    }
+}
+
+/* sum of scalars[i] * points[i] (Straus interleaving) */
+static void
+multi_scalarmult (ge_p2 *r, size_t n, const int8_t *slides, const ge_cached *table)
+{
+  ge_p1p1 t;
+  ge_p3 u;
+  size_t j;
+  int i;
+  int8_t d;
+
+  fe_0 (&r->X);
+  fe_1 (&r->Y);
+  fe_1 (&r->Z);
+
+  for (i = 255; i >= 0; --i)
+    {
+      for (j = 0; j < n; ++j)
+        if (slides[j * 256 + i])
+          break;
+      if (j < n)
+        break;
+    }
+
+  for (; i >= 0; --i)
+    {
+      ge_p2_dbl (&t, r);
+      for (j = 0; j < n; ++j)
+        if ((d = slides[j * 256 + i]) != 0)
+          {
+            ge_p1p1_to_p3 (&u, &t);
+            if (d > 0)
+              ge_add (&t, &u, &table[j * MULTIPLES + d / 2]);
+            else
+              ge_sub (&t, &u, &table[j * MULTIPLES + (-d) / 2]);
+          }
+      ge_p1p1_to_p2 (r, &t);
+    }
+}
+
+/* [L]P is the identity only if P has no small-order component,
+   t is the table of P multiples, order is the NAF of L */
+static int
+torsion_free (const ge_cached *t, const int8_t *order)
+{
+  ge_p2 r;
+  multi_scalarmult (&r, 1, order, t);
+  fe_sub (&r.Y, &r.Y, &r.Z);
+  return fe_iszero (&r.X) && fe_iszero (&r.Y);
+}
+
+/* points: B, R_0, A_0, R_1, A_1, ... */
+static int
+verify_batch (size_t n, const uint8_t *pks, const uint8_t *sigs,
+              const uint8_t *const *msgs, const size_t *msg_lens,
+              ge_cached *table, int8_t *slides, BN_CTX *bn, EVP_MD_CTX *md)
+{
+  curve_consts c;
+  ge_p3 p, u;
+  ge_p2 r;
+  ge_p1p1 t;
+  ge_cached tu[MULTIPLES];
+  uint8_t buf[64];
+  int8_t order_slide[256];
+  BIGNUM *order, *s, *h, *z, *sum;
+  size_t i;
+  int k, ok = 1;
+
+  fe_frombytes (&c.d, d_bytes);
+  fe_frombytes (&c.d2, d2_bytes);
+  fe_frombytes (&c.sqrtm1, sqrtm1_bytes);
+
+  BN_CTX_start (bn);
+  order = BN_CTX_get (bn);
+  s = BN_CTX_get (bn);
+  h = BN_CTX_get (bn);
+  z = BN_CTX_get (bn);
+  sum = BN_CTX_get (bn);
+  if (sum == NULL || BN_lebin2bn (order_bytes, 32, order) == NULL)
+    goto err;
+  BN_zero (sum);
+
+  if (!ge_frombytes (&p, base_bytes, &c))
+    goto err;
+  precompute (table, &p, &c);
+  slide (order_slide, order_bytes);
+
+  for (i = 0; i < n && ok; ++i)
+    {
+      const uint8_t *pk = pks + i * ED25519_PUBLIC_KEY_SIZE;
+      const uint8_t *sig = sigs + i * ED25519_SIGNATURE_SIZE;
+      ge_cached *tr = table + (2 * i + 1) * MULTIPLES;
+      int8_t *sr = slides + (2 * i + 1) * 256;
+
+      if (!ge_frombytes (&u, sig, &c))
+        {
+          ok = 0;
+          break;
+        }
+      precompute (tr, &u, &c);
+      if (!ge_frombytes (&p, pk, &c))
+        {
+          ok = 0;
+          break;
+        }
+      precompute (tr + MULTIPLES, &p, &c);
+
+      if (BN_lebin2bn (sig + 32, 32, s) == NULL)
+        goto err;
+      if (BN_cmp (s, order) >= 0)
+        {
+          ok = 0;
+          break;
+        }
+
+      /* h = SHA512(R || A || M) mod L */
+      if (EVP_DigestInit_ex (md, EVP_sha512 (), NULL) != 1
+          || EVP_DigestUpdate (md, sig, 32) != 1
+          || EVP_DigestUpdate (md, pk, ED25519_PUBLIC_KEY_SIZE) != 1
+          || (msg_lens[i] > 0 && EVP_DigestUpdate (md, msgs[i], msg_lens[i]) != 1)
+          || EVP_DigestFinal_ex (md, buf, NULL) != 1
+          || BN_lebin2bn (buf, 64, h) == NULL
+          || BN_nnmod (h, h, order, bn) != 1)
+        goto err;
+
+      /* individual verification requires R + h A - s B to be the identity, including
+         its small-order component, that is the component of R + (h mod 8) A.
+         Without this check small-order components of several signatures could cancel out */
+      for (k = BN_is_bit_set (h, 0) | BN_is_bit_set (h, 1) << 1 | BN_is_bit_set (h, 2) << 2; k > 0; --k)
+        {
+          ge_add (&t, &u, &tr[MULTIPLES]);
+          ge_p1p1_to_p3 (&u, &t);
+        }
+      precompute (tu, &u, &c);
+      if (!torsion_free (tu, order_slide))
+        {
+          ok = 0;
+          break;
+        }
+
+      /* random non-zero 128-bit z */
+      memset (buf, 0, 32);
+      if (RAND_bytes (buf, 16) != 1)
+        goto err;
+      buf[0] |= 1;
+      if (BN_lebin2bn (buf, 32, z) == NULL)
+        goto err;
+      slide (sr, buf);
+
+      /* z * h for A, z * s is subtracted from the scalar of B */
+      if (BN_mod_mul (h, h, z, order, bn) != 1
+          || BN_bn2lebinpad (h, buf, 32) != 32
+          || BN_mod_mul (s, s, z, order, bn) != 1
+          || BN_mod_add (sum, sum, s, order, bn) != 1)
+        goto err;
+      slide (sr + 256, buf);
+    }
+
+  if (ok)
+    {
+      if (BN_mod_sub (sum, order, sum, order, bn) != 1 || BN_bn2lebinpad (sum, buf, 32) != 32)
+        goto err;
+      slide (slides, buf);
+      /* cofactorless, as individual verification: with no small-order components
+         in R + h A - s B, passing the batch implies that each of them is the identity */
+      multi_scalarmult (&r, 2 * n + 1, slides, table);
+      fe_sub (&r.Y, &r.Y, &r.Z);
+      ok = fe_iszero (&r.X) && fe_iszero (&r.Y);
+    }
+
+  BN_CTX_end (bn);
+  return ok;
+
+err:
+  BN_CTX_end (bn);
+  return -1;
+}
+
+int
+ed25519_verify_batch (size_t n,
+                      const uint8_t *pks, const uint8_t *sigs,
+                      const uint8_t *const *msgs, const size_t *msg_lens)
+{
+  ge_cached *table;
+  int8_t *slides;
+  BN_CTX *bn;
+  EVP_MD_CTX *md;
+  int r = -1;
+
+  if (n == 0)
+    return 1;
+  if (n > (SIZE_MAX / sizeof (ge_cached) / MULTIPLES - 1) / 2)
+    return -1;
+  table = malloc ((2 * n + 1) * MULTIPLES * sizeof (ge_cached));
+  slides = malloc ((2 * n + 1) * 256);
+  bn = BN_CTX_new ();
+  md = EVP_MD_CTX_new ();
+  if (table != NULL && slides != NULL && bn != NULL && md != NULL)
+    r = verify_batch (n, pks, sigs, msgs, msg_lens, table, slides, bn, md);
+  EVP_MD_CTX_free (md);
+  BN_CTX_free (bn);
+  free (slides);
+  free (table);
+  return r;
+}
+
+#else /* no 128-bit integers */
+
+int
+ed25519_verify_batch (size_t n,
+                      const uint8_t *pks, const uint8_t *sigs,
+                      const uint8_t *const *msgs, const size_t *msg_lens)
+{
+  (void) n, (void) pks, (void) sigs, (void) msgs, (void) msg_lens;
+  return -1;
+}
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef ED25519_BATCH_H
+#define ED25519_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ED25519_PUBLIC_KEY_SIZE 32
+#define ED25519_SIGNATURE_SIZE 64
+
+/* Randomized batch verification of n Ed25519 signatures:
+   public keys (pks) and signatures (sigs) are concatenated, msgs[i] has msg_lens[i] bytes.
+
+   Checks sum z_i * (R_i + h_i * A_i - s_i * B) == 0 for random odd 128-bit z_i
+   with one multi-scalar multiplication.  The equation is cofactorless, as in individual
+   verification, and the batch fails if any R_i + h_i * A_i - s_i * B has a small-order
+   component, so these components cannot cancel out between signatures.
+   Passing the batch implies that each signature passes individual verification
+   (except with probability 2^-127); when it fails, the signatures have to be verified
+   individually to find the invalid ones.
+
+   returns 1 if all signatures are valid, 0 if some signature is invalid or malformed
+   (non-canonical point encodings and s >= L are rejected), -1 on internal error
+   or if the platform has no 128-bit integers */
+int ed25519_verify_batch (size_t n,
+                          const uint8_t *pks, const uint8_t *sigs,
+                          const uint8_t *const *msgs, const size_t *msg_lens);
+
+#endif /* ED25519_BATCH_H */
@@ -0,0 +1,140 @@
+/* SHA512_* low-level API is deprecated in OpenSSL 3.0, but it is the only way
+   to reuse pre-hashed HMAC pads without allocating a context per call */
+#define OPENSSL_API_COMPAT 0x10100000L
+
+#include <string.h>
+#include <openssl/crypto.h>
+#include <openssl/sha.h>
+
+#include "hkdf.h"
+
+#define CHAIN_KEY_SIZE 32
+
+typedef struct
+{
+  SHA512_CTX inner;
+  SHA512_CTX outer;
+} hmac_key;
+
+static void
+hmac_init (hmac_key *k, const uint8_t *key, size_t key_len)
+{
+  uint8_t block[SHA512_CBLOCK];
+  uint8_t kh[SHA512_DIGEST_LENGTH];
+  size_t i;
+
+  if (key_len > SHA512_CBLOCK)
+    {
+      SHA512 (key, key_len, kh);
+      key = kh;
+      key_len = SHA512_DIGEST_LENGTH;
+    }
+  memset (block, 0x36, SHA512_CBLOCK);
+  for (i = 0; i < key_len; ++i)
+    block[i] ^= key[i];
+  SHA512_Init (&k->inner);
+  SHA512_Update (&k->inner, block, SHA512_CBLOCK);
+  memset (block, 0x5c, SHA512_CBLOCK);
+  for (i = 0; i < key_len; ++i)
+    block[i] ^= key[i];
+  SHA512_Init (&k->outer);
+  SHA512_Update (&k->outer, block, SHA512_CBLOCK);
+  OPENSSL_cleanse (block, sizeof block);
+  OPENSSL_cleanse (kh, sizeof kh);
+}
+
+/* out = HMAC(k, d1 || d2 || d3) */
+static void
+hmac (uint8_t *out, const hmac_key *k,
+      const uint8_t *d1, size_t l1,
+      const uint8_t *d2, size_t l2,
+      const uint8_t *d3, size_t l3)
+{
+  SHA512_CTX c = k->inner;
+
+  SHA512_Update (&c, d1, l1);
+  SHA512_Update (&c, d2, l2);
+  SHA512_Update (&c, d3, l3);
+  SHA512_Final (out, &c);
+  c = k->outer;
+  SHA512_Update (&c, out, SHA512_DIGEST_LENGTH);
+  SHA512_Final (out, &c);
+  OPENSSL_cleanse (&c, sizeof c);
+}
+
+/* prk is the key initialized with HKDF-Extract output */
+static void
+hkdf_expand (uint8_t *out, size_t out_len, const hmac_key *prk,
+             const uint8_t *info, size_t info_len)
+{
+  uint8_t t[SHA512_DIGEST_LENGTH];
+  size_t t_len = 0, n;
+  uint8_t i = 1;
+
+  while (out_len > 0)
+    {
+      hmac (t, prk, t, t_len, info, info_len, &i, 1);
+      t_len = SHA512_DIGEST_LENGTH;
+      n = out_len < t_len ? out_len : t_len;
+      memcpy (out, t, n);
+      out += n;
+      out_len -= n;
+      ++i;
+    }
+  OPENSSL_cleanse (t, sizeof t);
+}
+
+/* salt_key is the key initialized with salt */
+static void
+hkdf (uint8_t *out, size_t out_len, const hmac_key *salt_key,
+      const uint8_t *ikm, size_t ikm_len,
+      const uint8_t *info, size_t info_len)
+{
+  uint8_t prk[SHA512_DIGEST_LENGTH];
+  hmac_key prk_key;
+
+  hmac (prk, salt_key, ikm, ikm_len, NULL, 0, NULL, 0);
+  hmac_init (&prk_key, prk, sizeof prk);
+  hkdf_expand (out, out_len, &prk_key, info, info_len);
+  OPENSSL_cleanse (prk, sizeof prk);
+  OPENSSL_cleanse (&prk_key, sizeof prk_key);
+}
+
+int
+hkdf_sha512 (uint8_t *out, size_t out_len,
+             const uint8_t *salt, size_t salt_len,
+             const uint8_t *ikm, size_t ikm_len,
+             const uint8_t *info, size_t info_len)
+{
+  hmac_key salt_key;
+
+  if (out_len > HKDF_SHA512_MAX_SIZE)
+    return -1;
+  hmac_init (&salt_key, salt, salt_len);
+  hkdf (out, out_len, &salt_key, ikm, ikm_len, info, info_len);
+  OPENSSL_cleanse (&salt_key, sizeof salt_key);
+  return 0;
+}
+
+int
+hkdf_sha512_chain (uint8_t *out, size_t step_len, uint32_t n,
+                   const uint8_t *ck, size_t ck_len,
+                   const uint8_t *info, size_t info_len)
+{
+  hmac_key salt_key;
+  uint32_t i;
+
+  if (step_len < CHAIN_KEY_SIZE || step_len > HKDF_SHA512_MAX_SIZE)
+    return -1;
+  /* the pads for empty salt are computed once for all steps */
+  hmac_init (&salt_key, NULL, 0);
+  for (i = 0; i < n; ++i)
+    {
+      hkdf (out, step_len, &salt_key, ck, ck_len, info, info_len);
+      ck = out;
+      ck_len = CHAIN_KEY_SIZE;
+      out += step_len;
+    }
+  OPENSSL_cleanse (&salt_key, sizeof salt_key);
+  return 0;
+}
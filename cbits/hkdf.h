@@ -0,0 +1,24 @@
+#ifndef HKDF_H
+#define HKDF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HKDF_SHA512_MAX_SIZE (255 * 64)
+
+/* RFC 5869 HKDF with HMAC-SHA512, out_len <= HKDF_SHA512_MAX_SIZE.
+   returns 0 on success, -1 if out_len is too large */
+int hkdf_sha512 (uint8_t *out, size_t out_len,
+                 const uint8_t *salt, size_t salt_len,
+                 const uint8_t *ikm, size_t ikm_len,
+                 const uint8_t *info, size_t info_len);
+
+/* n steps of KDF chain with empty salt: out[i] = HKDF(salt = "", ikm = ck[i], info),
+   where ck[0] = ck and ck[i + 1] is the first 32 bytes of out[i].
+   out must have n * step_len bytes, 32 <= step_len <= HKDF_SHA512_MAX_SIZE.
+   returns 0 on success, -1 if step_len is out of range */
+int hkdf_sha512_chain (uint8_t *out, size_t step_len, uint32_t n,
+                       const uint8_t *ck, size_t ck_len,
+                       const uint8_t *info, size_t info_len);
+
+#endif /* HKDF_H */
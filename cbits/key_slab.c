@@ -0,0 +1,184 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/crypto.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+#include "key_slab.h"
+
+#define MIN_CLASS_SHIFT 5 /* 32 bytes */
+#define NUM_CLASSES 7     /* up to 2048 bytes */
+#define LARGE NUM_CLASSES
+#define CHUNK_SIZE (64 * 1024)
+/* attempts to take the lock before the thread yields */
+#define MAX_SPINS 256
+
+/* precedes each key, so that the key is 16-byte aligned and can be freed by pointer */
+typedef union
+{
+  struct
+  {
+    void *next;  /* next free slot, when the slot is free */
+    size_t size; /* key size, for large keys */
+    uint32_t cls;
+  } h;
+  max_align_t align;
+} header;
+
+static char slab_lock;
+static header *free_lists[NUM_CLASSES];
+static size_t count;
+
+static inline void
+yield (void)
+{
+#ifdef _WIN32
+  SwitchToThread ();
+#else
+  sched_yield ();
+#endif
+}
+
+static inline void
+lock (void)
+{
+  int spins = 0;
+  while (__atomic_test_and_set (&slab_lock, __ATOMIC_ACQUIRE))
+    if (++spins == MAX_SPINS)
+      {
+        spins = 0;
+        yield ();
+      }
+}
+
+static inline void
+unlock (void)
+{
+  __atomic_clear (&slab_lock, __ATOMIC_RELEASE);
+}
+
+static inline size_t
+class_size (uint32_t cls)
+{
+  return (size_t) 1 << (cls + MIN_CLASS_SHIFT);
+}
+
+static void *
+alloc_locked (size_t size)
+{
+  void *p;
+#ifdef _WIN32
+  p = VirtualAlloc (NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+  if (p != NULL)
+    VirtualLock (p, size);
+#else
+  p = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    return NULL;
+  /* best effort, locking fails when RLIMIT_MEMLOCK is exceeded */
+  mlock (p, size);
+#ifdef MADV_DONTDUMP
+  madvise (p, size, MADV_DONTDUMP);
+#endif
+#endif
+  return p;
+}
+
+/* allocates a new chunk of slots without the lock, the memory is zeroed by the system,
+ * returns the list of slots with its last slot in last, or NULL if allocation failed */
+static header *
+new_chunk (uint32_t cls, header **last)
+{
+  uint8_t *chunk = alloc_locked (CHUNK_SIZE);
+  if (chunk == NULL)
+    return NULL;
+  header *first = NULL;
+  const size_t slot_size = sizeof (header) + class_size (cls);
+  *last = (header *) chunk;
+  for (size_t off = 0; off + slot_size <= CHUNK_SIZE; off += slot_size)
+    {
+      header *s = (header *) (chunk + off);
+      s->h.cls = cls;
+      s->h.next = first;
+      first = s;
+    }
+  return first;
+}
+
+void *
+key_slab_alloc (size_t size)
+{
+  header *s;
+  uint32_t cls = 0;
+  while (cls < NUM_CLASSES && class_size (cls) < size)
+    cls++;
+  if (cls == LARGE)
+    {
+      s = calloc (1, sizeof (header) + size);
+      if (s == NULL)
+        return NULL;
+      s->h.cls = LARGE;
+      s->h.size = size;
+      lock ();
+      count++;
+      unlock ();
+      return s + 1;
+    }
+  lock ();
+  while ((s = free_lists[cls]) == NULL)
+    {
+      /* another thread can add slots while the chunk is allocated, they are all kept on the free list */
+      header *first, *last;
+      unlock ();
+      if ((first = new_chunk (cls, &last)) == NULL)
+        return NULL;
+      lock ();
+      last->h.next = free_lists[cls];
+      free_lists[cls] = first;
+    }
+  free_lists[cls] = s->h.next;
+  s->h.next = NULL;
+  count++;
+  unlock ();
+  return s + 1;
+}
+
+void
+key_slab_free (void *p)
+{
+  if (p == NULL)
+    return;
+  header *s = (header *) p - 1;
+  const uint32_t cls = s->h.cls;
+  if (cls == LARGE)
+    {
+      OPENSSL_cleanse (p, s->h.size);
+      free (s);
+      lock ();
+      count--;
+      unlock ();
+      return;
+    }
+  /* wiped outside of the lock, the slot is not shared until it is on the free list */
+  OPENSSL_cleanse (p, class_size (cls));
+  lock ();
+  s->h.next = free_lists[cls];
+  free_lists[cls] = s;
+  count--;
+  unlock ();
+}
+
+size_t
+key_slab_count (void)
+{
+  lock ();
+  const size_t n = count;
+  unlock ();
+  return n;
+}
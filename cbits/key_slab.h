@@ -0,0 +1,25 @@
+/*
+ * Process-wide slab allocator for small secret keys (KEM secret and shared keys).
+ *
+ * Keys are allocated from size classes of 32 to 2048 bytes, carved from chunks
+ * of memory that is locked (when RLIMIT_MEMLOCK allows it) and excluded from
+ * core dumps.  Freed keys are wiped and kept on the free list of their class,
+ * the chunks are never returned to the system.  Larger keys are allocated
+ * with malloc and wiped when freed.  All functions are thread-safe.
+ */
+
+#ifndef KEY_SLAB_H
+#define KEY_SLAB_H
+
+#include <stddef.h>
+
+/* returns zeroed memory of at least size bytes, or NULL if allocation failed */
+void *key_slab_alloc (size_t size);
+
+/* wipes the key and returns it to the free list, p can be NULL */
+void key_slab_free (void *p);
+
+/* number of allocated keys */
+size_t key_slab_count (void);
+
+#endif /* KEY_SLAB_H */
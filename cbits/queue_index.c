@@ -0,0 +1,313 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+
+#include "queue_index.h"
+
+#define MIN_CAPACITY 1024
+/* attempts to take the lock before the thread yields */
+#define MAX_SPINS 256
+/* slots moved from the old array on each insert while the index grows,
+ * the move completes before the new array is 3/4 full */
+#define MIGRATE_SLOTS 64
+
+enum
+{
+  EMPTY = 0,
+  USED = 1,
+  DELETED = 2
+};
+
+typedef struct
+{
+  uint8_t key[QUEUE_INDEX_ID_SIZE];
+  uint8_t val[QUEUE_INDEX_ID_SIZE];
+  uint8_t key_len;
+  uint8_t val_len;
+  uint8_t state;
+} slot;
+
+typedef struct
+{
+  size_t capacity; /* power of 2 */
+  size_t deleted;
+  slot *slots;
+} table;
+
+/* while the index grows, the keys are moved from old to new table by inserts,
+ * so no operation holds the lock for the whole rehash */
+struct queue_index
+{
+  char lock;
+  size_t count; /* in both tables */
+  table new;
+  table old; /* slots == NULL when not growing */
+  size_t migrated; /* number of old slots already moved */
+};
+
+static inline void
+yield (void)
+{
+#ifdef _WIN32
+  SwitchToThread ();
+#else
+  sched_yield ();
+#endif
+}
+
+static inline void
+lock (queue_index *qi)
+{
+  int spins = 0;
+  while (__atomic_test_and_set (&qi->lock, __ATOMIC_ACQUIRE))
+    if (++spins == MAX_SPINS)
+      {
+        spins = 0;
+        yield ();
+      }
+}
+
+static inline void
+unlock (queue_index *qi)
+{
+  __atomic_clear (&qi->lock, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t
+mix (uint64_t h)
+{
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  return h;
+}
+
+/* queue IDs are random, but the keys in lookups are chosen by clients,
+ * so all bytes of the key are mixed into the hash */
+static uint64_t
+hash (const uint8_t *key, size_t key_len)
+{
+  uint8_t buf[QUEUE_INDEX_ID_SIZE] = { 0 };
+  uint64_t w[QUEUE_INDEX_ID_SIZE / 8];
+  memcpy (buf, key, key_len);
+  memcpy (w, buf, sizeof w);
+  uint64_t h = key_len;
+  for (size_t i = 0; i < QUEUE_INDEX_ID_SIZE / 8; i++)
+    h = mix (h ^ w[i]);
+  return h;
+}
+
+/* returns the slot with the key, or the first free slot where it can be inserted */
+static slot *
+find (const table *t, const uint8_t *key, size_t key_len, int *found)
+{
+  const size_t mask = t->capacity - 1;
+  slot *free_slot = NULL;
+  for (size_t i = hash (key, key_len) & mask;; i = (i + 1) & mask)
+    {
+      slot *s = &t->slots[i];
+      if (s->state == EMPTY)
+        {
+          *found = 0;
+          return free_slot ? free_slot : s;
+        }
+      if (s->state == DELETED)
+        {
+          if (!free_slot)
+            free_slot = s;
+        }
+      else if (s->key_len == key_len && memcmp (s->key, key, key_len) == 0)
+        {
+          *found = 1;
+          return s;
+        }
+    }
+}
+
+/* returns the slot with the key and its table, or NULL */
+static slot *
+find_used (queue_index *qi, const uint8_t *key, size_t key_len, table **t)
+{
+  int found;
+  *t = &qi->new;
+  slot *s = find (*t, key, key_len, &found);
+  if (!found && qi->old.slots != NULL)
+    {
+      *t = &qi->old;
+      s = find (*t, key, key_len, &found);
+    }
+  return found ? s : NULL;
+}
+
+/* moves the next slots from the old table, old slots become deleted,
+ * so that the probe sequences of the remaining keys are not broken */
+static void
+migrate (queue_index *qi, size_t n)
+{
+  for (; n > 0 && qi->migrated < qi->old.capacity; n--, qi->migrated++)
+    {
+      slot *s = &qi->old.slots[qi->migrated];
+      if (s->state == USED)
+        {
+          int found;
+          slot *d = find (&qi->new, s->key, s->key_len, &found);
+          if (d->state == DELETED)
+            qi->new.deleted--;
+          *d = *s;
+          s->state = DELETED;
+        }
+    }
+}
+
+/* the array for the next table is allocated without the lock,
+ * returns -1 if allocation failed */
+static int
+grow (queue_index *qi)
+{
+  /* load factor (including deleted slots) is kept below 3/4 */
+  while (qi->old.slots == NULL && (qi->count + qi->new.deleted + 1) * 4 > qi->new.capacity * 3)
+    {
+      const slot *const current = qi->new.slots;
+      const size_t capacity = (qi->count + 1) * 2 > qi->new.capacity ? qi->new.capacity * 2 : qi->new.capacity;
+      unlock (qi);
+      slot *slots = calloc (capacity, sizeof (slot));
+      lock (qi);
+      if (slots == NULL)
+        return -1;
+      if (qi->new.slots != current || qi->old.slots != NULL)
+        {
+          /* another thread started growing the index */
+          unlock (qi);
+          free (slots);
+          lock (qi);
+          continue;
+        }
+      qi->old = qi->new;
+      qi->new.capacity = capacity;
+      qi->new.deleted = 0;
+      qi->new.slots = slots;
+      qi->migrated = 0;
+    }
+  return 0;
+}
+
+queue_index *
+queue_index_new (void)
+{
+  queue_index *qi = calloc (1, sizeof (queue_index));
+  if (qi == NULL)
+    return NULL;
+  qi->new.slots = calloc (MIN_CAPACITY, sizeof (slot));
+  if (qi->new.slots == NULL)
+    {
+      free (qi);
+      return NULL;
+    }
+  qi->new.capacity = MIN_CAPACITY;
+  return qi;
+}
+
+void
+queue_index_free (queue_index *qi)
+{
+  if (qi == NULL)
+    return;
+  free (qi->new.slots);
+  free (qi->old.slots);
+  free (qi);
+}
+
+int
+queue_index_insert (queue_index *qi, const uint8_t *key, size_t key_len, const uint8_t *val, size_t val_len)
+{
+  if (key_len > QUEUE_INDEX_ID_SIZE || val_len > QUEUE_INDEX_ID_SIZE)
+    return -1;
+  int r = 1, found = 0;
+  slot *old = NULL;
+  lock (qi);
+  if (grow (qi) != 0)
+    r = -1;
+  else
+    {
+      if (qi->old.slots != NULL)
+        {
+          find (&qi->old, key, key_len, &found);
+          migrate (qi, MIGRATE_SLOTS);
+          if (qi->migrated == qi->old.capacity)
+            {
+              /* freed after unlock */
+              old = qi->old.slots;
+              qi->old.slots = NULL;
+            }
+        }
+      slot *s = found ? NULL : find (&qi->new, key, key_len, &found);
+      if (found)
+        r = 0;
+      else
+        {
+          if (s->state == DELETED)
+            qi->new.deleted--;
+          memcpy (s->key, key, key_len);
+          memcpy (s->val, val, val_len);
+          s->key_len = (uint8_t) key_len;
+          s->val_len = (uint8_t) val_len;
+          s->state = USED;
+          qi->count++;
+        }
+    }
+  unlock (qi);
+  free (old);
+  return r;
+}
+
+int
+queue_index_lookup (queue_index *qi, const uint8_t *key, size_t key_len, uint8_t *val)
+{
+  if (key_len > QUEUE_INDEX_ID_SIZE)
+    return -1;
+  int r = -1;
+  table *t;
+  lock (qi);
+  const slot *s = find_used (qi, key, key_len, &t);
+  if (s != NULL)
+    {
+      memcpy (val, s->val, s->val_len);
+      r = s->val_len;
+    }
+  unlock (qi);
+  return r;
+}
+
+int
+queue_index_delete (queue_index *qi, const uint8_t *key, size_t key_len)
+{
+  if (key_len > QUEUE_INDEX_ID_SIZE)
+    return 0;
+  table *t;
+  lock (qi);
+  slot *s = find_used (qi, key, key_len, &t);
+  if (s != NULL)
+    {
+      s->state = DELETED;
+      t->deleted++;
+      qi->count--;
+    }
+  unlock (qi);
+  return s != NULL;
+}
+
+size_t
+queue_index_count (queue_index *qi)
+{
+  lock (qi);
+  const size_t n = qi->count;
+  unlock (qi);
+  return n;
+}
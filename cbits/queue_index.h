@@ -0,0 +1,38 @@
+/*
+ * Open-addressing hash index of SMP queue IDs (e.g., sender ID -> recipient ID).
+ *
+ * Keys and values are IDs of at most QUEUE_INDEX_ID_SIZE bytes stored in
+ * fixed-size slots of one native array, so they are not traced by GHC GC.
+ * Operations are serialized with a lock that yields the thread after a bounded spin,
+ * they can be called from any thread. The lock is not held during allocation,
+ * and the keys are moved to the grown array a few at a time by the inserts.
+ */
+
+#ifndef QUEUE_INDEX_H
+#define QUEUE_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define QUEUE_INDEX_ID_SIZE 24
+
+typedef struct queue_index queue_index;
+
+/* returns NULL if allocation failed */
+queue_index *queue_index_new (void);
+
+void queue_index_free (queue_index *qi);
+
+/* returns 1 if added, 0 if the key is already present,
+ * -1 if the key or value is too long or allocation failed */
+int queue_index_insert (queue_index *qi, const uint8_t *key, size_t key_len, const uint8_t *val, size_t val_len);
+
+/* returns value length and copies the value, or -1 if not found */
+int queue_index_lookup (queue_index *qi, const uint8_t *key, size_t key_len, uint8_t *val);
+
+/* returns 1 if deleted, 0 if not found */
+int queue_index_delete (queue_index *qi, const uint8_t *key, size_t key_len);
+
+size_t queue_index_count (queue_index *qi);
+
+#endif /* QUEUE_INDEX_H */
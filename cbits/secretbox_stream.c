@@ -0,0 +1,504 @@
+#include <string.h>
+#include <openssl/crypto.h>
+
+#include "secretbox_stream.h"
+
+#define SALSA_BLOCK_SIZE 64
+#define POLY_BLOCK_SIZE 16
+#define MASK26 0x3ffffff
+
+typedef struct
+{
+  uint32_t r[5];
+  uint32_t h[5];
+  uint32_t pad[4];
+  size_t leftover;
+  uint8_t buffer[POLY_BLOCK_SIZE];
+} poly1305;
+
+struct sb_stream
+{
+  uint32_t input[16];
+  uint8_t keystream[SALSA_BLOCK_SIZE];
+  size_t ks_pos; /* used bytes of the keystream block */
+  poly1305 poly;
+};
+
+static inline uint32_t
+load32 (const uint8_t *s)
+{
+  return (uint32_t) s[0] | (uint32_t) s[1] << 8 | (uint32_t) s[2] << 16 | (uint32_t) s[3] << 24;
+}
+
+static inline void
+store32 (uint8_t *s, uint32_t x)
+{
+  s[0] = (uint8_t) x;
+  s[1] = (uint8_t) (x >> 8);
+  s[2] = (uint8_t) (x >> 16);
+  s[3] = (uint8_t) (x >> 24);
+}
+
+/* Salsa20 */
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define QR(a, b, c, d)          \
+  x[b] ^= ROTL32 (x[a] + x[d], 7);  \
+  x[c] ^= ROTL32 (x[b] + x[a], 9);  \
+  x[d] ^= ROTL32 (x[c] + x[b], 13); \
+  x[a] ^= ROTL32 (x[d] + x[c], 18)
+
+static void
+salsa20_rounds (uint32_t *x)
+{
+  int i;
+  for (i = 0; i < 10; ++i)
+    {
+      QR (0, 4, 8, 12);
+      QR (5, 9, 13, 1);
+      QR (10, 14, 2, 6);
+      QR (15, 3, 7, 11);
+      QR (0, 1, 2, 3);
+      QR (5, 6, 7, 4);
+      QR (10, 11, 8, 9);
+      QR (15, 12, 13, 14);
+    }
+}
+
+static void
+salsa20_setup (uint32_t *x, const uint8_t *key, const uint8_t *in)
+{
+  int i;
+  x[0] = 0x61707865;
+  x[5] = 0x3320646e;
+  x[10] = 0x79622d32;
+  x[15] = 0x6b206574;
+  for (i = 0; i < 4; ++i)
+    {
+      x[1 + i] = load32 (key + 4 * i);
+      x[11 + i] = load32 (key + 16 + 4 * i);
+      x[6 + i] = load32 (in + 4 * i);
+    }
+}
+
+static void
+hsalsa20 (uint8_t *out, const uint8_t *key, const uint8_t *in)
+{
+  static const int words[8] = { 0, 5, 10, 15, 6, 7, 8, 9 };
+  uint32_t x[16];
+  int i;
+  salsa20_setup (x, key, in);
+  salsa20_rounds (x);
+  for (i = 0; i < 8; ++i)
+    store32 (out + 4 * i, x[words[i]]);
+  OPENSSL_cleanse (x, sizeof x);
+}
+
+static void
+salsa20_block (sb_stream *st, uint8_t *out)
+{
+  uint32_t x[16];
+  int i;
+  memcpy (x, st->input, sizeof x);
+  salsa20_rounds (x);
+  for (i = 0; i < 16; ++i)
+    store32 (out + 4 * i, x[i] + st->input[i]);
+  if (++st->input[8] == 0)
+    ++st->input[9];
+  OPENSSL_cleanse (x, sizeof x);
+}
+
+static void
+salsa20_xor (sb_stream *st, uint8_t *buf, size_t len)
+{
+  size_t i, n;
+
+  if (st->ks_pos < SALSA_BLOCK_SIZE)
+    {
+      n = SALSA_BLOCK_SIZE - st->ks_pos;
+      if (n > len)
+        n = len;
+      for (i = 0; i < n; ++i)
+        buf[i] ^= st->keystream[st->ks_pos + i];
+      st->ks_pos += n;
+      buf += n;
+      len -= n;
+    }
+  while (len > 0)
+    {
+      salsa20_block (st, st->keystream);
+      n = len < SALSA_BLOCK_SIZE ? len : SALSA_BLOCK_SIZE;
+      for (i = 0; i < n; ++i)
+        buf[i] ^= st->keystream[i];
+      st->ks_pos = n;
+      buf += n;
+      len -= n;
+    }
+}
+
+/* Poly1305, 26-bit limbs */
+
+static void
+poly1305_init (poly1305 *p, const uint8_t *key)
+{
+  int i;
+  p->r[0] = load32 (key) & 0x3ffffff;
+  p->r[1] = (load32 (key + 3) >> 2) & 0x3ffff03;
+  p->r[2] = (load32 (key + 6) >> 4) & 0x3ffc0ff;
+  p->r[3] = (load32 (key + 9) >> 6) & 0x3f03fff;
+  p->r[4] = (load32 (key + 12) >> 8) & 0x00fffff;
+  for (i = 0; i < 5; ++i)
+    p->h[i] = 0;
+  for (i = 0; i < 4; ++i)
+    p->pad[i] = load32 (key + 16 + 4 * i);
+  p->leftover = 0;
+}
+
+static void
+poly1305_blocks (poly1305 *p, const uint8_t *m, size_t len, uint32_t hibit)
+{
+  const uint32_t r0 = p->r[0], r1 = p->r[1], r2 = p->r[2], r3 = p->r[3], r4 = p->r[4];
+  const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+  uint32_t h0 = p->h[0], h1 = p->h[1], h2 = p->h[2], h3 = p->h[3], h4 = p->h[4];
+  uint64_t d0, d1, d2, d3, d4;
+  uint32_t c;
+
+  while (len >= POLY_BLOCK_SIZE)
+    {
+      h0 += load32 (m) & MASK26;
+      h1 += (load32 (m + 3) >> 2) & MASK26;
+      h2 += (load32 (m + 6) >> 4) & MASK26;
+      h3 += (load32 (m + 9) >> 6) & MASK26;
+      h4 += (load32 (m + 12) >> 8) | hibit;
+
+      d0 = (uint64_t) h0 * r0 + (uint64_t) h1 * s4 + (uint64_t) h2 * s3 + (uint64_t) h3 * s2 + (uint64_t) h4 * s1;
+      d1 = (uint64_t) h0 * r1 + (uint64_t) h1 * r0 + (uint64_t) h2 * s4 + (uint64_t) h3 * s3 + (uint64_t) h4 * s2;
+      d2 = (uint64_t) h0 * r2 + (uint64_t) h1 * r1 + (uint64_t) h2 * r0 + (uint64_t) h3 * s4 + (uint64_t) h4 * s3;
+      d3 = (uint64_t) h0 * r3 + (uint64_t) h1 * r2 + (uint64_t) h2 * r1 + (uint64_t) h3 * r0 + (uint64_t) h4 * s4;
+      d4 = (uint64_t) h0 * r4 + (uint64_t) h1 * r3 + (uint64_t) h2 * r2 + (uint64_t) h3 * r1 + (uint64_t) h4 * r0;
+
+      c = (uint32_t) (d0 >> 26);
+      h0 = (uint32_t) d0 & MASK26;
+      d1 += c;
+      c = (uint32_t) (d1 >> 26);
+      h1 = (uint32_t) d1 & MASK26;
+      d2 += c;
+      c = (uint32_t) (d2 >> 26);
+      h2 = (uint32_t) d2 & MASK26;
+      d3 += c;
+      c = (uint32_t) (d3 >> 26);
+      h3 = (uint32_t) d3 & MASK26;
+      d4 += c;
+      c = (uint32_t) (d4 >> 26);
+      h4 = (uint32_t) d4 & MASK26;
+      h0 += c * 5;
+      c = h0 >> 26;
+      h0 &= MASK26;
+      h1 += c;
+
+      m += POLY_BLOCK_SIZE;
+      len -= POLY_BLOCK_SIZE;
+    }
+  p->h[0] = h0;
+  p->h[1] = h1;
+  p->h[2] = h2;
+  p->h[3] = h3;
+  p->h[4] = h4;
+}
+
+static void
+poly1305_update (poly1305 *p, const uint8_t *m, size_t len)
+{
+  size_t n;
+
+  if (p->leftover > 0)
+    {
+      n = POLY_BLOCK_SIZE - p->leftover;
+      if (n > len)
+        n = len;
+      memcpy (p->buffer + p->leftover, m, n);
+      p->leftover += n;
+      m += n;
+      len -= n;
+      if (p->leftover < POLY_BLOCK_SIZE)
+        return;
+      poly1305_blocks (p, p->buffer, POLY_BLOCK_SIZE, 1u << 24);
+      p->leftover = 0;
+    }
+  n = len & ~(size_t) (POLY_BLOCK_SIZE - 1);
+  if (n > 0)
+    {
+      poly1305_blocks (p, m, n, 1u << 24);
+      m += n;
+      len -= n;
+    }
+  if (len > 0)
+    {
+      memcpy (p->buffer, m, len);
+      p->leftover = len;
+    }
+}
+
+static void
+poly1305_carry (uint32_t *h)
+{
+  uint32_t c;
+  c = h[0] >> 26;
+  h[0] &= MASK26;
+  h[1] += c;
+  c = h[1] >> 26;
+  h[1] &= MASK26;
+  h[2] += c;
+  c = h[2] >> 26;
+  h[2] &= MASK26;
+  h[3] += c;
+  c = h[3] >> 26;
+  h[3] &= MASK26;
+  h[4] += c;
+  c = h[4] >> 26;
+  h[4] &= MASK26;
+  h[0] += c * 5;
+  c = h[0] >> 26;
+  h[0] &= MASK26;
+  h[1] += c;
+}
+
+/* h = h * a mod 2^130 - 5 */
+static void
+poly1305_mul (uint32_t *h, const uint32_t *a)
+{
+  const uint32_t s1 = a[1] * 5, s2 = a[2] * 5, s3 = a[3] * 5, s4 = a[4] * 5;
+  uint64_t d[5];
+  uint32_t c;
+  int i;
+
+  d[0] = (uint64_t) h[0] * a[0] + (uint64_t) h[1] * s4 + (uint64_t) h[2] * s3 + (uint64_t) h[3] * s2 + (uint64_t) h[4] * s1;
+  d[1] = (uint64_t) h[0] * a[1] + (uint64_t) h[1] * a[0] + (uint64_t) h[2] * s4 + (uint64_t) h[3] * s3 + (uint64_t) h[4] * s2;
+  d[2] = (uint64_t) h[0] * a[2] + (uint64_t) h[1] * a[1] + (uint64_t) h[2] * a[0] + (uint64_t) h[3] * s4 + (uint64_t) h[4] * s3;
+  d[3] = (uint64_t) h[0] * a[3] + (uint64_t) h[1] * a[2] + (uint64_t) h[2] * a[1] + (uint64_t) h[3] * a[0] + (uint64_t) h[4] * s4;
+  d[4] = (uint64_t) h[0] * a[4] + (uint64_t) h[1] * a[3] + (uint64_t) h[2] * a[2] + (uint64_t) h[3] * a[1] + (uint64_t) h[4] * a[0];
+
+  c = 0;
+  for (i = 0; i < 5; ++i)
+    {
+      d[i] += c;
+      c = (uint32_t) (d[i] >> 26);
+      h[i] = (uint32_t) d[i] & MASK26;
+    }
+  h[0] += c * 5;
+  c = h[0] >> 26;
+  h[0] &= MASK26;
+  h[1] += c;
+}
+
+/* out = r^n */
+static void
+poly1305_pow (uint32_t *out, const uint32_t *r, uint64_t n)
+{
+  uint32_t x[5];
+  memcpy (x, r, sizeof x);
+  out[0] = 1;
+  out[1] = out[2] = out[3] = out[4] = 0;
+  while (n > 0)
+    {
+      if (n & 1)
+        poly1305_mul (out, x);
+      n >>= 1;
+      if (n > 0)
+        poly1305_mul (x, x);
+    }
+  OPENSSL_cleanse (x, sizeof x);
+}
+
+static void
+poly1305_finish (poly1305 *p, uint8_t *tag)
+{
+  uint32_t h0, h1, h2, h3, h4, c;
+  uint32_t g0, g1, g2, g3, g4, mask;
+  uint64_t f;
+
+  if (p->leftover > 0)
+    {
+      p->buffer[p->leftover] = 1;
+      memset (p->buffer + p->leftover + 1, 0, POLY_BLOCK_SIZE - p->leftover - 1);
+      poly1305_blocks (p, p->buffer, POLY_BLOCK_SIZE, 0);
+    }
+
+  h0 = p->h[0];
+  h1 = p->h[1];
+  h2 = p->h[2];
+  h3 = p->h[3];
+  h4 = p->h[4];
+
+  c = h1 >> 26;
+  h1 &= MASK26;
+  h2 += c;
+  c = h2 >> 26;
+  h2 &= MASK26;
+  h3 += c;
+  c = h3 >> 26;
+  h3 &= MASK26;
+  h4 += c;
+  c = h4 >> 26;
+  h4 &= MASK26;
+  h0 += c * 5;
+  c = h0 >> 26;
+  h0 &= MASK26;
+  h1 += c;
+
+  /* h - p = h + 5 - 2^130 */
+  g0 = h0 + 5;
+  c = g0 >> 26;
+  g0 &= MASK26;
+  g1 = h1 + c;
+  c = g1 >> 26;
+  g1 &= MASK26;
+  g2 = h2 + c;
+  c = g2 >> 26;
+  g2 &= MASK26;
+  g3 = h3 + c;
+  c = g3 >> 26;
+  g3 &= MASK26;
+  g4 = h4 + c - (1u << 26);
+
+  /* select h if h < p, or h - p if h >= p */
+  mask = (g4 >> 31) - 1;
+  g0 &= mask;
+  g1 &= mask;
+  g2 &= mask;
+  g3 &= mask;
+  g4 &= mask;
+  mask = ~mask;
+  h0 = (h0 & mask) | g0;
+  h1 = (h1 & mask) | g1;
+  h2 = (h2 & mask) | g2;
+  h3 = (h3 & mask) | g3;
+  h4 = (h4 & mask) | g4;
+
+  /* h = (h + pad) mod 2^128 */
+  h0 = h0 | (h1 << 26);
+  h1 = (h1 >> 6) | (h2 << 20);
+  h2 = (h2 >> 12) | (h3 << 14);
+  h3 = (h3 >> 18) | (h4 << 8);
+  f = (uint64_t) h0 + p->pad[0];
+  store32 (tag, (uint32_t) f);
+  f = (uint64_t) h1 + p->pad[1] + (f >> 32);
+  store32 (tag + 4, (uint32_t) f);
+  f = (uint64_t) h2 + p->pad[2] + (f >> 32);
+  store32 (tag + 8, (uint32_t) f);
+  f = (uint64_t) h3 + p->pad[3] + (f >> 32);
+  store32 (tag + 12, (uint32_t) f);
+}
+
+size_t
+sb_stream_size (void)
+{
+  return sizeof (sb_stream);
+}
+
+void
+sb_stream_init (sb_stream *st, const uint8_t *key, const uint8_t *nonce)
+{
+  static const uint8_t zero[16] = { 0 };
+  uint8_t k1[SB_STREAM_KEY_SIZE], k2[SB_STREAM_KEY_SIZE];
+  uint8_t in[16];
+
+  hsalsa20 (k1, key, zero);
+  hsalsa20 (k2, k1, nonce);
+  memcpy (in, nonce + 16, 8);
+  memset (in + 8, 0, 8);
+  salsa20_setup (st->input, k2, in);
+  /* the first 32 bytes of the keystream are Poly1305 key */
+  salsa20_block (st, st->keystream);
+  poly1305_init (&st->poly, st->keystream);
+  st->ks_pos = 32;
+  OPENSSL_cleanse (k1, sizeof k1);
+  OPENSSL_cleanse (k2, sizeof k2);
+}
+
+void
+sb_stream_encrypt (sb_stream *st, uint8_t *buf, size_t len)
+{
+  salsa20_xor (st, buf, len);
+  poly1305_update (&st->poly, buf, len);
+}
+
+void
+sb_stream_decrypt (sb_stream *st, uint8_t *buf, size_t len)
+{
+  poly1305_update (&st->poly, buf, len);
+  salsa20_xor (st, buf, len);
+}
+
+void
+sb_stream_xor_at (const sb_stream *st, uint64_t offset, uint8_t *buf, size_t len)
+{
+  sb_stream s;
+  uint64_t block;
+  size_t n;
+
+  /* the message starts after the Poly1305 key in the first block */
+  offset += 32;
+  block = offset / SALSA_BLOCK_SIZE;
+  memcpy (s.input, st->input, sizeof s.input);
+  s.input[8] = (uint32_t) block;
+  s.input[9] = (uint32_t) (block >> 32);
+  s.ks_pos = SALSA_BLOCK_SIZE;
+  n = (size_t) (offset % SALSA_BLOCK_SIZE);
+  if (n > 0)
+    {
+      salsa20_block (&s, s.keystream);
+      s.ks_pos = n;
+    }
+  salsa20_xor (&s, buf, len);
+  OPENSSL_cleanse (s.input, sizeof s.input);
+  OPENSSL_cleanse (s.keystream, sizeof s.keystream);
+}
+
+void
+sb_stream_auth_update (sb_stream *st, const uint8_t *buf, size_t len)
+{
+  poly1305_update (&st->poly, buf, len);
+}
+
+void
+sb_stream_auth_part (const sb_stream *st, const uint8_t *buf, size_t len, uint32_t *part)
+{
+  poly1305 p;
+  memcpy (p.r, st->poly.r, sizeof p.r);
+  memset (p.h, 0, sizeof p.h);
+  poly1305_blocks (&p, buf, len, 1u << 24);
+  memcpy (part, p.h, sizeof p.h);
+  OPENSSL_cleanse (&p, sizeof p);
+}
+
+int
+sb_stream_auth_combine (sb_stream *st, const uint32_t *part, size_t len)
+{
+  uint32_t rn[5];
+  int i;
+
+  if (st->poly.leftover > 0 || len % POLY_BLOCK_SIZE != 0)
+    return -1;
+  /* sum of the blocks m1..mn is m1 * r^n + ... + mn * r,
+     so the preceding sum is multiplied by r^n before adding the part */
+  poly1305_pow (rn, st->poly.r, len / POLY_BLOCK_SIZE);
+  poly1305_mul (st->poly.h, rn);
+  for (i = 0; i < 5; ++i)
+    st->poly.h[i] += part[i];
+  poly1305_carry (st->poly.h);
+  OPENSSL_cleanse (rn, sizeof rn);
+  return 0;
+}
+
+void
+sb_stream_auth (sb_stream *st, uint8_t *tag)
+{
+  poly1305_finish (&st->poly, tag);
+}
+
+void
+sb_stream_clear (sb_stream *st)
+{
+  OPENSSL_cleanse (st, sizeof (sb_stream));
+}
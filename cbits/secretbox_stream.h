@@ -0,0 +1,52 @@
+/*
+ * Streaming XSalsa20-Poly1305 compatible with Simplex.Messaging.Crypto.Lazy
+ * (SbState): the key is first hashed with HSalsa20 over the zero block,
+ * as in NaCl crypto_box_beforenm, and then used as crypto_secretbox key.
+ *
+ * The data is encrypted or decrypted in place, in chunks of any size,
+ * and the authentication tag is computed over the ciphertext.
+ */
+
+#ifndef SECRETBOX_STREAM_H
+#define SECRETBOX_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SB_STREAM_KEY_SIZE 32
+#define SB_STREAM_NONCE_SIZE 24
+#define SB_STREAM_TAG_SIZE 16
+#define SB_STREAM_PART_SIZE 20
+
+typedef struct sb_stream sb_stream;
+
+size_t sb_stream_size (void);
+
+void sb_stream_init (sb_stream *st, const uint8_t *key, const uint8_t *nonce);
+
+void sb_stream_encrypt (sb_stream *st, uint8_t *buf, size_t len);
+
+void sb_stream_decrypt (sb_stream *st, uint8_t *buf, size_t len);
+
+/* XORs the buffer with the keystream at the offset of the buffer in the message,
+ * without changing the state, so it can be called concurrently for different parts */
+void sb_stream_xor_at (const sb_stream *st, uint64_t offset, uint8_t *buf, size_t len);
+
+/* adds the ciphertext to the tag */
+void sb_stream_auth_update (sb_stream *st, const uint8_t *buf, size_t len);
+
+/* computes the partial tag sum of the ciphertext part of the message, the length must be
+ * a multiple of 16 bytes; it does not change the state, so it can be called concurrently */
+void sb_stream_auth_part (const sb_stream *st, const uint8_t *buf, size_t len, uint32_t *part);
+
+/* adds the partial sum of the next len bytes of the ciphertext to the tag,
+ * returns -1 if the previous data or len are not a multiple of 16 bytes */
+int sb_stream_auth_combine (sb_stream *st, const uint32_t *part, size_t len);
+
+/* the state must not be used after the tag is computed */
+void sb_stream_auth (sb_stream *st, uint8_t *tag);
+
+/* wipes the keys */
+void sb_stream_clear (sb_stream *st);
+
+#endif /* SECRETBOX_STREAM_H */
@@ -10,6 +10,16 @@
 
 #include "sha512.h"
 
+#include "sntrup761_stats.h"
+
+/* counts calls and time of instrumented function when stats are enabled */
+#define STATS(counter, call) \
+do { \
+  uint64_t stats_start = sntrup761_stats_begin (); \
+  call; \
+  sntrup761_stats_end (counter, stats_start); \
+} while(0)
+
 /* from supercop-20201130/crypto_sort/int32/portable4/int32_minmax.inc */
 #define int32_MINMAX(a,b) \
 do { \
@@ -656,7 +666,7 @@ Short_fromlist (small * out, const uint32_t * in)
     L[i] = in[i] & (uint32_t) - 2;
   for (i = w; i < p; ++i)
     L[i] = (in[i] & (uint32_t) - 3) | 1;
-  crypto_sort_uint32 (L, p);
+  STATS (SNTRUP761_STAT_SORT, crypto_sort_uint32 (L, p));
   for (i = 0; i < p; ++i)
     out[i] = (L[i] & 3) - 1;
 }
@@ -676,7 +686,7 @@ Hash_prefix (unsigned char *out, int b, const unsigned char *in, int inlen)
   x[0] = b;
   for (i = 0; i < inlen; ++i)
     x[i + 1] = in[i];
-  crypto_hash_sha512 (h, x, inlen + 1);
+  STATS (SNTRUP761_STAT_HASH, crypto_hash_sha512 (h, x, inlen + 1));
   for (i = 0; i < 32; ++i)
     out[i] = h[i];
 }
@@ -726,16 +736,19 @@ KeyGen (Fq * h, small * f, small * ginv, void *random_ctx,
 {
   small g[p];
   Fq finv[p];
+  int r;
 
   for (;;)
     {
       Small_random (g, random_ctx, random);
-      if (R3_recip (ginv, g) == 0)
+      STATS (SNTRUP761_STAT_RECIP, r = R3_recip (ginv, g));
+      if (r == 0)
         break;
+      sntrup761_stats_retry ();
     }
   Short_random (f, random_ctx, random);
-  Rq_recip3 (finv, f);          /* always works */
-  Rq_mult_small (h, finv, g);
+  STATS (SNTRUP761_STAT_RECIP, Rq_recip3 (finv, f));    /* always works */
+  STATS (SNTRUP761_STAT_MULT, Rq_mult_small (h, finv, g));
 }
 
 /* c = Encrypt(r,h) */
@@ -744,7 +757,7 @@ Encrypt (Fq * c, const small * r, const Fq * h)
 {
   Fq hr[p];
 
-  Rq_mult_small (hr, h, r);
+  STATS (SNTRUP761_STAT_MULT, Rq_mult_small (hr, h, r));
   Round (c, hr);
 }
 
@@ -759,10 +772,10 @@ Decrypt (small * r, const Fq * c, const small * f, const small * ginv)
   int mask;
   int i;
 
-  Rq_mult_small (cf, c, f);
+  STATS (SNTRUP761_STAT_MULT, Rq_mult_small (cf, c, f));
   Rq_mult3 (cf3, cf);
   R3_fromRq (e, cf3);
-  R3_mult (ev, e, ginv);
+  STATS (SNTRUP761_STAT_MULT, R3_mult (ev, e, ginv));
 
   mask = Weightw_mask (ev);     /* 0 if weight w, else -1 */
   for (i = 0; i < w; ++i)
@@ -892,7 +905,7 @@ ZKeyGen (unsigned char *pk, unsigned char *sk, void *random_ctx,
   small f[p], v[p];
 
   KeyGen (h, f, v, random_ctx, random);
-  Rq_encode (pk, h);
+  STATS (SNTRUP761_STAT_ENCODE, Rq_encode (pk, h));
   Small_encode (sk, f);
   sk += Small_bytes;
   Small_encode (sk, v);
@@ -904,9 +917,9 @@ ZEncrypt (unsigned char *C, const Inputs r, const unsigned char *pk)
 {
   Fq h[p];
   Fq c[p];
-  Rq_decode (h, pk);
+  STATS (SNTRUP761_STAT_ENCODE, Rq_decode (h, pk));
   Encrypt (c, r, h);
-  Rounded_encode (C, c);
+  STATS (SNTRUP761_STAT_ENCODE, Rounded_encode (C, c));
 }
 
 /* r = ZDecrypt(C,sk) */
@@ -919,7 +932,7 @@ ZDecrypt (Inputs r, const unsigned char *C, const unsigned char *sk)
   Small_decode (f, sk);
   sk += Small_bytes;
   Small_decode (v, sk);
-  Rounded_decode (c, C);
+  STATS (SNTRUP761_STAT_ENCODE, Rounded_decode (c, C));
   Decrypt (r, c, f, v);
 }
 
@@ -964,6 +977,7 @@ void
 sntrup761_keypair (unsigned char *pk, unsigned char *sk, void *random_ctx,
                    sntrup761_random_func * random)
 {
+  uint64_t stats_start = sntrup761_stats_begin ();
   int i;
 
   ZKeyGen (pk, sk, random_ctx, random);
@@ -973,6 +987,7 @@ sntrup761_keypair (unsigned char *pk, unsigned char *sk, void *random_ctx,
   random (random_ctx, Inputs_bytes, sk);
   sk += Inputs_bytes;
   Hash_prefix (sk, 4, pk, PublicKeys_bytes);
+  sntrup761_stats_end (SNTRUP761_STAT_KEYPAIR, stats_start);
 }
 
 /* c,r_enc = Hide(r,pk,cache); cache is Hash4(pk) */
@@ -991,6 +1006,7 @@ void
 sntrup761_enc (unsigned char *c, unsigned char *k, const unsigned char *pk,
                void *random_ctx, sntrup761_random_func * random)
 {
+  uint64_t stats_start = sntrup761_stats_begin ();
   Inputs r;
   unsigned char r_enc[Inputs_bytes];
   unsigned char cache[Hash_bytes];
@@ -999,6 +1015,7 @@ sntrup761_enc (unsigned char *c, unsigned char *k, const unsigned char *pk,
   Inputs_random (r, random_ctx, random);
   Hide (c, r_enc, r, pk, cache);
   HashSession (k, 1, r_enc, c);
+  sntrup761_stats_end (SNTRUP761_STAT_ENC, stats_start);
 }
 
 /* 0 if matching ciphertext+confirm, else -1 */
@@ -1017,6 +1034,7 @@ Ciphertexts_diff_mask (const unsigned char *c, const unsigned char *c2)
 void
 sntrup761_dec (unsigned char *k, const unsigned char *c, const unsigned char *sk)
 {
+  uint64_t stats_start = sntrup761_stats_begin ();
   const unsigned char *pk = sk + SecretKeys_bytes;
   const unsigned char *rho = pk + PublicKeys_bytes;
   const unsigned char *cache = rho + Inputs_bytes;
@@ -1032,4 +1050,5 @@ sntrup761_dec (unsigned char *k, const unsigned char *c, const unsigned char *sk
   for (i = 0; i < Inputs_bytes; ++i)
     r_enc[i] ^= mask & (r_enc[i] ^ rho[i]);
   HashSession (k, 1 + mask, r_enc, c);
+  sntrup761_stats_end (SNTRUP761_STAT_DEC, stats_start);
 }
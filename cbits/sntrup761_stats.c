@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sntrup761_stats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define STATS_CYCLES 1
+#else
+#include <time.h>
+#define STATS_CYCLES 0
+#endif
+
+typedef struct thread_stats
+{
+  uint64_t counters[SNTRUP761_STATS_SIZE];
+  struct thread_stats *next;
+} thread_stats;
+
+static int stats_enabled = 0;
+
+/* all per-thread blocks, only ever prepended to */
+static thread_stats *all_stats = NULL;
+
+static _Thread_local thread_stats *my_stats = NULL;
+
+static inline uint64_t
+now (void)
+{
+#if STATS_CYCLES
+  return __rdtsc ();
+#else
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+static thread_stats *
+get_stats (void)
+{
+  thread_stats *s = my_stats;
+  if (s == NULL)
+    {
+      s = calloc (1, sizeof (thread_stats));
+      if (s == NULL)
+        return NULL;
+      s->next = __atomic_load_n (&all_stats, __ATOMIC_RELAXED);
+      while (!__atomic_compare_exchange_n (&all_stats, &s->next, s, 1,
+                                           __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+      my_stats = s;
+    }
+  return s;
+}
+
+/* counters are only written by the owning thread, atomics prevent torn reads in snapshot */
+static inline void
+add (thread_stats *s, int i, uint64_t n)
+{
+  __atomic_store_n (&s->counters[i], __atomic_load_n (&s->counters[i], __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+void
+sntrup761_stats_enable (int enable)
+{
+  __atomic_store_n (&stats_enabled, enable != 0, __ATOMIC_RELAXED);
+}
+
+int
+sntrup761_stats_enabled (void)
+{
+  return __atomic_load_n (&stats_enabled, __ATOMIC_RELAXED);
+}
+
+int
+sntrup761_stats_cycles (void)
+{
+  return STATS_CYCLES;
+}
+
+void
+sntrup761_stats_snapshot (uint64_t *out)
+{
+  thread_stats *s;
+  int i;
+
+  memset (out, 0, SNTRUP761_STATS_SIZE * sizeof (uint64_t));
+  for (s = __atomic_load_n (&all_stats, __ATOMIC_ACQUIRE); s != NULL; s = s->next)
+    for (i = 0; i < SNTRUP761_STATS_SIZE; ++i)
+      out[i] += __atomic_load_n (&s->counters[i], __ATOMIC_RELAXED);
+}
+
+/* returns 0 when disabled, sntrup761_stats_end ignores such calls */
+uint64_t
+sntrup761_stats_begin (void)
+{
+  if (!__atomic_load_n (&stats_enabled, __ATOMIC_RELAXED))
+    return 0;
+  return now ();
+}
+
+void
+sntrup761_stats_end (int counter, uint64_t start)
+{
+  thread_stats *s;
+
+  if (start == 0 || (s = get_stats ()) == NULL)
+    return;
+  add (s, counter, 1);
+  add (s, SNTRUP761_STAT_COUNT + counter, now () - start);
+}
+
+void
+sntrup761_stats_retry (void)
+{
+  thread_stats *s;
+
+  if (!__atomic_load_n (&stats_enabled, __ATOMIC_RELAXED) || (s = get_stats ()) == NULL)
+    return;
+  add (s, 2 * SNTRUP761_STAT_COUNT, 1);
+}
@@ -0,0 +1,52 @@
+/*
+ * Optional instrumentation of sntrup761 API calls and internal kernels.
+ *
+ * Counters are disabled by default and cost one relaxed load per
+ * instrumented call while disabled.  When enabled, each OS thread counts
+ * into its own block (no shared cache lines on the hot path); blocks are
+ * kept for the lifetime of the process, so that counts of the threads that
+ * exited are not lost, and summed when a snapshot is taken.
+ */
+
+#ifndef SNTRUP761_STATS_H
+#define SNTRUP761_STATS_H
+
+#include <stdint.h>
+
+/* public API */
+#define SNTRUP761_STAT_KEYPAIR 0
+#define SNTRUP761_STAT_ENC 1
+#define SNTRUP761_STAT_DEC 2
+/* internal kernels */
+#define SNTRUP761_STAT_MULT 3   /* R3_mult, Rq_mult_small */
+#define SNTRUP761_STAT_RECIP 4  /* R3_recip, Rq_recip3 */
+#define SNTRUP761_STAT_SORT 5   /* crypto_sort_uint32 */
+#define SNTRUP761_STAT_ENCODE 6 /* Rq/Rounded encode and decode */
+#define SNTRUP761_STAT_HASH 7   /* Hash_prefix */
+#define SNTRUP761_STAT_COUNT 8
+
+/* snapshot layout, in uint64_t words:
+   [0 .. COUNT-1]         number of calls per counter
+   [COUNT .. 2*COUNT-1]   cumulative cycles (or nanoseconds, see sntrup761_stats_cycles) per counter
+   [2*COUNT]              number of R3_recip retries in KeyGen */
+#define SNTRUP761_STATS_SIZE (2 * SNTRUP761_STAT_COUNT + 1)
+
+void sntrup761_stats_enable (int enable);
+
+int sntrup761_stats_enabled (void);
+
+/* 1 if the time unit is CPU cycles (rdtsc on x86),
+   0 if nanoseconds (clock_gettime on other platforms) */
+int sntrup761_stats_cycles (void);
+
+void sntrup761_stats_snapshot (uint64_t *out);
+
+/* used by sntrup761.c */
+
+uint64_t sntrup761_stats_begin (void);
+
+void sntrup761_stats_end (int counter, uint64_t start);
+
+void sntrup761_stats_retry (void);
+
+#endif /* SNTRUP761_STATS_H */
@@ -0,0 +1,385 @@
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+#include "x25519_cache.h"
+
+#define MIN_CAPACITY 32
+#define NONE (-1)
+/* attempts to take the lock before the thread yields */
+#define MAX_SPINS 256
+
+typedef struct
+{
+  uint8_t key[2 * X25519_CACHE_KEY_SIZE];
+  uint8_t secret[X25519_CACHE_KEY_SIZE];
+  int32_t hnext; /* next entry in the hash bucket */
+  int32_t prev;  /* more recently used */
+  int32_t next;  /* less recently used */
+} entry;
+
+struct x25519_cache
+{
+  char lock;
+  uint64_t seed[2]; /* secret key of the bucket hash */
+  uint32_t max_capacity;
+  uint32_t capacity; /* power of 2, it is also the number of buckets */
+  uint32_t count;
+  int32_t head; /* most recently used */
+  int32_t tail; /* least recently used */
+  entry *entries;
+  int32_t *buckets;
+  size_t size;
+};
+
+static void *
+alloc_locked (size_t size)
+{
+  void *p;
+#ifdef _WIN32
+  p = VirtualAlloc (NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+  if (p != NULL)
+    VirtualLock (p, size);
+#else
+  p = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    return NULL;
+  /* best effort, locking fails when RLIMIT_MEMLOCK is exceeded */
+  mlock (p, size);
+#ifdef MADV_DONTDUMP
+  madvise (p, size, MADV_DONTDUMP);
+#endif
+#endif
+  return p;
+}
+
+static void
+free_locked (void *p, size_t size)
+{
+  OPENSSL_cleanse (p, size);
+#ifdef _WIN32
+  VirtualUnlock (p, size);
+  VirtualFree (p, 0, MEM_RELEASE);
+#else
+  munlock (p, size);
+  munmap (p, size);
+#endif
+}
+
+static inline void
+yield (void)
+{
+#ifdef _WIN32
+  SwitchToThread ();
+#else
+  sched_yield ();
+#endif
+}
+
+static inline void
+lock (x25519_cache *c)
+{
+  int spins = 0;
+  while (__atomic_test_and_set (&c->lock, __ATOMIC_ACQUIRE))
+    if (++spins == MAX_SPINS)
+      {
+        spins = 0;
+        yield ();
+      }
+}
+
+static inline void
+unlock (x25519_cache *c)
+{
+  __atomic_clear (&c->lock, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t
+rotl (uint64_t x, int b)
+{
+  return (x << b) | (x >> (64 - b));
+}
+
+static inline void
+sipround (uint64_t *v)
+{
+  v[0] += v[1];
+  v[1] = rotl (v[1], 13);
+  v[1] ^= v[0];
+  v[0] = rotl (v[0], 32);
+  v[2] += v[3];
+  v[3] = rotl (v[3], 16);
+  v[3] ^= v[2];
+  v[0] += v[3];
+  v[3] = rotl (v[3], 21);
+  v[3] ^= v[0];
+  v[2] += v[1];
+  v[1] = rotl (v[1], 17);
+  v[1] ^= v[2];
+  v[2] = rotl (v[2], 32);
+}
+
+static inline uint64_t
+load64 (const uint8_t *p)
+{
+  return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16 | (uint64_t) p[3] << 24
+         | (uint64_t) p[4] << 32 | (uint64_t) p[5] << 40 | (uint64_t) p[6] << 48 | (uint64_t) p[7] << 56;
+}
+
+/* SipHash-2-4 of the cache key with the secret seed: the keys can be chosen by the peer,
+ * so without the seed the peer could put all its entries in one bucket */
+static uint32_t
+bucket (const x25519_cache *c, const uint8_t *key)
+{
+  uint64_t v[4] = { c->seed[0] ^ 0x736f6d6570736575ULL, c->seed[1] ^ 0x646f72616e646f6dULL,
+                    c->seed[0] ^ 0x6c7967656e657261ULL, c->seed[1] ^ 0x7465646279746573ULL };
+  uint64_t m;
+  size_t i;
+
+  for (i = 0; i <= 2 * X25519_CACHE_KEY_SIZE; i += 8)
+    {
+      /* the last block only has the message length */
+      m = i < 2 * X25519_CACHE_KEY_SIZE ? load64 (key + i) : (uint64_t) (2 * X25519_CACHE_KEY_SIZE) << 56;
+      v[3] ^= m;
+      sipround (v);
+      sipround (v);
+      v[0] ^= m;
+    }
+  v[2] ^= 0xff;
+  for (i = 0; i < 4; ++i)
+    sipround (v);
+  return (uint32_t) (v[0] ^ v[1] ^ v[2] ^ v[3]) & (c->capacity - 1);
+}
+
+static void
+make_key (uint8_t *key, const uint8_t *peer_key, const uint8_t *own_key)
+{
+  memcpy (key, peer_key, X25519_CACHE_KEY_SIZE);
+  memcpy (key + X25519_CACHE_KEY_SIZE, own_key, X25519_CACHE_KEY_SIZE);
+}
+
+static int32_t
+find (const x25519_cache *c, const uint8_t *key)
+{
+  int32_t i;
+  if (c->count == 0)
+    return NONE;
+  for (i = c->buckets[bucket (c, key)]; i != NONE; i = c->entries[i].hnext)
+    if (memcmp (c->entries[i].key, key, sizeof c->entries[i].key) == 0)
+      return i;
+  return NONE;
+}
+
+static void
+lru_unlink (x25519_cache *c, int32_t i)
+{
+  entry *e = &c->entries[i];
+  if (e->prev != NONE)
+    c->entries[e->prev].next = e->next;
+  else
+    c->head = e->next;
+  if (e->next != NONE)
+    c->entries[e->next].prev = e->prev;
+  else
+    c->tail = e->prev;
+}
+
+static void
+lru_push (x25519_cache *c, int32_t i)
+{
+  entry *e = &c->entries[i];
+  e->prev = NONE;
+  e->next = c->head;
+  if (c->head != NONE)
+    c->entries[c->head].prev = i;
+  else
+    c->tail = i;
+  c->head = i;
+}
+
+static void
+bucket_unlink (x25519_cache *c, int32_t i)
+{
+  int32_t *p = &c->buckets[bucket (c, c->entries[i].key)];
+  while (*p != i)
+    p = &c->entries[*p].hnext;
+  *p = c->entries[i].hnext;
+}
+
+static void
+bucket_push (x25519_cache *c, int32_t i)
+{
+  int32_t *b = &c->buckets[bucket (c, c->entries[i].key)];
+  c->entries[i].hnext = *b;
+  *b = i;
+}
+
+/* doubles the capacity when the cache is full, entries keep their indices, so only the buckets are rebuilt;
+ * the new memory is allocated without the lock, the old memory is returned in old / old_size
+ * to be freed after unlock, returns 0 if allocation failed */
+static int
+grow (x25519_cache *c, entry **old, size_t *old_size)
+{
+  while (c->count == c->capacity && c->capacity < c->max_capacity)
+    {
+      /* the capacity only increases, so it changes if another thread grew the cache */
+      const uint32_t current = c->capacity;
+      const uint32_t capacity = current == 0 ? MIN_CAPACITY : 2 * current;
+      const size_t size = (size_t) capacity * (sizeof (entry) + sizeof (int32_t));
+      uint8_t *p;
+      uint32_t i;
+
+      unlock (c);
+      p = alloc_locked (size);
+      lock (c);
+      if (p == NULL)
+        return 0;
+      if (c->capacity != current)
+        {
+          unlock (c);
+          free_locked (p, size);
+          lock (c);
+          continue;
+        }
+      if (c->entries != NULL)
+        {
+          memcpy (p, c->entries, (size_t) c->count * sizeof (entry));
+          *old = c->entries;
+          *old_size = c->size;
+        }
+      c->entries = (entry *) p;
+      c->buckets = (int32_t *) (p + (size_t) capacity * sizeof (entry));
+      c->capacity = capacity;
+      c->size = size;
+      for (i = 0; i < capacity; ++i)
+        c->buckets[i] = NONE;
+      for (i = 0; i < c->count; ++i)
+        bucket_push (c, (int32_t) i);
+    }
+  return 1;
+}
+
+x25519_cache *
+x25519_cache_new (uint32_t capacity)
+{
+  x25519_cache *c;
+  uint32_t cap = MIN_CAPACITY;
+
+  if (capacity > (1u << 24))
+    capacity = 1u << 24;
+  while (cap < capacity)
+    cap <<= 1;
+  if ((c = calloc (1, sizeof (x25519_cache))) == NULL)
+    return NULL;
+  if (RAND_bytes ((unsigned char *) c->seed, sizeof c->seed) != 1)
+    {
+      free (c);
+      return NULL;
+    }
+  c->max_capacity = cap;
+  c->head = c->tail = NONE;
+  return c;
+}
+
+void
+x25519_cache_free (x25519_cache *c)
+{
+  if (c == NULL)
+    return;
+  if (c->entries != NULL)
+    free_locked (c->entries, c->size);
+  OPENSSL_cleanse (c->seed, sizeof c->seed);
+  free (c);
+}
+
+void
+x25519_cache_clear (x25519_cache *c)
+{
+  uint32_t i;
+
+  if (c == NULL)
+    return;
+  lock (c);
+  if (c->entries != NULL)
+    {
+      OPENSSL_cleanse (c->entries, (size_t) c->count * sizeof (entry));
+      for (i = 0; i < c->capacity; ++i)
+        c->buckets[i] = NONE;
+    }
+  c->count = 0;
+  c->head = c->tail = NONE;
+  unlock (c);
+}
+
+int
+x25519_cache_get (x25519_cache *c, const uint8_t *peer_key, const uint8_t *own_key, uint8_t *secret)
+{
+  uint8_t key[2 * X25519_CACHE_KEY_SIZE];
+  int32_t i;
+
+  if (c == NULL)
+    return 0;
+  make_key (key, peer_key, own_key);
+  lock (c);
+  if ((i = find (c, key)) != NONE)
+    {
+      memcpy (secret, c->entries[i].secret, X25519_CACHE_KEY_SIZE);
+      if (c->head != i)
+        {
+          lru_unlink (c, i);
+          lru_push (c, i);
+        }
+    }
+  unlock (c);
+  return i != NONE;
+}
+
+void
+x25519_cache_put (x25519_cache *c, const uint8_t *peer_key, const uint8_t *own_key, const uint8_t *secret)
+{
+  uint8_t key[2 * X25519_CACHE_KEY_SIZE];
+  int32_t i;
+  entry *old = NULL;
+  size_t old_size = 0;
+
+  if (c == NULL)
+    return;
+  make_key (key, peer_key, own_key);
+  lock (c);
+  /* the lock is released while growing, so the key is looked up after it;
+   * when growing fails, the least recently used entry is evicted */
+  grow (c, &old, &old_size);
+  if ((i = find (c, key)) != NONE)
+    lru_unlink (c, i);
+  else
+    {
+      if (c->count < c->capacity)
+        i = (int32_t) c->count++;
+      else if (c->count > 0)
+        {
+          i = c->tail;
+          lru_unlink (c, i);
+          bucket_unlink (c, i);
+        }
+      else
+        {
+          unlock (c);
+          return; /* old is NULL, as the cache did not grow */
+        }
+      memcpy (c->entries[i].key, key, sizeof key);
+      bucket_push (c, i);
+    }
+  memcpy (c->entries[i].secret, secret, X25519_CACHE_KEY_SIZE);
+  lru_push (c, i);
+  unlock (c);
+  if (old != NULL)
+    free_locked (old, old_size);
+}
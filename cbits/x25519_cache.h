@@ -0,0 +1,35 @@
+/*
+ * Bounded LRU cache of X25519 shared secrets for one transport session.
+ *
+ * Entries are keyed by the pair of public keys (peer key, own key), so the
+ * same cache can be used with different own private keys.  Entries are kept
+ * in memory that is locked (when RLIMIT_MEMLOCK allows it), excluded from
+ * core dumps, and wiped when entries are evicted, cleared or freed.
+ * The memory is allocated on the first insertion and grows up to capacity.
+ */
+
+#ifndef X25519_CACHE_H
+#define X25519_CACHE_H
+
+#include <stdint.h>
+
+#define X25519_CACHE_KEY_SIZE 32
+
+typedef struct x25519_cache x25519_cache;
+
+/* capacity is rounded up to a power of 2, at least 32; returns NULL if allocation or hash seed generation failed */
+x25519_cache *x25519_cache_new (uint32_t capacity);
+
+/* wipes and frees all memory, c can be NULL */
+void x25519_cache_free (x25519_cache *c);
+
+/* wipes all entries, the cache can still be used */
+void x25519_cache_clear (x25519_cache *c);
+
+/* returns 1 and copies the secret if found, 0 otherwise (or if c is NULL) */
+int x25519_cache_get (x25519_cache *c, const uint8_t *peer_key, const uint8_t *own_key, uint8_t *secret);
+
+/* adds or replaces the secret, evicting the least recently used entry when the cache is full */
+void x25519_cache_put (x25519_cache *c, const uint8_t *peer_key, const uint8_t *own_key, const uint8_t *secret);
+
+#endif /* X25519_CACHE_H */
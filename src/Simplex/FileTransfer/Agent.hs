@@ -69,7 +69,7 @@ import Simplex.Messaging.Agent.Stats
 import Simplex.Messaging.Agent.Store.SQLite
 import qualified Simplex.Messaging.Agent.Store.SQLite.DB as DB
 import qualified Simplex.Messaging.Crypto as C
-import Simplex.Messaging.Crypto.File (CryptoFile (..), CryptoFileArgs)
+import Simplex.Messaging.Crypto.File (CryptoFile (..), CryptoFileArgs, FTCryptoError (..))
 import qualified Simplex.Messaging.Crypto.File as CF
 import qualified Simplex.Messaging.Crypto.Lazy as LC
 import Simplex.Messaging.Encoding
@@ -292,10 +292,8 @@ runXFTPRcvLocalWorker c Worker {doWork} = do
       chunkPaths <- getChunkPaths chunks
       encSize <- liftIO $ foldM (\s path -> (s +) . fromIntegral <$> getFileSize path) 0 chunkPaths
       when (FileSize encSize /= size) $ throwE $ XFTP "" XFTP.SIZE
-      encDigest <- liftIO $ LC.sha512Hash <$> readChunks chunkPaths
-      when (FileDigest encDigest /= digest) $ throwE $ XFTP "" XFTP.DIGEST
       let destFile = CryptoFile fsSavePath cfArgs
-      void $ liftError (FILE . FILE_IO . show) $ decryptChunks encSize chunkPaths key nonce $ \_ -> pure destFile
+      void $ liftError decryptError $ decryptVerifyChunks encSize chunkPaths (Just $ unFileDigest digest) key nonce $ \_ -> pure destFile
       case redirect of
         Nothing -> do
           notify c rcvFileEntityId $ RFDONE fsSavePath
@@ -328,6 +326,10 @@ runXFTPRcvLocalWorker c Worker {doWork} = do
           pure $ fsPath : ps
         getChunkPaths (RcvFileChunk {chunkTmpPath = Nothing} : _cs) =
           throwE $ INTERNAL "no chunk path"
+        decryptError :: FTCryptoError -> AgentErrorType
+        decryptError = \case
+          FTCEInvalidDigest -> XFTP "" XFTP.DIGEST
+          e -> FILE . FILE_IO $ show e
 
 xftpDeleteRcvFile' :: AgentClient -> RcvFileId -> AM' ()
 xftpDeleteRcvFile' c rcvFileEntityId = xftpDeleteRcvFiles' c [rcvFileEntityId]
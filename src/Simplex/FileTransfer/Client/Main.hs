@@ -103,6 +103,7 @@ cliCryptoError = \case
   FTCEInvalidHeader e -> CLIError $ "Invalid file header: " <> e
   FTCEInvalidAuthTag -> CLIError "Error decrypting file: incorrect auth tag"
   FTCEInvalidFileSize -> CLIError "Error decrypting file: incorrect file size"
+  FTCEInvalidDigest -> CLIError "File digest mismatch"
   FTCEFileIOError e -> CLIError $ "File IO error: " <> show e
 
 data CliCommand
@@ -440,12 +441,10 @@ cliReceiveFile ReceiveOptions {fileDescription, filePath, retryCount, tempPath,
       (errs, rs) <- partitionEithers . concat <$> liftIO (pooledForConcurrentlyN 16 srvChunks $ mapM $ runExceptT . downloadFileChunk g a encPath size downloadedChunks)
       mapM_ throwE errs
       let chunkPaths = map snd $ sortOn fst rs
-      encDigest <- liftIO $ LC.sha512Hash <$> readChunks chunkPaths
-      when (encDigest /= unFileDigest digest) $ throwE $ CLIError "File digest mismatch"
       encSize <- liftIO $ foldM (\s path -> (s +) . fromIntegral <$> getFileSize path) 0 chunkPaths
       when (FileSize encSize /= size) $ throwE $ CLIError "File size mismatch"
       liftIO $ printNoNewLine "Decrypting file..."
-      CryptoFile path _ <- withExceptT cliCryptoError $ decryptChunks encSize chunkPaths key nonce $ fmap CF.plain . getFilePath
+      CryptoFile path _ <- withExceptT cliCryptoError $ decryptVerifyChunks encSize chunkPaths (Just $ unFileDigest digest) key nonce $ fmap CF.plain . getFilePath
       forM_ chunks $ acknowledgeFileChunk a
       whenM (doesPathExist encPath) $ removeDirectoryRecursive encPath
       liftIO $ do
@@ -1,106 +1,148 @@
-{-# LANGUAGE BangPatterns #-}
 {-# LANGUAGE DeriveAnyClass #-}
+{-# LANGUAGE MultiWayIf #-}
 {-# LANGUAGE NamedFieldPuns #-}
 {-# LANGUAGE OverloadedStrings #-}
 {-# LANGUAGE ScopedTypeVariables #-}
+{-# LANGUAGE TupleSections #-}
 
 module Simplex.FileTransfer.Crypto where
 
+import Control.Concurrent (getNumCapabilities)
 import Control.Monad
 import Control.Monad.Except
 import Control.Monad.Trans.Except
 import qualified Data.Attoparsec.ByteString.Char8 as A
-import Data.Bifunctor (first)
 import qualified Data.ByteArray as BA
 import Data.ByteString.Char8 (ByteString)
 import qualified Data.ByteString.Char8 as B
+import qualified Data.ByteString.Internal as BI
+import Data.ByteString.Unsafe (unsafeUseAsCStringLen)
 import qualified Data.ByteString.Lazy.Char8 as LB
+import Data.Functor (($>))
 import Data.Int (Int64)
+import Foreign (Ptr, Word8, allocaBytesAligned, castPtr, copyBytes, fillBytes, plusPtr)
 import Simplex.FileTransfer.Types (FileHeader (..), authTagSize)
 import qualified Simplex.Messaging.Crypto as C
 import Simplex.Messaging.Crypto.File (CryptoFile (..), FTCryptoError (..))
 import qualified Simplex.Messaging.Crypto.File as CF
+import Simplex.Messaging.Crypto.HashStream (hashStreamDigest, hashStreamUpdate, withSHA512Stream)
 import Simplex.Messaging.Crypto.Lazy (LazyByteString)
 import qualified Simplex.Messaging.Crypto.Lazy as LC
+import Simplex.Messaging.Crypto.SecretBoxStream (SbStream, sbStreamAuth, sbStreamAuthCombine, sbStreamAuthPart, sbStreamAuthUpdate, sbStreamXorAt, withSbStream)
 import Simplex.Messaging.Encoding
-import Simplex.Messaging.Util (liftEitherWith)
+import Simplex.Messaging.Util (liftEitherWith, whenM)
+import System.IO (hGetBuf, hPutBuf)
 import UnliftIO
-import UnliftIO.Directory (removeFile)
+import UnliftIO.Directory (doesFileExist, getFileSize, removeFile, renameFile)
 
+-- | Encrypts the file in batches, each batch is split into parts that are encrypted by several threads,
+-- using their parts of the keystream and computing partial tag sums that are then added to the tag in order.
+-- The output is the same as with sequential encryption, with the auth tag at the end.
 encryptFile :: CryptoFile -> ByteString -> C.SbKey -> C.CbNonce -> Int64 -> Int64 -> FilePath -> ExceptT FTCryptoError IO ()
 encryptFile srcFile fileHdr key nonce fileSize' encSize encFile = do
-  sb <- liftEitherWith FTCECryptoError $ LC.sbInit key nonce
-  CF.withFile srcFile ReadMode $ \r -> ExceptT . withFile encFile WriteMode $ \w -> runExceptT $ do
-    let lenStr = smpEncode fileSize'
-        (hdr, !sb') = LC.sbEncryptChunk sb $ lenStr <> fileHdr
-        padLen = encSize - authTagSize - fileSize' - 8
-    liftIO $ B.hPut w hdr
-    sb2 <- encryptChunks r w (sb', fileSize' - fromIntegral (B.length fileHdr))
-    CF.hGetTag r
-    sb3 <- encryptPad w (sb2, padLen)
-    let tag = BA.convert $ LC.sbAuth sb3
-    liftIO $ B.hPut w tag
+  let hdr = smpEncode fileSize' <> fileHdr
+      hdrLen = fromIntegral $ B.length hdr
+      fileEnd = 8 + fileSize'
+      ctLen = encSize - authTagSize
+  when (hdrLen > fileEnd || fileEnd > ctLen) $ throwE FTCEInvalidFileSize
+  n <- liftIO getNumCapabilities
+  let batchSize = n * partSize
+  CF.withFile srcFile ReadMode $ \r -> ExceptT . withFile encFile WriteMode $ \w -> withSbStream key nonce $ \sb ->
+    allocaBytesAligned batchSize 64 $ \buf -> runExceptT $ do
+      let copyAt off pos s = liftIO . unsafeUseAsCStringLen s $ \(p, len) -> copyBytes (buf `plusPtr` fromIntegral (pos - off)) (castPtr p) len
+          readPlain off end = do
+            when (off < hdrLen) $ copyAt off off $ B.take (fromIntegral $ end - off) $ B.drop (fromIntegral off) hdr
+            let pos = max off hdrLen
+                len = fromIntegral $ min end fileEnd - pos
+            when (len > 0) $ do
+              s <- liftIO $ CF.hGet r len
+              when (B.length s /= len) $ throwE $ FTCEFileIOError "encrypting file: unexpected EOF"
+              copyAt off pos s
+            let padPos = max off fileEnd
+            when (end > padPos) $ liftIO $ fillBytes (buf `plusPtr` fromIntegral (padPos - off)) (BI.c2w '#') (fromIntegral $ end - padPos)
+          encryptBatch off len = do
+            let parts = [(o, min partSize (len - o)) | o <- [0, partSize .. len - 1]]
+            sums <- liftIO $ case parts of
+              [part] -> (: []) <$> encryptPart part
+              _ -> mapConcurrently encryptPart parts
+            forM_ (zip parts sums) $ \((o, l), authPart) -> do
+              let l' = l - l `mod` 16
+              ok <- liftIO $ sbStreamAuthCombine sb authPart l'
+              unless ok $ throwE $ FTCEFileIOError "encrypting file: unaligned part"
+              liftIO $ sbStreamAuthUpdate sb (buf `plusPtr` (o + l')) (l - l')
+            where
+              encryptPart (o, l) = do
+                let p = buf `plusPtr` o
+                sbStreamXorAt sb (off + fromIntegral o) p l
+                sbStreamAuthPart sb p (l - l `mod` 16)
+          encryptBatches off = when (off < ctLen) $ do
+            let len = fromIntegral $ min (fromIntegral batchSize) (ctLen - off)
+                end = off + fromIntegral len
+            readPlain off end
+            encryptBatch off len
+            liftIO $ hPutBuf w buf len
+            encryptBatches end
+      encryptBatches 0
+      CF.hGetTag r
+      liftIO $ B.hPut w =<< sbStreamAuth sb
   where
-    encryptChunks r = encryptChunks_ $ liftIO . CF.hGet r . fromIntegral
-    encryptPad = encryptChunks_ $ \sz -> pure $ B.replicate (fromIntegral sz) '#'
-    encryptChunks_ :: (Int64 -> IO ByteString) -> Handle -> (LC.SbState, Int64) -> ExceptT FTCryptoError IO LC.SbState
-    encryptChunks_ get w (!sb, !len)
-      | len == 0 = pure sb
-      | otherwise = do
-          let chSize = min len 65536
-          ch <- liftIO $ get chSize
-          when (B.length ch /= fromIntegral chSize) $ throwE $ FTCEFileIOError "encrypting file: unexpected EOF"
-          let (ch', sb') = LC.sbEncryptChunk sb ch
-          liftIO $ B.hPut w ch'
-          encryptChunks_ get w (sb', len - chSize)
+    -- multiple of 16 bytes, so that only the last part of the file can have incomplete Poly1305 block
+    partSize = 1048576
 
 decryptChunks :: Int64 -> [FilePath] -> C.SbKey -> C.CbNonce -> (String -> ExceptT String IO CryptoFile) -> ExceptT FTCryptoError IO CryptoFile
-decryptChunks _ [] _ _ _ = throwE $ FTCEInvalidHeader "empty"
-decryptChunks encSize (chPath : chPaths) key nonce getDestFile = case reverse chPaths of
-  [] -> do
-    (!authOk, !f) <- liftEither . first FTCECryptoError . LC.sbDecryptTailTag key nonce (encSize - authTagSize) =<< liftIO (LB.readFile chPath)
-    unless authOk $ throwE FTCEInvalidAuthTag
-    (FileHeader {fileName}, !f') <- parseFileHeader f
-    destFile <- withExceptT FTCEFileIOError $ getDestFile fileName
-    CF.writeFile destFile f'
-    pure destFile
-  lastPath : chPaths' -> do
-    (state, expectedLen, ch) <- decryptFirstChunk
-    (FileHeader {fileName}, ch') <- parseFileHeader ch
-    destFile@(CryptoFile path _) <- withExceptT FTCEFileIOError $ getDestFile fileName
-    authOk <- CF.withFile destFile WriteMode $ \h -> liftIO $ do
-      CF.hPut h ch'
-      state' <- foldM (decryptChunk h) state $ reverse chPaths'
-      decryptLastChunk h state' expectedLen
-    unless authOk $ do
-      removeFile path
-      throwE FTCEInvalidAuthTag
-    pure destFile
-    where
-      decryptFirstChunk = do
-        sb <- liftEitherWith FTCECryptoError $ LC.sbInit key nonce
-        ch <- liftIO $ LB.readFile chPath
-        let (ch1, !sb') = LC.sbDecryptChunkLazy sb ch
-        (!expectedLen, ch2) <- liftEitherWith FTCECryptoError $ LC.splitLen ch1
-        let len1 = LB.length ch2
-        pure ((sb', len1), expectedLen, ch2)
-      decryptChunk h (!sb, !len) chPth = do
-        ch <- LB.readFile chPth
-        let len' = len + LB.length ch
-            (ch', sb') = LC.sbDecryptChunkLazy sb ch
-        CF.hPut h ch'
-        pure (sb', len')
-      decryptLastChunk h (!sb, !len) expectedLen = do
-        ch <- LB.readFile lastPath
-        let (ch1, tag') = LB.splitAt (LB.length ch - authTagSize) ch
-            tag'' = LB.toStrict tag'
-            (ch2, sb') = LC.sbDecryptChunkLazy sb ch1
-            len' = len + LB.length ch2
-            ch3 = LB.take (LB.length ch2 - len' + expectedLen) ch2
-            tag :: ByteString = BA.convert (LC.sbAuth sb')
-        CF.hPut h ch3
-        CF.hPutTag h
-        pure $ B.length tag'' == 16 && BA.constEq tag'' tag
+decryptChunks encSize chPaths = decryptVerifyChunks encSize chPaths Nothing
+
+-- | Decrypts the file reading each chunk once, and validates SHA512 digest of the encrypted chunks, if it is passed.
+-- Each chunk is added to the digest and to the auth tag, and then it is decrypted in place by several threads,
+-- each using its part of the keystream. Plaintext is written to a temporary file in the destination directory,
+-- it is renamed to the destination file only after the digest and the tag are verified, and removed on any failure.
+decryptVerifyChunks :: Int64 -> [FilePath] -> Maybe ByteString -> C.SbKey -> C.CbNonce -> (String -> ExceptT String IO CryptoFile) -> ExceptT FTCryptoError IO CryptoFile
+decryptVerifyChunks _ [] _ _ _ _ = throwE $ FTCEInvalidHeader "empty"
+decryptVerifyChunks encSize chPaths digest_ key nonce getDestFile = do
+  chSizes <- liftIO $ mapM (fmap fromIntegral . getFileSize) chPaths
+  let ctLen = encSize - authTagSize
+  when (sum chSizes /= encSize || ctLen < 8) $ throwE FTCEInvalidFileSize
+  case zip3 chPaths (scanl (+) 0 chSizes) chSizes of
+    [] -> throwE $ FTCEInvalidHeader "empty"
+    firstChunk : chunks -> ExceptT . withSbStream key nonce $ \sb -> withSHA512Stream $ \hs ->
+      allocaBytesAligned (fromIntegral $ maximum chSizes) 64 $ \buf -> runExceptT $ do
+        let decryptChunk (path, off, size) = do
+              let size' = fromIntegral size
+              n <- liftIO $ withBinaryFile path ReadMode $ \h -> hGetBuf h buf size'
+              when (n /= size') $ throwE $ FTCEFileIOError "decrypting file: unexpected EOF"
+              liftIO $ do
+                forM_ digest_ $ \_ -> hashStreamUpdate hs buf n
+                let len = fromIntegral $ max 0 $ min size (ctLen - off)
+                sbStreamAuthUpdate sb buf len
+                decryptParallel sb off buf len
+                tag <- B.packCStringLen (castPtr buf `plusPtr` len, n - len)
+                pure (len, tag)
+        (len1, tag1) <- decryptChunk firstChunk
+        hdrStr <- liftIO $ B.packCStringLen (castPtr buf, min len1 $ 8 + 1024)
+        (expectedLen, s) <- liftEitherWith FTCECryptoError $ LC.splitLen $ LB.fromStrict hdrStr
+        (FileHeader {fileName}, s') <- parseFileHeader s
+        let start = 8 + LB.length s - LB.length s'
+            end = min ctLen $ 8 + expectedLen
+            writePlain h off len = liftIO $ do
+              let a = max 0 $ start - off
+                  b = min (fromIntegral len) (end - off)
+              when (b > a) $ CF.hPut h . LB.fromStrict =<< B.packCStringLen (castPtr buf `plusPtr` fromIntegral a, fromIntegral $ b - a)
+        destFile@(CryptoFile path cfArgs) <- withExceptT FTCEFileIOError $ getDestFile fileName
+        let tmpPath = path <> ".tmp"
+        ExceptT . (`finally` whenM (doesFileExist tmpPath) (removeFile tmpPath)) . runExceptT $ do
+          (tag', tag, digest') <- CF.withFile (CryptoFile tmpPath cfArgs) WriteMode $ \h -> do
+            writePlain h 0 len1
+            tags <- forM chunks $ \chunk@(_, off, _) -> do
+              (len, tag) <- decryptChunk chunk
+              writePlain h off len
+              pure tag
+            liftIO $ do
+              CF.hPutTag h
+              (B.concat $ tag1 : tags,,) <$> sbStreamAuth sb <*> hashStreamDigest hs
+          if
+            | any (digest' /=) digest_ -> throwE FTCEInvalidDigest
+            | B.length tag' /= C.authTagSize || not (BA.constEq tag' tag) -> throwE FTCEInvalidAuthTag
+            | otherwise -> renameFile tmpPath path $> destFile
   where
     parseFileHeader :: LazyByteString -> ExceptT FTCryptoError IO (FileHeader, LazyByteString)
     parseFileHeader s = do
@@ -110,5 +152,13 @@ decryptChunks encSize (chPath : chPaths) key nonce getDestFile = case reverse ch
         A.Partial _ -> throwE $ FTCEInvalidHeader "incomplete"
         A.Done rest hdr -> pure (hdr, LB.fromStrict rest <> s')
 
-readChunks :: [FilePath] -> IO LB.ByteString
-readChunks = foldM (\s path -> (s <>) <$> LB.readFile path) ""
+decryptParallel :: SbStream -> Int64 -> Ptr Word8 -> Int -> IO ()
+decryptParallel sb off buf len = do
+  n <- getNumCapabilities
+  let partSize = max minPartSize $ (len + n - 1) `div` n
+  case [(o, min partSize (len - o)) | o <- [0, partSize .. len - 1]] of
+    [part] -> decryptPart part
+    parts -> forConcurrently_ parts decryptPart
+  where
+    decryptPart (o, l) = sbStreamXorAt sb (off + fromIntegral o) (buf `plusPtr` o) l
+    minPartSize = 262144
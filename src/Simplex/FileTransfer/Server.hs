@@ -50,7 +50,6 @@ import Simplex.FileTransfer.Server.Store
 import Simplex.FileTransfer.Server.StoreLog
 import Simplex.FileTransfer.Transport
 import qualified Simplex.Messaging.Crypto as C
-import qualified Simplex.Messaging.Crypto.Lazy as LC
 import Simplex.Messaging.Encoding
 import Simplex.Messaging.Encoding.String
 import Simplex.Messaging.Protocol (CorrId (..), EntityId (..), RcvPublicAuthKey, RcvPublicDhKey, RecipientId, TransmissionAuth, pattern NoEntity)
@@ -61,7 +60,7 @@ import Simplex.Messaging.Server.QueueStore (RoundedSystemTime, getRoundedSystemT
 import Simplex.Messaging.Server.Stats
 import Simplex.Messaging.TMap (TMap)
 import qualified Simplex.Messaging.TMap as TM
-import Simplex.Messaging.Transport (ALPN, SessionId, THandleAuth (..), THandleParams (..), TransportPeer (..), defaultSupportedParams)
+import Simplex.Messaging.Transport (ALPN, SessionId, THandleAuth (..), THandleParams (..), TransportPeer (..), clearSessionDhCache, defaultSupportedParams, newSessionDhCache)
 import Simplex.Messaging.Transport.Buffer (trimCR)
 import Simplex.Messaging.Transport.HTTP2
 import Simplex.Messaging.Transport.HTTP2.File (fileBlockSize)
@@ -115,7 +114,10 @@ xftpServer cfg@XFTPServerConfig {xftpPort, transportConfig, inactiveClientExpira
         Left e -> putStrLn ("servers has no valid key: " <> show e) >> exitFailure
       env <- ask
       sessions <- liftIO TM.emptyIO
-      let cleanup sessionId = atomically $ TM.delete sessionId sessions
+      let cleanup sessionId =
+            atomically (TM.lookupDelete sessionId sessions) >>= \case
+              Just (HandshakeAccepted THandleParams {thAuth = Just auth}) -> clearSessionDhCache auth
+              _ -> pure ()
       liftIO . runHTTP2Server started xftpPort defaultHTTP2BufferSize defaultSupportedParams srvCreds alpn_ transportConfig inactiveClientExpiration cleanup $ \sessionId sessionALPN r sendResponse -> do
         reqBody <- getHTTP2Body r xftpBlockSize
         let v = VersionXFTP 1
@@ -158,7 +160,8 @@ xftpServer cfg@XFTPServerConfig {xftpPort, transportConfig, inactiveClientExpira
           unless (keyHash == kh) $ throwE HANDSHAKE
           case compatibleVRange' xftpServerVRange v of
             Just (Compatible vr) -> do
-              let auth = THAuthServer {serverPrivKey = pk, sessSecret' = Nothing}
+              dhCache' <- liftIO newSessionDhCache
+              let auth = THAuthServer {serverPrivKey = pk, sessSecret' = Nothing, dhCache'}
                   thParams = thParams0 {thAuth = Just auth, thVersion = v, thServerVRange = vr}
               atomically $ TM.insert sessionId (HandshakeAccepted thParams) sessions
 #ifdef slow_servers
@@ -306,7 +309,8 @@ xftpServer cfg@XFTPServerConfig {xftpPort, transportConfig, inactiveClientExpira
 data ServerFile = ServerFile
   { filePath :: FilePath,
     fileSize :: Word32,
-    sbState :: LC.SbState
+    dhSecret :: C.DhSecretX25519,
+    cbNonce :: C.CbNonce
   }
 
 processRequest :: XFTPTransportRequest -> M ()
@@ -341,8 +345,8 @@ processRequest XFTPTransportRequest {thParams, reqBody = body@HTTP2Body {bodyHea
             Right t -> do
               send $ byteString t
               -- timeout sending file in the same way as receiving
-              forM_ serverFile_ $ \ServerFile {filePath, fileSize, sbState} -> do
-                withFile filePath ReadMode $ \h -> sendEncFile h send sbState fileSize
+              forM_ serverFile_ $ \ServerFile {filePath, fileSize, dhSecret, cbNonce} ->
+                sendEncServerFile filePath send dhSecret cbNonce fileSize
           done
 
 #ifdef slow_servers
@@ -493,13 +497,10 @@ processXFTPRequest HTTP2Body {bodyPart} = \case
               (sDhKey, spDhKey) <- atomically $ C.generateKeyPair g
               let dhSecret = C.dh' rDhKey spDhKey
               cbNonce <- atomically $ C.randomCbNonce g
-              case LC.cbInit dhSecret cbNonce of
-                Right sbState -> do
-                  stats <- asks serverStats
-                  incFileStat fileDownloads
-                  liftIO $ updatePeriodStats (filesDownloaded stats) senderId
-                  pure (FRFile sDhKey cbNonce, Just ServerFile {filePath = path, fileSize = size, sbState})
-                _ -> pure (FRErr INTERNAL, Nothing)
+              stats <- asks serverStats
+              incFileStat fileDownloads
+              liftIO $ updatePeriodStats (filesDownloaded stats) senderId
+              pure (FRFile sDhKey cbNonce, Just ServerFile {filePath = path, fileSize = size, dhSecret, cbNonce})
         _ -> pure (FRErr NO_FILE, Nothing)
 
     deleteServerFile :: FileRec -> M FileResponse
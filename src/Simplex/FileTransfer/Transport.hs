@@ -27,6 +27,7 @@ module Simplex.FileTransfer.Transport
     ReceiveFileError (..),
     receiveFile,
     sendEncFile,
+    sendEncServerFile,
     receiveEncFile,
     receiveSbFile,
   )
@@ -37,7 +38,6 @@ import qualified Control.Exception as E
 import Control.Logger.Simple
 import Control.Monad
 import Control.Monad.Except
-import Control.Monad.IO.Class
 import Control.Monad.Trans.Except
 import qualified Data.Aeson.TH as J
 import qualified Data.Attoparsec.ByteString.Char8 as A
@@ -46,13 +46,18 @@ import qualified Data.ByteArray as BA
 import Data.ByteString.Builder (Builder, byteString)
 import Data.ByteString.Char8 (ByteString)
 import qualified Data.ByteString.Char8 as B
-import qualified Data.ByteString.Lazy.Char8 as LB
+import qualified Data.ByteString.Internal as BI
+import Data.ByteString.Unsafe (unsafeUseAsCString, unsafeUseAsCStringLen)
 import Data.Functor (($>))
 import Data.Word (Word16, Word32)
 import qualified Data.X509 as X
+import Foreign (Ptr, Word8, allocaBytesAligned, castPtr, copyBytes)
+import GHC.IO.Handle.Internals (ioe_EOF)
 import Network.HTTP2.Client (HTTP2Error)
 import qualified Simplex.Messaging.Crypto as C
+import Simplex.Messaging.Crypto.HashStream (hashStreamDigest, hashStreamUpdate, withSHA256Stream)
 import qualified Simplex.Messaging.Crypto.Lazy as LC
+import Simplex.Messaging.Crypto.SecretBoxStream (SbStream, sbStreamAuth, sbStreamDecrypt, sbStreamEncrypt, withCbStream)
 import Simplex.Messaging.Encoding
 import Simplex.Messaging.Encoding.String
 import Simplex.Messaging.Parsers
@@ -62,7 +67,7 @@ import Simplex.Messaging.Transport.HTTP2.File
 import Simplex.Messaging.Util (bshow, tshow)
 import Simplex.Messaging.Version
 import Simplex.Messaging.Version.Internal
-import System.IO (Handle, IOMode (..), withFile)
+import System.IO (Handle, IOMode (..), hGetBuf, hPutBuf, withFile)
 
 data XFTPRcvChunkSpec = XFTPRcvChunkSpec
   { filePath :: FilePath,
@@ -147,20 +152,44 @@ sendEncFile h send = go
         send (byteString encCh) `E.catch` \(e :: E.SomeException) -> print e >> E.throwIO e
         go sbState' $ sz - fromIntegral (B.length ch)
 
+-- | Sends the encrypted file chunk, reading it directly into the buffers that are encrypted in place.
+-- The buffers are not reused, as the response body holds them until they are sent.
+sendEncServerFile :: FilePath -> (Builder -> IO ()) -> C.DhSecretX25519 -> C.CbNonce -> Word32 -> IO ()
+sendEncServerFile filePath send dhSecret cbNonce fileSize =
+  withFile filePath ReadMode $ \h -> withCbStream dhSecret cbNonce $ \st -> do
+    let go 0 = send . byteString =<< sbStreamAuth st
+        go sz = do
+          let n = min (fromIntegral sz) encBlockSize
+          ch <- BI.createAndTrim n $ \p -> do
+            r <- hGetBuf h p n
+            sbStreamEncrypt st p r
+            pure r
+          when (B.null ch) ioe_EOF
+          send $ byteString ch
+          go $ sz - fromIntegral (B.length ch)
+    go fileSize
+  where
+    encBlockSize = 4 * fileBlockSize
+
 receiveFile :: (Int -> IO ByteString) -> XFTPRcvChunkSpec -> ExceptT XFTPErrorType IO ()
 receiveFile getBody chunk = ExceptT $ runExceptT (receiveFile_ receive chunk) `E.catches` handlers
   where
-    receive h sz = hReceiveFile getBody h sz >>= \sz' -> pure $ if sz' == 0 then Right () else Left SIZE
+    receive write sz = receiveFileBlocks getBody (writeBlock write) sz >>= \sz' -> pure $ if sz' == 0 then Right () else Left SIZE
+    writeBlock write ch = unsafeUseAsCStringLen ch $ \(p, n) -> write (castPtr p) n
     handlers =
       [ E.Handler $ \(e :: HTTP2Error) -> logWarn (err e) $> Left TIMEOUT,
         E.Handler $ \(e :: E.SomeException) -> logError (err e) $> Left FILE_IO
       ]
     err e = "receiveFile error: " <> tshow e
 
-receiveEncFile :: (Int -> IO ByteString) -> LC.SbState -> XFTPRcvChunkSpec -> ExceptT XFTPErrorType IO ()
-receiveEncFile getBody = receiveFile_ . receive
+-- | Receives the encrypted file chunk, decrypting it in place in the reused buffer.
+receiveEncFile :: (Int -> IO ByteString) -> C.DhSecretX25519 -> C.CbNonce -> XFTPRcvChunkSpec -> ExceptT XFTPErrorType IO ()
+receiveEncFile getBody dhSecret cbNonce = receiveFile_ receive
   where
-    receive sbState h sz = first err <$> receiveSbFile getBody h sbState sz
+    receive write sz =
+      withCbStream dhSecret cbNonce $ \st ->
+        allocaBytesAligned fileBlockSize 64 $ \buf ->
+          first err <$> receiveSbStream getBody write st buf sz
     err RFESize = SIZE
     err RFECrypto = CRYPTO
 
@@ -190,10 +219,42 @@ receiveSbFile getBody h = receive
         | otherwise -> pure $ Left RFESize
     authSz = fromIntegral C.authTagSize
 
-receiveFile_ :: (Handle -> Word32 -> IO (Either XFTPErrorType ())) -> XFTPRcvChunkSpec -> ExceptT XFTPErrorType IO ()
+receiveSbStream :: (Int -> IO ByteString) -> (Ptr Word8 -> Int -> IO ()) -> SbStream -> Ptr Word8 -> Word32 -> IO (Either ReceiveFileError ())
+receiveSbStream getBody write st buf = receive
+  where
+    receive sz = do
+      ch <- getBody fileBlockSize
+      let chSize = fromIntegral $ B.length ch
+      if
+        | chSize > sz + authSz -> pure $ Left RFESize
+        | chSize > 0 -> do
+            let (ch', rest) = B.splitAt (fromIntegral sz) ch
+                sz' = sz - fromIntegral (B.length ch')
+            decryptWrite ch'
+            if sz' > 0
+              then receive sz'
+              else do
+                let tag' = B.take C.authTagSize rest
+                    tagSz = B.length tag'
+                tag <- sbStreamAuth st
+                tag'' <- if tagSz == C.authTagSize then pure tag' else (tag' <>) <$> getBody (C.authTagSize - tagSz)
+                pure $ if BA.constEq tag'' tag then Right () else Left RFECrypto
+        | otherwise -> pure $ Left RFESize
+    decryptWrite bs = unless (B.null bs) $ do
+      let (b, bs') = B.splitAt fileBlockSize bs
+          n = B.length b
+      unsafeUseAsCString b $ \p -> copyBytes buf (castPtr p) n
+      sbStreamDecrypt st buf n
+      write buf n
+      decryptWrite bs'
+    authSz = fromIntegral C.authTagSize
+
+-- | Writes the received chunk to the file, computing its digest as it is written.
+receiveFile_ :: ((Ptr Word8 -> Int -> IO ()) -> Word32 -> IO (Either XFTPErrorType ())) -> XFTPRcvChunkSpec -> ExceptT XFTPErrorType IO ()
 receiveFile_ receive XFTPRcvChunkSpec {filePath, chunkSize, chunkDigest} = do
-  ExceptT $ withFile filePath WriteMode (`receive` chunkSize)
-  digest' <- liftIO $ LC.sha256Hash <$> LB.readFile filePath
+  digest' <- ExceptT $ withFile filePath WriteMode $ \h -> withSHA256Stream $ \hs -> do
+    let write p n = hashStreamUpdate hs p n >> hPutBuf h p n
+    receive write chunkSize >>= traverse (\_ -> hashStreamDigest hs)
   when (digest' /= chunkDigest) $ throwE DIGEST
 
 data XFTPErrorType
@@ -255,7 +255,6 @@ import Data.Bifunctor (first, second)
 import Data.ByteArray (ScrubbedBytes)
 import qualified Data.ByteArray as BA
 import Data.ByteString (ByteString)
-import qualified Data.ByteString.Base64.URL as U
 import qualified Data.ByteString.Char8 as B
 import Data.Char (toLower)
 import Data.Functor (($>))
@@ -296,6 +295,7 @@ import Simplex.Messaging.Crypto.File (CryptoFile (..), CryptoFileArgs (..))
 import Simplex.Messaging.Crypto.Ratchet (PQEncryption (..), PQSupport (..), RatchetX448, SkippedMsgDiff (..), SkippedMsgKeys)
 import qualified Simplex.Messaging.Crypto.Ratchet as CR
 import Simplex.Messaging.Encoding
+import qualified Simplex.Messaging.Encoding.Base64URL as U
 import Simplex.Messaging.Encoding.String
 import Simplex.Messaging.Notifications.Protocol (DeviceToken (..), NtfSubscriptionId, NtfTknStatus (..), NtfTokenId, SMPQueueNtf (..))
 import Simplex.Messaging.Notifications.Types
@@ -1285,11 +1285,24 @@ deleteRatchet :: DB.Connection -> ConnId -> IO ()
 deleteRatchet db connId =
   DB.execute db "DELETE FROM ratchets WHERE conn_id = ?" (Only connId)
 
+-- | Ratchet state is saved as JSON, binary state with KEM state saved in ratchet_kem_states
+-- is also read, so that the agent can be downgraded after the next release that will save it.
 getRatchet :: DB.Connection -> ConnId -> IO (Either StoreError RatchetX448)
 getRatchet db connId =
-  firstRow' ratchet SERatchetNotFound $ DB.query db "SELECT ratchet_state FROM ratchets WHERE conn_id = ?" (Only connId)
+  firstRow' ratchet SERatchetNotFound $
+    DB.query
+      db
+      [sql|
+        SELECT r.ratchet_state, k.kem_state
+        FROM ratchets r
+        LEFT JOIN ratchet_kem_states k ON k.conn_id = r.conn_id
+        WHERE r.conn_id = ?
+      |]
+      (Only connId)
   where
-    ratchet = maybe (Left SERatchetNotFound) Right . fromOnly
+    ratchet = \case
+      (Just s, kem_) -> first (SEInternal . B.pack) $ CR.decodeStoredRatchet s kem_
+      _ -> Left SERatchetNotFound
 
 getSkippedMsgKeys :: DB.Connection -> ConnId -> IO SkippedMsgKeys
 getSkippedMsgKeys db connId =
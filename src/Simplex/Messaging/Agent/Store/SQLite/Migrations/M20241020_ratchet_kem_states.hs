@@ -0,0 +1,22 @@
+{-# LANGUAGE QuasiQuotes #-}
+
+module Simplex.Messaging.Agent.Store.SQLite.Migrations.M20241020_ratchet_kem_states where
+
+import Database.SQLite.Simple (Query)
+import Database.SQLite.Simple.QQ (sql)
+
+-- KEM state of the ratchets saved in binary format, this version only reads it.
+m20241020_ratchet_kem_states :: Query
+m20241020_ratchet_kem_states =
+    [sql|
+CREATE TABLE ratchet_kem_states (
+  conn_id BLOB NOT NULL PRIMARY KEY REFERENCES ratchets ON DELETE CASCADE,
+  kem_state BLOB NOT NULL
+);
+|]
+
+down_m20241020_ratchet_kem_states :: Query
+down_m20241020_ratchet_kem_states =
+    [sql|
+DROP TABLE ratchet_kem_states;
+|]
@@ -1,18 +1,45 @@
 {-# LANGUAGE LambdaCase #-}
+{-# LANGUAGE NamedFieldPuns #-}
 {-# LANGUAGE OverloadedStrings #-}
 
-module Simplex.Messaging.Compression where
+module Simplex.Messaging.Compression
+  ( Compressed (..),
+    CompressionDictId,
+    CompressionDict (dictId),
+    maxLengthPassthrough,
+    compressionLevel,
+    mkCompressionDict,
+    compress1,
+    compressWithDict,
+    decompress1,
+    decompressWithDict,
+  ) where
 
-import qualified Codec.Compression.Zstd as Z1
+import Codec.Compression.Zstd.FFI (CCtx, CDict, DCtx, DDict)
+import qualified Codec.Compression.Zstd.FFI as Z
+import Control.Concurrent (myThreadId, threadCapability)
+import qualified Control.Exception as E
 import Data.ByteString (ByteString)
 import qualified Data.ByteString as B
+import qualified Data.ByteString.Internal as BI
+import Data.ByteString.Unsafe (unsafeUseAsCStringLen)
+import Data.IORef
+import Data.IntMap.Strict (IntMap)
+import qualified Data.IntMap.Strict as IM
+import Data.Maybe (fromMaybe)
+import Foreign
+import Foreign.C
 import Simplex.Messaging.Encoding
+import System.IO.Unsafe (unsafeDupablePerformIO, unsafePerformIO)
 
 data Compressed
   = -- | Short messages are left intact to skip copying and FFI festivities.
     Passthrough ByteString
   | -- | Generic compression using no extra context.
     Compressed Large
+  | -- | Compression using the shared dictionary with this ID.
+    -- It can only be sent to the peers that support it and have this dictionary.
+    DictCompressed CompressionDictId Large
 
 -- | Messages below this length are not encoded to avoid compression overhead.
 maxLengthPassthrough :: Int
@@ -25,21 +52,110 @@ instance Encoding Compressed where
   smpEncode = \case
     Passthrough bytes -> "0" <> smpEncode bytes
     Compressed bytes -> "1" <> smpEncode bytes
+    DictCompressed dId bytes -> "2" <> smpEncode (dId, bytes)
   smpP =
     smpP >>= \case
       '0' -> Passthrough <$> smpP
       '1' -> Compressed <$> smpP
+      '2' -> DictCompressed <$> smpP <*> smpP
       x -> fail $ "unknown Compressed tag: " <> show x
 
+-- | Dictionary version, sent with the messages compressed using it.
+type CompressionDictId = Word16
+
+-- | Shared dictionary trained with `zstd --train` on the samples of typical messages.
+-- The released dictionary must never change - the new version gets the new ID,
+-- and the old versions have to be kept to decompress the messages that use them.
+data CompressionDict = CompressionDict
+  { dictId :: CompressionDictId,
+    cDict :: ForeignPtr CDict,
+    dDict :: ForeignPtr DDict
+  }
+
+-- | Prepares the dictionary once, so it is not parsed for each message.
+mkCompressionDict :: CompressionDictId -> ByteString -> IO CompressionDict
+mkCompressionDict dictId dict =
+  unsafeUseAsCStringLen dict $ \(p, len) -> do
+    cDict <- newForeignPtr Z.p_freeCDict =<< Z.checkAlloc "createCDict" (Z.createCDict p (fromIntegral len) compressionLevel)
+    dDict <- newForeignPtr Z.p_freeDDict =<< Z.checkAlloc "createDDict" (Z.createDDict p (fromIntegral len))
+    pure CompressionDict {dictId, cDict, dDict}
+
 compress1 :: ByteString -> Compressed
 compress1 bs
   | B.length bs <= maxLengthPassthrough = Passthrough bs
-  | otherwise = Compressed . Large $ Z1.compress compressionLevel bs
+  | otherwise = Compressed . Large $ zstdCompress (\ctx dst dstLen src srcLen -> Z.compressCCtx ctx dst dstLen src srcLen compressionLevel) bs
+
+compressWithDict :: CompressionDict -> ByteString -> Compressed
+compressWithDict CompressionDict {dictId, cDict} bs
+  | B.length bs <= maxLengthPassthrough = Passthrough bs
+  | otherwise = DictCompressed dictId . Large $ zstdCompress (\ctx dst dstLen src srcLen -> withForeignPtr cDict $ Z.compressUsingCDict ctx dst dstLen src srcLen) bs
 
 decompress1 :: Compressed -> Either String ByteString
-decompress1 = \case
+decompress1 = decompressWithDict (const Nothing)
+
+-- | Decompresses the message using the dictionary available to this client by its ID.
+decompressWithDict :: (CompressionDictId -> Maybe CompressionDict) -> Compressed -> Either String ByteString
+decompressWithDict getDict = \case
   Passthrough bs -> Right bs
-  Compressed (Large bs) -> case Z1.decompress bs of
-    Z1.Error e -> Left e
-    Z1.Skip -> Right mempty
-    Z1.Decompress bs' -> Right bs'
+  Compressed (Large bs) -> zstdDecompress Z.decompressDCtx bs
+  DictCompressed dId (Large bs) -> case getDict dId of
+    Just CompressionDict {dDict} -> zstdDecompress (\ctx dst dstLen src srcLen -> withForeignPtr dDict $ Z.decompressUsingDDict ctx dst dstLen src srcLen) bs
+    Nothing -> Left $ "unknown compression dictionary: " <> show dId
+
+zstdCompress :: (Ptr CCtx -> Ptr Word8 -> CSize -> Ptr Word8 -> CSize -> IO CSize) -> ByteString -> ByteString
+zstdCompress compress bs = unsafeDupablePerformIO $
+  unsafeUseAsCStringLen bs $ \(src, len) -> do
+    let bound = fromIntegral $ Z.compressBound (fromIntegral len)
+    withZstdContext cctxPool $ \ctx ->
+      BI.createAndTrim bound $ \dst ->
+        Z.checkError (compress ctx dst (fromIntegral bound) (castPtr src) (fromIntegral len)) >>= \case
+          Left e -> E.throwIO $ userError e
+          Right r -> pure $ fromIntegral r
+
+zstdDecompress :: (Ptr DCtx -> Ptr Word8 -> CSize -> Ptr Word8 -> CSize -> IO CSize) -> ByteString -> Either String ByteString
+zstdDecompress decompress bs = unsafeDupablePerformIO $
+  unsafeUseAsCStringLen bs $ \(src, len) ->
+    Z.getDecompressedSize src (fromIntegral len) >>= \case
+      -- frames without content size are skipped, as zstd package did before
+      Nothing -> pure $ Right mempty
+      Just size
+        | size > fromIntegral (maxBound :: Int) -> pure $ Left "decompressed size is too large"
+        | otherwise -> withZstdContext dctxPool $ \ctx -> do
+            let size' = fromIntegral size
+            fp <- BI.mallocByteString size'
+            r <- withForeignPtr fp $ \dst -> Z.checkError $ decompress ctx dst (fromIntegral size') (castPtr src) (fromIntegral len)
+            pure $ BI.fromForeignPtr fp 0 . fromIntegral <$> r
+
+-- | Native contexts reused by the threads running on the same capability.
+-- Context is taken from the capability slot for the duration of one FFI call and then returned to it.
+-- If the slot is empty (another thread on this capability holds the context,
+-- or the evaluation that took it was abandoned), a new context is created and put to the slot after the call.
+-- Contexts are freed by finalizers, so the contexts that are not returned do not leak.
+data ZstdContextPool c = ZstdContextPool
+  { createCtx :: IO (Ptr c),
+    freeCtx :: FinalizerPtr c,
+    ctxSlots :: IORef (IntMap (IORef (Maybe (ForeignPtr c))))
+  }
+
+cctxPool :: ZstdContextPool CCtx
+cctxPool = unsafePerformIO $ ZstdContextPool (Z.checkAlloc "createCCtx" Z.createCCtx) Z.p_freeCCtx <$> newIORef IM.empty
+{-# NOINLINE cctxPool #-}
+
+dctxPool :: ZstdContextPool DCtx
+dctxPool = unsafePerformIO $ ZstdContextPool (Z.checkAlloc "createDCtx" Z.createDCtx) Z.p_freeDCtx <$> newIORef IM.empty
+{-# NOINLINE dctxPool #-}
+
+withZstdContext :: ZstdContextPool c -> (Ptr c -> IO a) -> IO a
+withZstdContext ZstdContextPool {createCtx, freeCtx, ctxSlots} action = do
+  (cap, _) <- threadCapability =<< myThreadId
+  slot <- maybe (addSlot cap) pure . IM.lookup cap =<< readIORef ctxSlots
+  ctx <- maybe (newForeignPtr freeCtx =<< createCtx) pure =<< atomicModifyIORef' slot (\ctx_ -> (Nothing, ctx_))
+  r <- withForeignPtr ctx action
+  atomicModifyIORef' slot $ \ctx_ -> (Just $ fromMaybe ctx ctx_, ())
+  pure r
+  where
+    addSlot cap = do
+      slot <- newIORef Nothing
+      atomicModifyIORef' ctxSlots $ \slots -> case IM.lookup cap slots of
+        Just slot' -> (slots, slot')
+        Nothing -> (IM.insert cap slot slots, slot)
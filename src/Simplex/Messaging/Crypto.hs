@@ -14,6 +14,7 @@
 {-# LANGUAGE RankNTypes #-}
 {-# LANGUAGE ScopedTypeVariables #-}
 {-# LANGUAGE StandaloneDeriving #-}
+{-# LANGUAGE TupleSections #-}
 {-# LANGUAGE TypeApplications #-}
 {-# LANGUAGE TypeFamilies #-}
 {-# LANGUAGE TypeOperators #-}
@@ -100,6 +101,7 @@ module Simplex.Messaging.Crypto
     sign',
     verify,
     verify',
+    verifyBatch,
     validSignatureSize,
     checkAlgorithm,
 
@@ -107,10 +109,14 @@ module Simplex.Messaging.Crypto
     CbAuthenticator (..),
     cbAuthenticatorSize,
     cbAuthenticate,
+    cbAuthenticateCached,
     cbVerify,
+    cbVerifyCached,
+    cbVerifyUncached,
 
     -- * DH derivation
     dh',
+    dhCached,
     dhBytes',
 
     -- * AES256 AEAD-GCM scheme
@@ -119,7 +125,9 @@ module Simplex.Messaging.Crypto
     GCMIV (unGCMIV), -- constructor is not exported
     AuthTag (..),
     encryptAEAD,
+    encryptAEADInto,
     decryptAEAD,
+    decryptAEADAny,
     encryptAESNoPad,
     decryptAESNoPad,
     authTagSize,
@@ -198,13 +206,13 @@ import Control.Concurrent.STM
 import Control.Exception (Exception)
 import Control.Monad
 import Control.Monad.Except
+import Control.Monad.IO.Class (liftIO)
 import Control.Monad.Trans.Except
 import Crypto.Cipher.AES (AES256)
 import qualified Crypto.Cipher.Types as AES
 import qualified Crypto.Cipher.XSalsa as XSalsa
 import qualified Crypto.Error as CE
 import Crypto.Hash (Digest, SHA256 (..), SHA512 (..), hash, hashDigestSize)
-import qualified Crypto.KDF.HKDF as H
 import qualified Crypto.MAC.Poly1305 as Poly1305
 import qualified Crypto.PubKey.Curve25519 as X25519
 import qualified Crypto.PubKey.Curve448 as X448
@@ -220,27 +228,34 @@ import Data.Bifunctor (bimap, first)
 import Data.ByteArray (ByteArrayAccess)
 import qualified Data.ByteArray as BA
 import Data.ByteString.Base64 (decode, encode)
-import qualified Data.ByteString.Base64.URL as U
 import Data.ByteString.Char8 (ByteString)
 import qualified Data.ByteString.Char8 as B
 import Data.ByteString.Lazy (fromStrict, toStrict)
 import Data.Constraint (Dict (..))
+import Data.Functor (($>))
 import Data.Kind (Constraint, Type)
 import qualified Data.List.NonEmpty as L
 import Data.String
 import Data.Type.Equality
 import Data.Typeable (Proxy (Proxy), Typeable)
-import Data.Word (Word32)
+import Data.Word (Word32, Word8)
 import Data.X509
 import Data.X509.Validation (Fingerprint (..), getFingerprint)
 import Database.SQLite.Simple.FromField (FromField (..))
 import Database.SQLite.Simple.ToField (ToField (..))
+import Foreign.Ptr (Ptr, nullPtr)
 import GHC.TypeLits (ErrorMessage (..), KnownNat, Nat, TypeError, natVal, type (+))
 import Network.Transport.Internal (decodeWord16, encodeWord16)
+import Simplex.Messaging.Crypto.AESGCM (aesGCMDecrypt, aesGCMDecryptAny, aesGCMEncryptPadded)
+import Simplex.Messaging.Crypto.Ed25519Batch (ed25519VerifyBatch)
+import Simplex.Messaging.Crypto.HKDF (hkdf)
+import Simplex.Messaging.Crypto.X25519Cache (X25519Cache, insertX25519Secret, lookupX25519Secret)
 import Simplex.Messaging.Encoding
+import qualified Simplex.Messaging.Encoding.Base64URL as U
 import Simplex.Messaging.Encoding.String
 import Simplex.Messaging.Parsers (blobFieldDecoder, parseAll, parseString)
 import Simplex.Messaging.Util ((<$?>))
+import System.IO.Unsafe (unsafeDupablePerformIO)
 
 -- | Cryptographic algorithms.
 data Algorithm = Ed25519 | Ed448 | X25519 | X448
@@ -491,6 +506,10 @@ instance AlgorithmI a => StrEncoding (DhSecret a) where
   strEncode = strEncode . dhBytes'
   strDecode = (\(ADhSecret _ s) -> checkAlgorithm s) <=< strDecode
 
+instance AlgorithmI a => Encoding (DhSecret a) where
+  smpEncode = smpEncode . dhBytes'
+  smpP = strDecode <$?> smpP
+
 instance StrEncoding ADhSecret where
   strEncode (ADhSecret _ s) = strEncode $ dhBytes' s
   strDecode = cryptoPassed . secret
@@ -844,6 +863,8 @@ data CryptoError
     CryptoIVError
   | -- | AES decryption error
     AESDecryptError
+  | -- | AES encryption error
+    AESEncryptError
   | -- CryptoBox decryption error
     CBDecryptError
   | -- Poly1305 initialization error
@@ -967,13 +988,34 @@ sha512Hash = BA.convert . (hash :: ByteString -> Digest SHA512)
 -- | AEAD-GCM encryption with associated data.
 --
 -- Used as part of double ratchet encryption.
--- This function requires 16 bytes IV, it transforms IV in cryptonite_aes_gcm_init here:
+-- This function requires 16 bytes IV, it transforms IV in the same way as cryptonite_aes_gcm_init here:
 -- https://github.com/haskell-crypto/cryptonite/blob/master/cbits/cryptonite_aes.c
+-- The message is padded while it is encrypted, by the native AES-GCM, without allocating the padded message.
 encryptAEAD :: Key -> IV -> Int -> ByteString -> ByteString -> ExceptT CryptoError IO (AuthTag, ByteString)
-encryptAEAD aesKey ivBytes paddedLen ad msg = do
-  aead <- initAEAD @AES256 aesKey ivBytes
-  msg' <- liftEither $ pad msg paddedLen
-  pure . first AuthTag $ AES.aeadSimpleEncrypt aead ad msg' authTagSize
+encryptAEAD aesKey iv paddedLen ad msg = do
+  liftEither $ validatePaddedAEAD aesKey iv paddedLen msg
+  ((ok, encMsg), tag) <- liftIO $ BA.allocRet authTagSize $ \tagPtr -> BA.allocRet paddedLen $ \out ->
+    aesGCMEncryptPadded (unKey aesKey) (unIV iv) ad (nullPtr, 0) msg paddedLen out tagPtr
+  unless ok $ throwE AESEncryptError
+  pure (AuthTag $ AES.AuthTag tag, encMsg)
+
+-- | The same as encryptAEAD, but the encrypted message (paddedLen bytes) and the auth tag are written to the buffers.
+-- The associated data is ad followed by the bytes at the pointer, so it can include the part of the output buffer.
+encryptAEADInto :: Key -> IV -> Int -> ByteString -> (Ptr Word8, Int) -> ByteString -> Ptr Word8 -> Ptr Word8 -> ExceptT CryptoError IO ()
+encryptAEADInto aesKey iv paddedLen ad ad2 msg out tagPtr = do
+  liftEither $ validatePaddedAEAD aesKey iv paddedLen msg
+  ok <- liftIO $ aesGCMEncryptPadded (unKey aesKey) (unIV iv) ad ad2 msg paddedLen out tagPtr
+  unless ok $ throwE AESEncryptError
+
+-- the same errors as with crypton AES-GCM and pad
+validatePaddedAEAD :: Key -> IV -> Int -> ByteString -> Either CryptoError ()
+validatePaddedAEAD (Key aesKey) (IV ivBytes) paddedLen msg
+  | B.length aesKey /= aesKeySize = Left $ AESCipherError CE.CryptoError_KeySizeInvalid
+  | B.length ivBytes /= ivSize @AES256 = Left CryptoIVError
+  | len > maxMsgLen || paddedLen - len - 2 < 0 = Left CryptoLargeMsgError
+  | otherwise = Right ()
+  where
+    len = B.length msg
 
 -- Used to encrypt WebRTC frames.
 -- This function requires 12 bytes IV, it does not transform IV.
@@ -990,11 +1032,24 @@ encryptAEADNoPad aesKey ivBytes ad msg = do
 -- Used as part of double ratchet encryption.
 -- This function requires 16 bytes IV, it transforms IV in cryptonite_aes_gcm_init here:
 -- https://github.com/haskell-crypto/cryptonite/blob/master/cbits/cryptonite_aes.c
--- To make it compatible with WebCrypto we will need to start using initAEADGCM.
+-- To make it compatible with WebCrypto we will need to start using 12 bytes IV.
 decryptAEAD :: Key -> IV -> ByteString -> ByteString -> AuthTag -> ExceptT CryptoError IO ByteString
-decryptAEAD aesKey ivBytes ad msg (AuthTag authTag) = do
-  aead <- initAEAD @AES256 aesKey ivBytes
-  liftEither . unPad =<< maybeError AESDecryptError (AES.aeadSimpleDecrypt aead ad msg authTag)
+decryptAEAD (Key aesKey) (IV ivBytes) ad msg (AuthTag authTag) = do
+  when (B.length aesKey /= aesKeySize) $ throwE $ AESCipherError CE.CryptoError_KeySizeInvalid
+  when (B.length ivBytes /= ivSize @AES256) $ throwE CryptoIVError
+  liftEither . unPad =<< maybeError AESDecryptError =<< liftIO (aesGCMDecrypt aesKey ivBytes ad "" msg (BA.convert authTag))
+
+-- | AEAD-GCM decryption with the first of the keys that decrypts the message.
+--
+-- Used to decrypt double ratchet headers: all keys are tried in one native call,
+-- and the time depends only on the number of keys, not on which key matches.
+-- Returns the index of the matching key in the list.
+decryptAEADAny :: [Key] -> IV -> ByteString -> ByteString -> AuthTag -> ExceptT CryptoError IO (Int, ByteString)
+decryptAEADAny keys (IV ivBytes) ad msg (AuthTag authTag) = do
+  let validKeys = filter ((== aesKeySize) . B.length . unKey . snd) $ zip [0 ..] keys
+  liftIO (aesGCMDecryptAny (map (unKey . snd) validKeys) ivBytes ad msg (BA.convert authTag)) >>= \case
+    Just (i, padded) | (keyIdx, _) : _ <- drop i validKeys -> (keyIdx,) <$> liftEither (unPad padded)
+    _ -> throwE AESDecryptError
 
 -- Used to decrypt WebRTC frames.
 -- This function requires 12 bytes IV, it does not transform IV.
@@ -1060,16 +1115,6 @@ appendMaxLenBS (MLBS s1) (MLBS s2) = MLBS $ s1 <> s2
 maxLength :: forall i. KnownNat i => Int
 maxLength = fromIntegral (natVal $ Proxy @i)
 
--- this function requires 16 bytes IV, it transforms IV in cryptonite_aes_gcm_init here:
--- https://github.com/haskell-crypto/cryptonite/blob/master/cbits/cryptonite_aes.c
--- This is used for double ratchet encryption, so to make it compatible with WebCrypto we will need to deprecate it and start using initAEADGCM
-initAEAD :: forall c. AES.BlockCipher c => Key -> IV -> ExceptT CryptoError IO (AES.AEAD c)
-initAEAD (Key aesKey) (IV ivBytes) = do
-  iv <- makeIV @c ivBytes
-  cryptoFailable $ do
-    cipher <- AES.cipherInit aesKey
-    AES.aeadInit AES.AEAD_GCM cipher iv
-
 -- this function requires 12 bytes IV, it does not transforms IV.
 initAEADGCM :: Key -> GCMIV -> ExceptT CryptoError IO (AES.AEAD AES256)
 initAEADGCM (Key aesKey) (GCMIV ivBytes) = cryptoFailable $ do
@@ -1089,9 +1134,6 @@ ivSize = AES.blockSize (undefined :: c)
 gcmIVSize :: Int
 gcmIVSize = 12
 
-makeIV :: AES.BlockCipher c => ByteString -> ExceptT CryptoError IO (AES.IV c)
-makeIV bs = maybeError CryptoIVError $ AES.makeIV bs
-
 maybeError :: CryptoError -> Maybe a -> ExceptT CryptoError IO a
 maybeError e = maybe (throwE e) return
 
@@ -1193,10 +1235,37 @@ verify (APublicVerifyKey a k) (ASignature a' sig) msg = case testEquality a a' o
   Just Refl -> verify' k sig msg
   _ -> False
 
+-- | Batch verification of Ed25519 signatures, faster than verifying them one by one.
+--
+-- Returns True if all signatures are valid. When it returns False,
+-- signatures have to be verified with verify' to find the invalid ones.
+verifyBatch :: [(PublicKey Ed25519, Signature Ed25519, ByteString)] -> IO Bool
+verifyBatch sigs =
+  ed25519VerifyBatch (map (\(PublicKeyEd25519 k, SignatureEd25519 sig, msg) -> (BA.convert k, BA.convert sig, msg)) sigs) >>= \case
+    Just r -> pure r
+    Nothing -> pure $ all (\(k, sig, msg) -> verify' k sig msg) sigs
+
 dh' :: DhAlgorithm a => PublicKey a -> PrivateKey a -> DhSecret a
 dh' (PublicKeyX25519 k) (PrivateKeyX25519 pk _) = DhSecretX25519 $ X25519.dh k pk
 dh' (PublicKeyX448 k) (PrivateKeyX448 pk _) = DhSecretX448 $ X448.dh k pk
 
+-- | X25519 shared secret from the session cache, it is computed and added to the cache on miss.
+dhCached :: X25519Cache -> PublicKeyX25519 -> PrivateKeyX25519 -> DhSecret X25519
+dhCached cache k pk = unsafeDupablePerformIO $
+  lookupDhCached cache k pk >>= \case
+    Just secret -> pure secret
+    Nothing -> let secret = dh' k pk in insertDhCached cache k pk secret $> secret
+
+lookupDhCached :: X25519Cache -> PublicKeyX25519 -> PrivateKeyX25519 -> IO (Maybe (DhSecret X25519))
+lookupDhCached cache (PublicKeyX25519 peerKey) (PrivateKeyX25519 _ ownKey) =
+  lookupX25519Secret cache peerKey ownKey >>= \case
+    Just s | CE.CryptoPassed secret <- X25519.dhSecret s -> pure $ Just $ DhSecretX25519 secret
+    _ -> pure Nothing
+
+insertDhCached :: X25519Cache -> PublicKeyX25519 -> PrivateKeyX25519 -> DhSecret X25519 -> IO ()
+insertDhCached cache (PublicKeyX25519 peerKey) (PrivateKeyX25519 _ ownKey) (DhSecretX25519 s) =
+  insertX25519Secret cache peerKey ownKey s
+
 -- | NaCl @crypto_box@ encrypt with padding with a shared DH secret and 192-bit nonce.
 cbEncrypt :: DhSecret X25519 -> CbNonce -> ByteString -> Int -> Either CryptoError ByteString
 cbEncrypt (DhSecretX25519 secret) = sbEncrypt_ secret
@@ -1257,11 +1326,40 @@ cbAuthenticatorSize = hashDigestSize SHA512 + authTagSize -- 64 + 16 = 80 bytes
 
 -- create crypto_box authenticator for a message.
 cbAuthenticate :: PublicKeyX25519 -> PrivateKeyX25519 -> CbNonce -> ByteString -> CbAuthenticator
-cbAuthenticate k pk nonce msg = CbAuthenticator $ cbEncryptNoPad (dh' k pk) nonce (sha512Hash msg)
+cbAuthenticate k pk = cbAuthenticate_ (dh' k pk)
+
+-- | cbAuthenticate with the shared secret from the session cache.
+cbAuthenticateCached :: X25519Cache -> PublicKeyX25519 -> PrivateKeyX25519 -> CbNonce -> ByteString -> CbAuthenticator
+cbAuthenticateCached cache k pk = cbAuthenticate_ (dhCached cache k pk)
+
+cbAuthenticate_ :: DhSecret X25519 -> CbNonce -> ByteString -> CbAuthenticator
+cbAuthenticate_ secret nonce msg = CbAuthenticator $ cbEncryptNoPad secret nonce (sha512Hash msg)
 
 -- verify crypto_box authenticator for a message.
 cbVerify :: PublicKeyX25519 -> PrivateKeyX25519 -> CbNonce -> CbAuthenticator -> ByteString -> Bool
-cbVerify k pk nonce (CbAuthenticator s) authorized = cbDecryptNoPad (dh' k pk) nonce s == Right (sha512Hash authorized)
+cbVerify k pk = cbVerify_ (dh' k pk)
+
+-- | cbVerify with the shared secret from the session cache.
+-- On cache miss the secret is added to the cache only if the check succeeds, so failed checks always compute DH secret.
+cbVerifyCached :: X25519Cache -> PublicKeyX25519 -> PrivateKeyX25519 -> CbNonce -> CbAuthenticator -> ByteString -> Bool
+cbVerifyCached cache k pk nonce auth authorized = unsafeDupablePerformIO $
+  lookupDhCached cache k pk >>= \case
+    Just secret -> pure $ cbVerify_ secret nonce auth authorized
+    Nothing -> do
+      let secret = dh' k pk
+          r = cbVerify_ secret nonce auth authorized
+      when r $ insertDhCached cache k pk secret
+      pure r
+
+-- | cbVerify with the same cost as the cache miss in 'cbVerifyCached', the result of the cache lookup is ignored.
+-- It is used with the dummy key, so that the failed check takes the same time whether the queue exists or not.
+cbVerifyUncached :: X25519Cache -> PublicKeyX25519 -> PrivateKeyX25519 -> CbNonce -> CbAuthenticator -> ByteString -> Bool
+cbVerifyUncached cache k pk nonce auth authorized = unsafeDupablePerformIO $ do
+  _ <- lookupDhCached cache k pk
+  pure $! cbVerify_ (dh' k pk) nonce auth authorized
+
+cbVerify_ :: DhSecret X25519 -> CbNonce -> CbAuthenticator -> ByteString -> Bool
+cbVerify_ secret nonce (CbAuthenticator s) authorized = cbDecryptNoPad secret nonce s == Right (sha512Hash authorized)
 
 newtype CbNonce = CryptoBoxNonce {unCbNonce :: ByteString}
   deriving (Eq, Show)
@@ -1347,8 +1445,7 @@ newtype SbChainKey = SecretBoxChainKey {unSbChainKey :: ByteString}
 sbcInit :: ByteArrayAccess secret => ByteString -> secret -> (SbChainKey, SbChainKey)
 sbcInit salt secret = (SecretBoxChainKey ck1, SecretBoxChainKey ck2)
   where
-    prk = H.extract salt secret :: H.PRK SHA512
-    out = H.expand prk ("SimpleXSbChainInit" :: ByteString) 64
+    out = hkdf salt secret "SimpleXSbChainInit" 64
     (ck1, ck2) = B.splitAt 32 out
 
 type SbKeyNonce = (SbKey, CbNonce)
@@ -1356,8 +1453,7 @@ type SbKeyNonce = (SbKey, CbNonce)
 sbcHkdf :: SbChainKey -> (SbKeyNonce, SbChainKey)
 sbcHkdf (SecretBoxChainKey ck) = ((SecretBoxKey sk, CryptoBoxNonce nonce), SecretBoxChainKey ck')
   where
-    prk = H.extract B.empty ck :: H.PRK SHA512
-    out = H.expand prk ("SimpleXSbChain" :: ByteString) 88 -- = 32 (new chain key) + 32 (secret_box key) + 24 (nonce)
+    out = hkdf B.empty ck "SimpleXSbChain" 88 -- = 32 (new chain key) + 32 (secret_box key) + 24 (nonce)
     (ck', rest) = B.splitAt 32 out
     (sk, nonce) = B.splitAt 32 rest
 
@@ -0,0 +1,74 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+
+-- |
+-- Module      : Simplex.Messaging.Crypto.AESGCM
+-- Copyright   : (c) simplex.chat
+-- License     : AGPL-3
+--
+-- Maintainer  : chat@simplex.chat
+-- Stability   : experimental
+-- Portability : non-portable
+--
+-- Native AES-256-GCM operations that are not available in crypton.
+module Simplex.Messaging.Crypto.AESGCM
+  ( aesGCMEncryptPadded,
+    aesGCMDecrypt,
+    aesGCMDecryptAny,
+  ) where
+
+import qualified Data.ByteArray as BA
+import Data.ByteString (ByteString)
+import qualified Data.ByteString as B
+import Foreign
+import Foreign.C
+
+-- | AES-256-GCM encryption of the message padded to paddedLen bytes as in Simplex.Messaging.Crypto.pad,
+-- without allocating the padded message: the ciphertext is written to out and the tag to tagOut.
+-- The associated data is ad followed by the bytes at the pointer, that can be in the same output buffer.
+-- The message length should be validated by the caller, it returns False if it does not fit or on internal error.
+aesGCMEncryptPadded :: ByteString -> ByteString -> ByteString -> (Ptr Word8, Int) -> ByteString -> Int -> Ptr Word8 -> Ptr Word8 -> IO Bool
+aesGCMEncryptPadded key iv ad (ad2Ptr, ad2Len) msg paddedLen out tagOut =
+  BA.withByteArray key $ \keyPtr ->
+    BA.withByteArray iv $ \ivPtr ->
+      BA.withByteArray ad $ \adPtr ->
+        BA.withByteArray msg $ \msgPtr ->
+          (== 0) <$> c_aes256gcm_encrypt_padded out tagOut keyPtr ivPtr (fromIntegral $ B.length iv) adPtr (fromIntegral $ B.length ad) ad2Ptr (fromIntegral ad2Len) msgPtr (fromIntegral $ B.length msg) (fromIntegral paddedLen)
+
+-- | AES-256-GCM decryption with the associated data ad1 <> ad2, without concatenating it.
+aesGCMDecrypt :: ByteString -> ByteString -> ByteString -> ByteString -> ByteString -> ByteString -> IO (Maybe ByteString)
+aesGCMDecrypt key iv ad1 ad2 ct tag =
+  BA.withByteArray key $ \keyPtr ->
+    BA.withByteArray iv $ \ivPtr ->
+      BA.withByteArray ad1 $ \ad1Ptr ->
+        BA.withByteArray ad2 $ \ad2Ptr ->
+          BA.withByteArray ct $ \ctPtr ->
+            BA.withByteArray tag $ \tagPtr -> do
+              (r, out) <- BA.allocRet (B.length ct) $ \outPtr ->
+                c_aes256gcm_decrypt outPtr keyPtr ivPtr (fromIntegral $ B.length iv) ad1Ptr (fromIntegral $ B.length ad1) ad2Ptr (fromIntegral $ B.length ad2) ctPtr (fromIntegral $ B.length ct) tagPtr
+              pure $ if r == 1 then Just out else Nothing
+
+-- | AES-256-GCM decryption with the first of the 32-byte keys that authenticates the message.
+-- All keys are tried in one call, so that the time depends only on the number of keys.
+-- Returns the index of the matching key and the plaintext.
+aesGCMDecryptAny :: [ByteString] -> ByteString -> ByteString -> ByteString -> ByteString -> IO (Maybe (Int, ByteString))
+aesGCMDecryptAny keys iv ad ct tag =
+  BA.withByteArray (B.concat keys) $ \keysPtr ->
+    BA.withByteArray iv $ \ivPtr ->
+      BA.withByteArray ad $ \adPtr ->
+        BA.withByteArray ct $ \ctPtr ->
+          BA.withByteArray tag $ \tagPtr -> do
+            (r, out) <- BA.allocRet (B.length ct) $ \outPtr ->
+              c_aes256gcm_decrypt_any outPtr keysPtr (fromIntegral $ length keys) ivPtr (fromIntegral $ B.length iv) adPtr (fromIntegral $ B.length ad) ctPtr (fromIntegral $ B.length ct) tagPtr
+            pure $ if r >= 0 then Just (fromIntegral r, out) else Nothing
+
+-- int aes256gcm_encrypt_padded (uint8_t *out, uint8_t *tag, const uint8_t *key, const uint8_t *iv, size_t iv_len, const uint8_t *ad1, size_t ad1_len, const uint8_t *ad2, size_t ad2_len, const uint8_t *msg, size_t msg_len, size_t padded_len);
+foreign import ccall unsafe "aes256gcm_encrypt_padded"
+  c_aes256gcm_encrypt_padded :: Ptr Word8 -> Ptr Word8 -> Ptr Word8 -> Ptr Word8 -> CSize -> Ptr Word8 -> CSize -> Ptr Word8 -> CSize -> Ptr Word8 -> CSize -> CSize -> IO CInt
+
+-- int aes256gcm_decrypt (uint8_t *out, const uint8_t *key, const uint8_t *iv, size_t iv_len, const uint8_t *ad1, size_t ad1_len, const uint8_t *ad2, size_t ad2_len, const uint8_t *ct, size_t ct_len, const uint8_t *tag);
+foreign import ccall unsafe "aes256gcm_decrypt"
+  c_aes256gcm_decrypt :: Ptr Word8 -> Ptr Word8 -> Ptr Word8 -> CSize -> Ptr Word8 -> CSize -> Ptr Word8 -> CSize -> Ptr Word8 -> CSize -> Ptr Word8 -> IO CInt
+
+-- int aes256gcm_decrypt_any (uint8_t *out, const uint8_t *keys, size_t n_keys, const uint8_t *iv, size_t iv_len, const uint8_t *ad, size_t ad_len, const uint8_t *ct, size_t ct_len, const uint8_t *tag);
+foreign import ccall unsafe "aes256gcm_decrypt_any"
+  c_aes256gcm_decrypt_any :: Ptr Word8 -> Ptr Word8 -> CSize -> Ptr Word8 -> CSize -> Ptr Word8 -> CSize -> Ptr Word8 -> CSize -> Ptr Word8 -> IO CInt
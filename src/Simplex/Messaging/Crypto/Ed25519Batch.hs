@@ -0,0 +1,41 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+
+-- |
+-- Module      : Simplex.Messaging.Crypto.Ed25519Batch
+-- Copyright   : (c) simplex.chat
+-- License     : AGPL-3
+--
+-- Maintainer  : chat@simplex.chat
+-- Stability   : experimental
+-- Portability : non-portable
+--
+-- Native randomized batch verification of Ed25519 signatures.
+module Simplex.Messaging.Crypto.Ed25519Batch
+  ( ed25519VerifyBatch,
+  ) where
+
+import qualified Data.ByteArray as BA
+import Data.ByteString (ByteString)
+import qualified Data.ByteString as B
+import Data.ByteString.Unsafe (unsafeUseAsCString)
+import Foreign
+import Foreign.C
+
+-- | Verifies a batch of (32-byte public key, 64-byte signature, message) with one multi-scalar multiplication.
+-- Returns Just True if all signatures are valid, Just False if some signature is invalid,
+-- and Nothing if batch verification is not supported on this platform.
+ed25519VerifyBatch :: [(ByteString, ByteString, ByteString)] -> IO (Maybe Bool)
+ed25519VerifyBatch sigs =
+  BA.withByteArray (B.concat pks) $ \pksPtr ->
+    BA.withByteArray (B.concat ss) $ \sigsPtr ->
+      withMany unsafeUseAsCString msgs $ \msgPtrs ->
+        withArray (map castPtr msgPtrs) $ \msgsPtr ->
+          withArray (map (fromIntegral . B.length) msgs) $ \lensPtr -> do
+            r <- c_ed25519_verify_batch (fromIntegral $ length sigs) pksPtr sigsPtr msgsPtr lensPtr
+            pure $ if r < 0 then Nothing else Just (r == 1)
+  where
+    (pks, ss, msgs) = unzip3 sigs
+
+-- int ed25519_verify_batch (size_t n, const uint8_t *pks, const uint8_t *sigs, const uint8_t *const *msgs, const size_t *msg_lens);
+foreign import ccall "ed25519_verify_batch"
+  c_ed25519_verify_batch :: CSize -> Ptr Word8 -> Ptr Word8 -> Ptr (Ptr Word8) -> Ptr CSize -> IO CInt
@@ -104,6 +104,7 @@ data FTCryptoError
   | FTCEInvalidHeader String
   | FTCEInvalidFileSize
   | FTCEInvalidAuthTag
+  | FTCEInvalidDigest
   | FTCEFileIOError String
   deriving (Show, Eq, Exception)
 
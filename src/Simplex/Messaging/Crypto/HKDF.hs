@@ -0,0 +1,61 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+
+-- |
+-- Module      : Simplex.Messaging.Crypto.HKDF
+-- Copyright   : (c) simplex.chat
+-- License     : AGPL-3
+--
+-- Maintainer  : chat@simplex.chat
+-- Stability   : experimental
+-- Portability : non-portable
+--
+-- Native HKDF-SHA512 (RFC 5869) used in double ratchet and secret box chains.
+module Simplex.Messaging.Crypto.HKDF
+  ( hkdf,
+    hkdfChain,
+  ) where
+
+import Control.Monad (when)
+import Data.ByteArray (ByteArrayAccess)
+import qualified Data.ByteArray as BA
+import Data.ByteString (ByteString)
+import qualified Data.ByteString as B
+import qualified Data.ByteString.Internal as BI
+import Foreign
+import Foreign.C
+import System.IO.Unsafe (unsafeDupablePerformIO)
+
+-- | HKDF-SHA512, the output length must be at most 16320 (255 * 64) bytes.
+hkdf :: ByteArrayAccess ikm => ByteString -> ikm -> ByteString -> Int -> ByteString
+hkdf salt ikm info len =
+  unsafeDupablePerformIO . BI.create len $ \outPtr ->
+    BA.withByteArray salt $ \saltPtr ->
+      BA.withByteArray ikm $ \ikmPtr ->
+        BA.withByteArray info $ \infoPtr -> do
+          r <- c_hkdf_sha512 outPtr (fromIntegral len) saltPtr (fromIntegral $ B.length salt) ikmPtr (fromIntegral $ BA.length ikm) infoPtr (fromIntegral $ B.length info)
+          when (r /= 0) $ error "hkdf: invalid output length"
+
+-- | @n@ steps of HKDF-SHA512 chain with empty salt, computed in one call.
+-- Each step derives @len@ bytes from the current chain key,
+-- the first 32 bytes of the step output are the chain key for the next step.
+-- The returned step outputs share one buffer.
+hkdfChain :: ByteString -> Int -> Int -> ByteString -> [ByteString]
+hkdfChain info len n ck
+  | n <= 0 = []
+  | otherwise = splitSteps $ unsafeDupablePerformIO . BI.create (n * len) $ \outPtr ->
+      BA.withByteArray ck $ \ckPtr ->
+        BA.withByteArray info $ \infoPtr -> do
+          r <- c_hkdf_sha512_chain outPtr (fromIntegral len) (fromIntegral n) ckPtr (fromIntegral $ B.length ck) infoPtr (fromIntegral $ B.length info)
+          when (r /= 0) $ error "hkdfChain: invalid step length"
+  where
+    splitSteps s
+      | B.null s = []
+      | otherwise = let (step, rest) = B.splitAt len s in step : splitSteps rest
+
+-- int hkdf_sha512 (uint8_t *out, size_t out_len, const uint8_t *salt, size_t salt_len, const uint8_t *ikm, size_t ikm_len, const uint8_t *info, size_t info_len);
+foreign import ccall unsafe "hkdf_sha512"
+  c_hkdf_sha512 :: Ptr Word8 -> CSize -> Ptr Word8 -> CSize -> Ptr Word8 -> CSize -> Ptr Word8 -> CSize -> IO CInt
+
+-- int hkdf_sha512_chain (uint8_t *out, size_t step_len, uint32_t n, const uint8_t *ck, size_t ck_len, const uint8_t *info, size_t info_len);
+foreign import ccall unsafe "hkdf_sha512_chain"
+  c_hkdf_sha512_chain :: Ptr Word8 -> CSize -> Word32 -> Ptr Word8 -> CSize -> Ptr Word8 -> CSize -> IO CInt
@@ -0,0 +1,87 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+
+-- |
+-- Module      : Simplex.Messaging.Crypto.HashStream
+-- Copyright   : (c) simplex.chat
+-- License     : AGPL-3
+--
+-- Maintainer  : chat@simplex.chat
+-- Stability   : experimental
+-- Portability : non-portable
+--
+-- Incremental SHA-256 and SHA-512 over native buffers (OpenSSL EVP), to hash the data while it is received or read.
+module Simplex.Messaging.Crypto.HashStream
+  ( HashStream,
+    withSHA256Stream,
+    withSHA512Stream,
+    hashStreamUpdate,
+    hashStreamDigest,
+  ) where
+
+import qualified Control.Exception as E
+import Control.Monad (when)
+import Data.ByteString (ByteString)
+import qualified Data.ByteString.Internal as BI
+import Foreign
+import Foreign.C
+
+data EvpMdCtx
+
+data EvpMd
+
+data HashStream = HashStream (Ptr EvpMdCtx) Int
+
+withSHA256Stream :: (HashStream -> IO a) -> IO a
+withSHA256Stream = withHashStream c_evp_sha256 32
+
+withSHA512Stream :: (HashStream -> IO a) -> IO a
+withSHA512Stream = withHashStream c_evp_sha512 64
+
+withHashStream :: Ptr EvpMd -> Int -> (HashStream -> IO a) -> IO a
+withHashStream md size action = E.bracket newCtx c_evp_md_ctx_free $ \ctx -> do
+  check "EVP_DigestInit_ex" =<< c_evp_digest_init_ex ctx md nullPtr
+  action $ HashStream ctx size
+  where
+    newCtx = do
+      ctx <- c_evp_md_ctx_new
+      when (ctx == nullPtr) $ E.throwIO $ userError "EVP_MD_CTX_new: allocation failed"
+      pure ctx
+
+hashStreamUpdate :: HashStream -> Ptr Word8 -> Int -> IO ()
+hashStreamUpdate (HashStream ctx _) p len = check "EVP_DigestUpdate" =<< c_evp_digest_update ctx p (fromIntegral len)
+
+-- | The digest of all data, the stream cannot be updated after that.
+hashStreamDigest :: HashStream -> IO ByteString
+hashStreamDigest (HashStream ctx size) =
+  BI.create size $ \p -> check "EVP_DigestFinal_ex" =<< c_evp_digest_final_ex ctx p nullPtr
+
+check :: String -> CInt -> IO ()
+check name r = when (r /= 1) $ E.throwIO $ userError $ name <> " failed"
+
+-- EVP_MD_CTX *EVP_MD_CTX_new (void);
+foreign import ccall unsafe "EVP_MD_CTX_new"
+  c_evp_md_ctx_new :: IO (Ptr EvpMdCtx)
+
+-- void EVP_MD_CTX_free (EVP_MD_CTX *ctx);
+foreign import ccall unsafe "EVP_MD_CTX_free"
+  c_evp_md_ctx_free :: Ptr EvpMdCtx -> IO ()
+
+-- const EVP_MD *EVP_sha256 (void);
+foreign import ccall unsafe "EVP_sha256"
+  c_evp_sha256 :: Ptr EvpMd
+
+-- const EVP_MD *EVP_sha512 (void);
+foreign import ccall unsafe "EVP_sha512"
+  c_evp_sha512 :: Ptr EvpMd
+
+-- int EVP_DigestInit_ex (EVP_MD_CTX *ctx, const EVP_MD *type, ENGINE *impl);
+foreign import ccall unsafe "EVP_DigestInit_ex"
+  c_evp_digest_init_ex :: Ptr EvpMdCtx -> Ptr EvpMd -> Ptr () -> IO CInt
+
+-- int EVP_DigestUpdate (EVP_MD_CTX *ctx, const void *d, size_t cnt);
+foreign import ccall unsafe "EVP_DigestUpdate"
+  c_evp_digest_update :: Ptr EvpMdCtx -> Ptr Word8 -> CSize -> IO CInt
+
+-- int EVP_DigestFinal_ex (EVP_MD_CTX *ctx, unsigned char *md, unsigned int *s);
+foreign import ccall unsafe "EVP_DigestFinal_ex"
+  c_evp_digest_final_ex :: Ptr EvpMdCtx -> Ptr Word8 -> Ptr CUInt -> IO CInt
@@ -0,0 +1,79 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+
+-- |
+-- Module      : Simplex.Messaging.Crypto.KeySlab
+-- Copyright   : (c) simplex.chat
+-- License     : AGPL-3
+--
+-- Maintainer  : chat@simplex.chat
+-- Stability   : experimental
+-- Portability : non-portable
+--
+-- Secret keys allocated from the native slab allocator in locked memory.
+-- Unlike 'ScrubbedBytes', they are not allocated in pinned GHC heap,
+-- and they are wiped and returned to the free list by C finalizer, without scheduling Haskell finalizers.
+module Simplex.Messaging.Crypto.KeySlab
+  ( LockedBytes,
+    keySlabCount,
+  ) where
+
+import Control.Monad (when)
+import Data.ByteArray (ByteArray (..), ByteArrayAccess (..))
+import qualified Data.ByteArray as BA
+import Foreign
+import Foreign.C
+import System.IO.Unsafe (unsafeDupablePerformIO)
+
+data LockedBytes = LockedBytes (ForeignPtr Word8) Int
+
+instance Show LockedBytes where
+  show _ = "<locked-bytes>"
+
+instance Eq LockedBytes where
+  (==) = BA.constEq
+
+instance Ord LockedBytes where
+  compare a b = unsafeDupablePerformIO $
+    BA.withByteArray a $ \pa -> BA.withByteArray b $ \pb -> do
+      let la = BA.length a
+          lb = BA.length b
+      r <- c_memcmp pa pb (fromIntegral $ min la lb)
+      pure $ if r == 0 then compare la lb else compare r 0
+
+instance Semigroup LockedBytes where
+  (<>) = BA.append
+
+instance Monoid LockedBytes where
+  mempty = BA.empty
+
+instance ByteArrayAccess LockedBytes where
+  length (LockedBytes _ n) = n
+  withByteArray (LockedBytes fp _) f = withForeignPtr fp (f . castPtr)
+
+instance ByteArray LockedBytes where
+  allocRet n f = do
+    p <- c_key_slab_alloc (fromIntegral n)
+    when (p == nullPtr) $ ioError $ userError "LockedBytes: allocation failed"
+    fp <- newForeignPtr c_key_slab_free_ptr p
+    r <- withForeignPtr fp (f . castPtr)
+    pure (r, LockedBytes fp n)
+
+-- | Number of allocated keys, for diagnostics.
+keySlabCount :: IO Int
+keySlabCount = fromIntegral <$> c_key_slab_count
+
+-- void *key_slab_alloc (size_t size);
+foreign import ccall unsafe "key_slab_alloc"
+  c_key_slab_alloc :: CSize -> IO (Ptr Word8)
+
+-- void key_slab_free (void *p);
+foreign import ccall unsafe "&key_slab_free"
+  c_key_slab_free_ptr :: FunPtr (Ptr Word8 -> IO ())
+
+-- size_t key_slab_count (void);
+foreign import ccall unsafe "key_slab_count"
+  c_key_slab_count :: IO CSize
+
+-- int memcmp (const void *s1, const void *s2, size_t n);
+foreign import ccall unsafe "string.h memcmp"
+  c_memcmp :: Ptr Word8 -> Ptr Word8 -> CSize -> IO CInt
@@ -78,6 +78,8 @@ module Simplex.Messaging.Crypto.Ratchet
     RatchetKey (..),
     fullHeaderLen,
     applySMDiff,
+    decodeRatchet,
+    decodeStoredRatchet,
     encodeMsgHeader,
     msgHeaderP,
   )
@@ -88,8 +90,6 @@ import Control.Monad.Except
 import Control.Monad.IO.Class (liftIO)
 import Control.Monad.Trans.Except
 import Crypto.Cipher.AES (AES256)
-import Crypto.Hash (SHA512)
-import qualified Crypto.KDF.HKDF as H
 import Crypto.Random (ChaChaDRG)
 import Data.Aeson (FromJSON (..), ToJSON (..))
 import qualified Data.Aeson as J
@@ -102,6 +102,7 @@ import qualified Data.ByteString.Char8 as B
 import qualified Data.ByteString.Lazy as LB
 import Data.Composition ((.:), (.:.))
 import Data.Functor (($>))
+import Data.List (foldl')
 import qualified Data.List.NonEmpty as L
 import Data.Map.Strict (Map)
 import qualified Data.Map.Strict as M
@@ -111,8 +112,10 @@ import Data.Typeable (Typeable)
 import Data.Word (Word16, Word32)
 import Database.SQLite.Simple.FromField (FromField (..))
 import Database.SQLite.Simple.ToField (ToField (..))
+import Foreign.Ptr (nullPtr, plusPtr)
 import Simplex.Messaging.Agent.QueryString
 import Simplex.Messaging.Crypto
+import Simplex.Messaging.Crypto.HKDF (hkdf, hkdfChain)
 import Simplex.Messaging.Crypto.SNTRUP761.Bindings
 import Simplex.Messaging.Encoding
 import Simplex.Messaging.Encoding.String
@@ -522,14 +525,14 @@ data RatchetKEM = RatchetKEM
   { rcPQRs :: KEMKeyPair,
     rcKEMs :: Maybe RatchetKEMAccepted
   }
-  deriving (Show)
+  deriving (Eq, Show)
 
 data RatchetKEMAccepted = RatchetKEMAccepted
   { rcPQRr :: KEMPublicKey, -- received key
     rcPQRss :: KEMSharedKey, -- computed shared secret
     rcPQRct :: KEMCiphertext -- sent encaps(rcPQRr, rcPQRss)
   }
-  deriving (Show)
+  deriving (Eq, Show)
 
 type SkippedMsgKeys = Map HeaderKey SkippedHdrMsgKeys
 
@@ -729,9 +732,30 @@ data EncRatchetMessage = EncRatchetMessage
     emBody :: ByteString
   }
 
-encodeEncRatchetMessage :: VersionE2E -> EncRatchetMessage -> ByteString
-encodeEncRatchetMessage v EncRatchetMessage {emHeader, emBody, emAuthTag} =
-  encodeLarge v emHeader <> smpEncode (emAuthTag, Tail emBody)
+-- | Encrypts the header and the message into one buffer, in the format parsed by encRatchetMessageP:
+-- encodeLarge v emHeader <> smpEncode (emAuthTag, Tail emBody), where emHeader is encoded EncMessageHeader.
+-- The header and the message are padded while they are encrypted, and the encrypted header is written
+-- before the message is encrypted, because it is a part of the message associated data.
+encryptRatchetMessage :: VersionE2E -> HeaderKey -> IV -> Int -> ByteString -> ByteString -> MessageKey -> Int -> ByteString -> ExceptT CryptoError IO ByteString
+encryptRatchetMessage v hk ehIV hdrPaddedLen ad hdr (MessageKey mk iv) msgPaddedLen msg = do
+  (r, msg') <- liftIO . BA.allocRet totalLen $ \p -> runExceptT $ do
+    liftIO $ BA.copyByteArrayToPtr prefix p
+    encryptAEADInto hk ehIV hdrPaddedLen ad (nullPtr, 0) hdr (p `plusPtr` ehBodyPos) (p `plusPtr` ehTagPos)
+    liftIO $ BA.copyByteArrayToPtr (encodeLen hdrPaddedLen) (p `plusPtr` (ehTagPos + authTagSize))
+    encryptAEADInto mk iv msgPaddedLen ad (p `plusPtr` lenSize, emHeaderLen) msg (p `plusPtr` emBodyPos) (p `plusPtr` emTagPos)
+  liftEither r $> msg'
+  where
+    large = v >= pqRatchetE2EEncryptVersion
+    lenSize = if large then 2 else 1
+    encodeLen n = if large then smpEncode @Word16 (fromIntegral n) else B.singleton (lenEncode n)
+    ehPrefix = smpEncode (v, ehIV)
+    emHeaderLen = B.length ehPrefix + authTagSize + lenSize + hdrPaddedLen
+    prefix = encodeLen emHeaderLen <> ehPrefix
+    ehTagPos = B.length prefix
+    ehBodyPos = ehTagPos + authTagSize + lenSize
+    emTagPos = lenSize + emHeaderLen
+    emBodyPos = emTagPos + authTagSize
+    totalLen = emBodyPos + msgPaddedLen
 
 encRatchetMessageP :: Parser EncRatchetMessage
 encRatchetMessageP = do
@@ -857,13 +881,10 @@ rcEncrypt rc@Ratchet {rcSnd = Just sr@SndRatchet {rcCKs, rcHKs}, rcDHRs, rcKEM,
       maxSupported' = max supportedE2EVersion $ if pqEnc_ == Just PQEncOn then pqRatchetE2EEncryptVersion else v
       rcVersion' = rcVersion {maxSupported = maxSupported'}
   -- enc_header = HENCRYPT(state.HKs, header)
-  (ehAuthTag, ehBody) <- encryptAEAD rcHKs ehIV (paddedHeaderLen v rcSupportKEM') rcAD (msgHeader v maxSupported')
   -- return enc_header, ENCRYPT(mk, plaintext, CONCAT(AD, enc_header))
-  let emHeader = smpEncode EncMessageHeader {ehVersion = v, ehBody, ehAuthTag, ehIV}
-  (emAuthTag, emBody) <- encryptAEAD mk iv paddedMsgLen (rcAD <> emHeader) msg
-  let msg' = encodeEncRatchetMessage v EncRatchetMessage {emHeader, emBody, emAuthTag}
-      -- state.Ns += 1
-      rc' =
+  msg' <- encryptRatchetMessage v rcHKs ehIV (paddedHeaderLen v rcSupportKEM') rcAD (msgHeader v maxSupported') (MessageKey mk iv) paddedMsgLen msg
+  -- state.Ns += 1
+  let rc' =
         rc
           { rcSnd = Just sr {rcCKs = ck'},
             rcNs = rcNs + 1,
@@ -895,10 +916,11 @@ rcEncrypt rc@Ratchet {rcSnd = Just sr@SndRatchet {rcCKs, rcHKs}, rcDHRs, rcKEM,
       Nothing -> ARKP SRKSProposed $ RKParamsProposed k
       Just RatchetKEMAccepted {rcPQRct} -> ARKP SRKSAccepted $ RKParamsAccepted rcPQRct k
 
-data SkippedMessage a
-  = SMMessage (DecryptResult a)
-  | SMHeader (Maybe RatchetStep) (MsgHeader a)
-  | SMNone
+-- | header key that decrypted message header
+data HeaderKeyUsed
+  = HKSkipped HeaderKey SkippedHdrMsgKeys
+  | HKCurrent
+  | HKNext
 
 data RatchetStep = AdvanceRatchet | SameRatchet
   deriving (Eq, Show)
@@ -919,16 +941,20 @@ rcDecrypt ::
 rcDecrypt g rc@Ratchet {rcRcv, rcAD = Str rcAD, rcVersion} rcMKSkipped msg' = do
   encMsg@EncRatchetMessage {emHeader} <- parseE CryptoHeaderError encRatchetMessageP msg'
   encHdr <- parseE CryptoHeaderError smpP emHeader
-  -- plaintext = TrySkippedMessageKeysHE(state, enc_header, cipher-text, AD)
-  decryptSkipped encHdr encMsg >>= \case
-    SMNone -> do
-      (rcStep, hdr) <- decryptRcHeader rcRcv encHdr
-      decryptRcMessage rcStep hdr encMsg
-    SMHeader rcStep_ hdr ->
-      case rcStep_ of
-        Just rcStep -> decryptRcMessage rcStep hdr encMsg
-        Nothing -> throwE CERatchetHeader
-    SMMessage r -> pure r
+  decryptHeader encHdr >>= \case
+    (HKSkipped hk mks, hdr@MsgHeader {msgNs}) -> case M.lookup msgNs mks of
+      -- plaintext = TrySkippedMessageKeysHE(state, enc_header, cipher-text, AD)
+      Just mk -> do
+        msg <- decryptMessage mk encMsg
+        pure (msg, rc, SMDRemove hk msgNs)
+      Nothing
+        | maybe False ((== hk) . rcHKr) rcRcv -> decryptRcMessage SameRatchet hdr encMsg
+        | hk == rcNHKr rc -> decryptRcMessage AdvanceRatchet hdr encMsg
+        | otherwise -> throwE CERatchetHeader
+    -- header = HDECRYPT(state.HKr, enc_header)
+    (HKCurrent, hdr) -> decryptRcMessage SameRatchet hdr encMsg
+    -- header = HDECRYPT(state.NHKr, enc_header)
+    (HKNext, hdr) -> decryptRcMessage AdvanceRatchet hdr encMsg
   where
     decryptRcMessage :: RatchetStep -> MsgHeader a -> EncRatchetMessage -> ExceptT CryptoError IO (DecryptResult a)
     decryptRcMessage rcStep hdr@MsgHeader {msgMaxVersion, msgPN, msgNs} encMsg = do
@@ -1031,47 +1057,27 @@ rcDecrypt g rc@Ratchet {rcRcv, rcAD = Str rcAD, rcVersion} rcMKSkipped msg' = do
       | rcNr + maxSkip < untilN = Left $ CERatchetTooManySkipped (untilN + 1 - rcNr)
       | rcNr == untilN = Right (r, M.empty)
       | otherwise =
-          let (rcCKr', rcNr', mks) = advanceRcvRatchet (untilN - rcNr) rcCKr rcNr M.empty
+          let (rcCKr', rcNr', mks) = advanceRcvRatchet (untilN - rcNr) rcCKr rcNr
               r' = r {rcRcv = Just rr {rcCKr = rcCKr'}, rcNr = rcNr'}
            in Right (r', M.singleton rcHKr mks)
-    advanceRcvRatchet :: Word32 -> RatchetKey -> Word32 -> SkippedHdrMsgKeys -> (RatchetKey, Word32, SkippedHdrMsgKeys)
-    advanceRcvRatchet 0 ck msgNs mks = (ck, msgNs, mks)
-    advanceRcvRatchet n ck msgNs mks =
-      let (ck', mk, iv, _) = chainKdf ck
-          mks' = M.insert msgNs (MessageKey mk iv) mks
-       in advanceRcvRatchet (n - 1) ck' (msgNs + 1) mks'
-    decryptSkipped :: EncMessageHeader -> EncRatchetMessage -> ExceptT CryptoError IO (SkippedMessage a)
-    decryptSkipped encHdr encMsg = tryDecryptSkipped SMNone $ M.assocs rcMKSkipped
+    -- all skipped message keys are derived in one native call
+    advanceRcvRatchet :: Word32 -> RatchetKey -> Word32 -> (RatchetKey, Word32, SkippedHdrMsgKeys)
+    advanceRcvRatchet n ck msgNs = foldl' addKey (ck, msgNs, M.empty) $ chainKdfN n ck
       where
-        tryDecryptSkipped :: SkippedMessage a -> [(HeaderKey, SkippedHdrMsgKeys)] -> ExceptT CryptoError IO (SkippedMessage a)
-        tryDecryptSkipped SMNone ((hk, mks) : hks) = do
-          tryE (decryptHeader hk encHdr) >>= \case
-            Left CERatchetHeader -> tryDecryptSkipped SMNone hks
-            Left e -> throwE e
-            Right hdr@MsgHeader {msgNs} ->
-              case M.lookup msgNs mks of
-                Nothing ->
-                  let nextRc
-                        | maybe False ((== hk) . rcHKr) rcRcv = Just SameRatchet
-                        | hk == rcNHKr rc = Just AdvanceRatchet
-                        | otherwise = Nothing
-                   in pure $ SMHeader nextRc hdr
-                Just mk -> do
-                  msg <- decryptMessage mk encMsg
-                  pure $ SMMessage (msg, rc, SMDRemove hk msgNs)
-        tryDecryptSkipped r _ = pure r
-    decryptRcHeader :: Maybe RcvRatchet -> EncMessageHeader -> ExceptT CryptoError IO (RatchetStep, MsgHeader a)
-    decryptRcHeader Nothing hdr = decryptNextHeader hdr
-    decryptRcHeader (Just RcvRatchet {rcHKr}) hdr =
-      -- header = HDECRYPT(state.HKr, enc_header)
-      ((SameRatchet,) <$> decryptHeader rcHKr hdr) `catchE` \case
-        CERatchetHeader -> decryptNextHeader hdr
-        e -> throwE e
-    -- header = HDECRYPT(state.NHKr, enc_header)
-    decryptNextHeader hdr = (AdvanceRatchet,) <$> decryptHeader (rcNHKr rc) hdr
-    decryptHeader k EncMessageHeader {ehVersion, ehBody, ehAuthTag, ehIV} = do
-      header <- decryptAEAD k ehIV rcAD ehBody ehAuthTag `catchE` \_ -> throwE CERatchetHeader
-      parseE' CryptoHeaderError (msgHeaderP ehVersion) header
+        addKey (_, i, mks) (ck', mk, iv, _) = (ck', i + 1, M.insert i (MessageKey mk iv) mks)
+    -- Header keys are tried in one call, in the order of the algorithm:
+    -- skipped message header keys (TrySkippedMessageKeysHE), then state.HKr and state.NHKr.
+    decryptHeader :: EncMessageHeader -> ExceptT CryptoError IO (HeaderKeyUsed, MsgHeader a)
+    decryptHeader EncMessageHeader {ehVersion, ehBody, ehAuthTag, ehIV} = do
+      let hks =
+            map (\(hk, mks) -> (hk, HKSkipped hk mks)) (M.assocs rcMKSkipped)
+              <> maybe [] (\RcvRatchet {rcHKr} -> [(rcHKr, HKCurrent)]) rcRcv
+              <> [(rcNHKr rc, HKNext)]
+      (i, header) <- decryptAEADAny (map fst hks) ehIV rcAD ehBody ehAuthTag `catchE` \_ -> throwE CERatchetHeader
+      hdr <- parseE' CryptoHeaderError (msgHeaderP ehVersion) header
+      case drop i hks of
+        (_, hku) : _ -> pure (hku, hdr)
+        [] -> throwE CERatchetHeader
     decryptMessage :: MessageKey -> EncRatchetMessage -> ExceptT CryptoError IO (Either CryptoError ByteString)
     decryptMessage (MessageKey mk iv) EncRatchetMessage {emHeader, emBody, emAuthTag} =
       -- DECRYPT(mk, cipher-text, CONCAT(AD, enc_header))
@@ -1087,16 +1093,27 @@ rootKdf (RatchetKey rk) k pk kemSecret_ =
    in (RatchetKey rk', RatchetKey ck, Key nhk)
 
 chainKdf :: RatchetKey -> (RatchetKey, Key, IV, IV)
-chainKdf (RatchetKey ck) =
-  let (ck', mk, ivs) = hkdf3 "" ck "SimpleXChainRatchet"
+chainKdf (RatchetKey ck) = chainKdfStep $ hkdf "" ck chainKdfInfo 96
+
+-- | @n@ consecutive steps of 'chainKdf'
+chainKdfN :: Word32 -> RatchetKey -> [(RatchetKey, Key, IV, IV)]
+chainKdfN n (RatchetKey ck) = map chainKdfStep $ hkdfChain chainKdfInfo 96 (fromIntegral n) ck
+
+chainKdfStep :: ByteString -> (RatchetKey, Key, IV, IV)
+chainKdfStep out =
+  let (ck', mk, ivs) = split3 out
       (iv1, iv2) = B.splitAt 16 ivs
    in (RatchetKey ck', Key mk, IV iv1, IV iv2)
 
+chainKdfInfo :: ByteString
+chainKdfInfo = "SimpleXChainRatchet"
+
 hkdf3 :: ByteString -> ByteString -> ByteString -> (ByteString, ByteString, ByteString)
-hkdf3 salt ikm info = (s1, s2, s3)
+hkdf3 salt ikm info = split3 $ hkdf salt ikm info 96
+
+split3 :: ByteString -> (ByteString, ByteString, ByteString)
+split3 out = (s1, s2, s3)
   where
-    prk = H.extract salt ikm :: H.PRK SHA512
-    out = H.expand prk info 96
     (s1, rest) = B.splitAt 32 out
     (s2, s3) = B.splitAt 32 rest
 
@@ -1120,9 +1137,84 @@ instance AlgorithmI a => ToJSON (Ratchet a) where
 instance AlgorithmI a => FromJSON (Ratchet a) where
   parseJSON = $(JQ.mkParseJSON defaultJSON ''Ratchet)
 
+instance Encoding PQEncryption where
+  smpEncode (PQEncryption pq) = smpEncode pq
+  smpP = PQEncryption <$> smpP
+
+instance Encoding PQSupport where
+  smpEncode (PQSupport pq) = smpEncode pq
+  smpP = PQSupport <$> smpP
+
+instance Encoding RatchetVersions where
+  smpEncode RatchetVersions {current, maxSupported} = smpEncode (current, maxSupported)
+  smpP = RatchetVersions <$> smpP <*> smpP
+
+instance Encoding RatchetKey where
+  smpEncode (RatchetKey k) = smpEncode k
+  smpP = RatchetKey <$> smpP
+
+instance AlgorithmI a => Encoding (SndRatchet a) where
+  smpEncode SndRatchet {rcDHRr, rcCKs, rcHKs = Key hk} = smpEncode (rcDHRr, rcCKs, hk)
+  smpP = SndRatchet <$> smpP <*> smpP <*> (Key <$> smpP)
+
+instance Encoding RcvRatchet where
+  smpEncode RcvRatchet {rcCKr, rcHKr = Key hk} = smpEncode (rcCKr, hk)
+  smpP = RcvRatchet <$> smpP <*> (Key <$> smpP)
+
+instance Encoding RatchetKEMAccepted where
+  smpEncode RatchetKEMAccepted {rcPQRr, rcPQRss, rcPQRct} = smpEncode (rcPQRr, rcPQRss, rcPQRct)
+  smpP = RatchetKEMAccepted <$> smpP <*> smpP <*> smpP
+
+instance Encoding RatchetKEM where
+  smpEncode RatchetKEM {rcPQRs, rcKEMs} = smpEncode (rcPQRs, rcKEMs)
+  smpP = RatchetKEM <$> smpP <*> smpP
+
+-- | Binary ratchet state prefixed with the format version.
+-- KEM state is encoded last - it is several kilobytes, and binary states saved by the agent do not include it.
+instance AlgorithmI a => Encoding (Ratchet a) where
+  smpEncode Ratchet {rcVersion, rcAD = Str ad, rcDHRs, rcKEM, rcSupportKEM, rcEnableKEM, rcSndKEM, rcRcvKEM, rcRK, rcSnd, rcRcv, rcNs, rcNr, rcPN, rcNHKs = Key nhks, rcNHKr = Key nhkr} =
+    smpEncode ('1', rcVersion, ad, encodePrivKey rcDHRs, rcSupportKEM, rcEnableKEM, rcSndKEM, rcRcvKEM)
+      <> smpEncode (rcRK, rcSnd, rcRcv, rcNs, rcNr, rcPN, nhks, nhkr)
+      <> smpEncode rcKEM
+  smpP =
+    A.anyChar >>= \case
+      '1' -> do
+        rcVersion <- smpP
+        rcAD <- Str <$> smpP
+        rcDHRs <- decodePrivKey <$?> smpP
+        (rcSupportKEM, rcEnableKEM, rcSndKEM, rcRcvKEM) <- smpP
+        (rcRK, rcSnd, rcRcv, rcNs, rcNr, rcPN) <- smpP
+        rcNHKs <- Key <$> smpP
+        rcNHKr <- Key <$> smpP
+        rcKEM <- smpP
+        pure Ratchet {rcVersion, rcAD, rcDHRs, rcKEM, rcSupportKEM, rcEnableKEM, rcSndKEM, rcRcvKEM, rcRK, rcSnd, rcRcv, rcNs, rcNr, rcPN, rcNHKs, rcNHKr}
+      _ -> fail "unsupported ratchet state format"
+
+-- | Decodes binary or JSON ratchet state.
+decodeRatchet :: AlgorithmI a => ByteString -> Either String (Ratchet a)
+decodeRatchet s
+  | jsonRatchet s = J.eitherDecodeStrict' s
+  | otherwise = smpDecode s
+
+-- | Decodes ratchet state saved by the agent: JSON state includes KEM state,
+-- and binary state is saved without it, with KEM state saved separately.
+decodeStoredRatchet :: AlgorithmI a => ByteString -> Maybe RatchetKEM -> Either String (Ratchet a)
+decodeStoredRatchet s kem_
+  | jsonRatchet s = J.eitherDecodeStrict' s
+  | otherwise = (\rc -> rc {rcKEM = kem_}) <$> smpDecode s
+
+jsonRatchet :: ByteString -> Bool
+jsonRatchet s = B.take 1 s == "{"
+
+-- TODO switch to binary format in the next release, once all supported versions can read it.
+-- It is not written yet, so that the agent can be downgraded to the versions that only read JSON.
 instance AlgorithmI a => ToField (Ratchet a) where toField = toField . LB.toStrict . J.encode
 
-instance (AlgorithmI a, Typeable a) => FromField (Ratchet a) where fromField = blobFieldDecoder J.eitherDecodeStrict'
+instance (AlgorithmI a, Typeable a) => FromField (Ratchet a) where fromField = blobFieldDecoder decodeRatchet
+
+instance ToField RatchetKEM where toField = toField . smpEncode
+
+instance FromField RatchetKEM where fromField = blobFieldDecoder smpDecode
 
 instance ToField PQEncryption where toField (PQEncryption pqEnc) = toField pqEnc
 
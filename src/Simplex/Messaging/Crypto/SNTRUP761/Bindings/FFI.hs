@@ -4,6 +4,10 @@ module Simplex.Messaging.Crypto.SNTRUP761.Bindings.FFI
   ( c_sntrup761_keypair,
     c_sntrup761_enc,
     c_sntrup761_dec,
+    c_sntrup761_stats_enable,
+    c_sntrup761_stats_enabled,
+    c_sntrup761_stats_cycles,
+    c_sntrup761_stats_snapshot,
   ) where
 
 import Foreign
@@ -21,3 +25,19 @@ foreign import ccall "sntrup761_enc"
 -- void sntrup761_dec (uint8_t *k, const uint8_t *c, const uint8_t *sk);
 foreign import ccall "sntrup761_dec"
   c_sntrup761_dec :: Ptr Word8 -> Ptr Word8 -> Ptr Word8 -> IO ()
+
+-- void sntrup761_stats_enable (int enable);
+foreign import ccall "sntrup761_stats_enable"
+  c_sntrup761_stats_enable :: CInt -> IO ()
+
+-- int sntrup761_stats_enabled (void);
+foreign import ccall "sntrup761_stats_enabled"
+  c_sntrup761_stats_enabled :: IO CInt
+
+-- int sntrup761_stats_cycles (void);
+foreign import ccall "sntrup761_stats_cycles"
+  c_sntrup761_stats_cycles :: IO CInt
+
+-- void sntrup761_stats_snapshot (uint64_t *out);
+foreign import ccall "sntrup761_stats_snapshot"
+  c_sntrup761_stats_snapshot :: Ptr Word64 -> IO ()
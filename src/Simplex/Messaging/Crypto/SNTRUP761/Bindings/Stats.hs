@@ -0,0 +1,61 @@
+{-# LANGUAGE NamedFieldPuns #-}
+
+module Simplex.Messaging.Crypto.SNTRUP761.Bindings.Stats
+  ( SNTRUP761Stats (..),
+    CallStats (..),
+    setSNTRUP761Stats,
+    getSNTRUP761Stats,
+  ) where
+
+import Foreign
+import Simplex.Messaging.Crypto.SNTRUP761.Bindings.Defines
+import Simplex.Messaging.Crypto.SNTRUP761.Bindings.FFI
+
+-- | Counters of sntrup761 API calls and internal kernels, summed over all threads since the process start.
+-- Counters only change while stats are enabled.
+data SNTRUP761Stats = SNTRUP761Stats
+  { kemStatsEnabled :: Bool,
+    -- | True if time is measured in CPU cycles (x86 time stamp counter), False if in nanoseconds
+    timeInCycles :: Bool,
+    keypairStats :: CallStats,
+    encStats :: CallStats,
+    decStats :: CallStats,
+    multStats :: CallStats,
+    recipStats :: CallStats,
+    sortStats :: CallStats,
+    encodeStats :: CallStats,
+    hashStats :: CallStats,
+    -- | number of times R3_recip failed in KeyGen and a new random polynomial was generated
+    keyGenRetries :: Word64
+  }
+  deriving (Show)
+
+data CallStats = CallStats
+  { callCount :: Word64,
+    callTime :: Word64
+  }
+  deriving (Show)
+
+setSNTRUP761Stats :: Bool -> IO ()
+setSNTRUP761Stats on = c_sntrup761_stats_enable $ if on then 1 else 0
+
+getSNTRUP761Stats :: IO SNTRUP761Stats
+getSNTRUP761Stats = do
+  kemStatsEnabled <- (/= 0) <$> c_sntrup761_stats_enabled
+  timeInCycles <- (/= 0) <$> c_sntrup761_stats_cycles
+  cs <- allocaArray c_SNTRUP761_STATS_SIZE $ \p -> c_sntrup761_stats_snapshot p >> peekArray c_SNTRUP761_STATS_SIZE p
+  let stat i = CallStats {callCount = cs !! i, callTime = cs !! (c_SNTRUP761_STAT_COUNT + i)}
+  pure
+    SNTRUP761Stats
+      { kemStatsEnabled,
+        timeInCycles,
+        keypairStats = stat c_SNTRUP761_STAT_KEYPAIR,
+        encStats = stat c_SNTRUP761_STAT_ENC,
+        decStats = stat c_SNTRUP761_STAT_DEC,
+        multStats = stat c_SNTRUP761_STAT_MULT,
+        recipStats = stat c_SNTRUP761_STAT_RECIP,
+        sortStats = stat c_SNTRUP761_STAT_SORT,
+        encodeStats = stat c_SNTRUP761_STAT_ENCODE,
+        hashStats = stat c_SNTRUP761_STAT_HASH,
+        keyGenRetries = cs !! (2 * c_SNTRUP761_STAT_COUNT)
+      }
@@ -0,0 +1,132 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+{-# LANGUAGE GADTs #-}
+{-# LANGUAGE PatternSynonyms #-}
+
+-- |
+-- Module      : Simplex.Messaging.Crypto.SecretBoxStream
+-- Copyright   : (c) simplex.chat
+-- License     : AGPL-3
+--
+-- Maintainer  : chat@simplex.chat
+-- Stability   : experimental
+-- Portability : non-portable
+--
+-- Native streaming XSalsa20-Poly1305 that encrypts and decrypts buffers in place.
+-- The ciphertext and the tag are the same as with SbState in "Simplex.Messaging.Crypto.Lazy".
+module Simplex.Messaging.Crypto.SecretBoxStream
+  ( SbStream,
+    withCbStream,
+    withSbStream,
+    sbStreamEncrypt,
+    sbStreamDecrypt,
+    sbStreamXorAt,
+    sbStreamAuthUpdate,
+    SbAuthPart,
+    sbStreamAuthPart,
+    sbStreamAuthCombine,
+    sbStreamAuth,
+  ) where
+
+import qualified Control.Exception as E
+import qualified Data.ByteArray as BA
+import Data.ByteArray (ByteArrayAccess)
+import Data.ByteString (ByteString)
+import qualified Data.ByteString.Internal as BI
+import Foreign
+import Foreign.C
+import Simplex.Messaging.Crypto (CbNonce, DhSecret (..), DhSecretX25519, SbKey, authTagSize, pattern CbNonce, pattern SbKey)
+
+data SbStreamState
+
+newtype SbStream = SbStream (Ptr SbStreamState)
+
+-- | Runs the action with the stream state for the shared DH secret and nonce,
+-- the state is wiped when the action completes.
+withCbStream :: DhSecretX25519 -> CbNonce -> (SbStream -> IO a) -> IO a
+withCbStream (DhSecretX25519 secret) (CbNonce nonce) = withStream_ secret nonce
+
+-- | Same as withCbStream for the symmetric key.
+withSbStream :: SbKey -> CbNonce -> (SbStream -> IO a) -> IO a
+withSbStream (SbKey key) (CbNonce nonce) = withStream_ key nonce
+
+withStream_ :: ByteArrayAccess key => key -> ByteString -> (SbStream -> IO a) -> IO a
+withStream_ key nonce action =
+  allocaBytesAligned (fromIntegral c_sb_stream_size) 16 $ \st -> do
+    BA.withByteArray key $ \keyPtr -> BA.withByteArray nonce $ c_sb_stream_init st keyPtr
+    action (SbStream st) `E.finally` c_sb_stream_clear st
+
+-- | Encrypts the buffer in place.
+sbStreamEncrypt :: SbStream -> Ptr Word8 -> Int -> IO ()
+sbStreamEncrypt (SbStream st) p len = c_sb_stream_encrypt st p (fromIntegral len)
+
+-- | Decrypts the buffer in place.
+sbStreamDecrypt :: SbStream -> Ptr Word8 -> Int -> IO ()
+sbStreamDecrypt (SbStream st) p len = c_sb_stream_decrypt st p (fromIntegral len)
+
+-- | XORs the buffer with the keystream at the offset of this buffer in the message.
+-- It does not change the stream, so different parts of the message can be processed concurrently,
+-- and the ciphertext should be added to the tag with sbStreamAuthUpdate.
+sbStreamXorAt :: SbStream -> Int64 -> Ptr Word8 -> Int -> IO ()
+sbStreamXorAt (SbStream st) offset p len = c_sb_stream_xor_at st (fromIntegral offset) p (fromIntegral len)
+
+sbStreamAuthUpdate :: SbStream -> Ptr Word8 -> Int -> IO ()
+sbStreamAuthUpdate (SbStream st) p len = c_sb_stream_auth_update st p (fromIntegral len)
+
+-- | Partial tag sum of the ciphertext without the final reduction.
+newtype SbAuthPart = SbAuthPart ByteString
+
+-- | Computes the partial tag sum of the part of the ciphertext, the length must be a multiple of 16 bytes.
+-- It does not change the stream, so the parts of the message can be processed concurrently,
+-- and then added to the tag in order with sbStreamAuthCombine.
+sbStreamAuthPart :: SbStream -> Ptr Word8 -> Int -> IO SbAuthPart
+sbStreamAuthPart (SbStream st) p len = SbAuthPart <$> BI.create 20 (c_sb_stream_auth_part st p (fromIntegral len) . castPtr)
+
+-- | Adds the partial sum of the next len bytes of the ciphertext to the tag.
+-- It returns False if the ciphertext processed so far or len are not a multiple of 16 bytes.
+sbStreamAuthCombine :: SbStream -> SbAuthPart -> Int -> IO Bool
+sbStreamAuthCombine (SbStream st) (SbAuthPart part) len =
+  BA.withByteArray part $ \p -> (== 0) <$> c_sb_stream_auth_combine st p (fromIntegral len)
+
+-- | Authentication tag of all processed data, the stream cannot be used after that.
+sbStreamAuth :: SbStream -> IO ByteString
+sbStreamAuth (SbStream st) = BI.create authTagSize $ c_sb_stream_auth st
+
+-- size_t sb_stream_size (void);
+foreign import ccall unsafe "sb_stream_size"
+  c_sb_stream_size :: CSize
+
+-- void sb_stream_init (sb_stream *st, const uint8_t *key, const uint8_t *nonce);
+foreign import ccall unsafe "sb_stream_init"
+  c_sb_stream_init :: Ptr SbStreamState -> Ptr Word8 -> Ptr Word8 -> IO ()
+
+-- void sb_stream_encrypt (sb_stream *st, uint8_t *buf, size_t len);
+foreign import ccall unsafe "sb_stream_encrypt"
+  c_sb_stream_encrypt :: Ptr SbStreamState -> Ptr Word8 -> CSize -> IO ()
+
+-- void sb_stream_decrypt (sb_stream *st, uint8_t *buf, size_t len);
+foreign import ccall unsafe "sb_stream_decrypt"
+  c_sb_stream_decrypt :: Ptr SbStreamState -> Ptr Word8 -> CSize -> IO ()
+
+-- void sb_stream_xor_at (const sb_stream *st, uint64_t offset, uint8_t *buf, size_t len);
+foreign import ccall "sb_stream_xor_at"
+  c_sb_stream_xor_at :: Ptr SbStreamState -> Word64 -> Ptr Word8 -> CSize -> IO ()
+
+-- void sb_stream_auth_update (sb_stream *st, const uint8_t *buf, size_t len);
+foreign import ccall unsafe "sb_stream_auth_update"
+  c_sb_stream_auth_update :: Ptr SbStreamState -> Ptr Word8 -> CSize -> IO ()
+
+-- void sb_stream_auth_part (const sb_stream *st, const uint8_t *buf, size_t len, uint32_t *part);
+foreign import ccall "sb_stream_auth_part"
+  c_sb_stream_auth_part :: Ptr SbStreamState -> Ptr Word8 -> CSize -> Ptr Word32 -> IO ()
+
+-- int sb_stream_auth_combine (sb_stream *st, const uint32_t *part, size_t len);
+foreign import ccall unsafe "sb_stream_auth_combine"
+  c_sb_stream_auth_combine :: Ptr SbStreamState -> Ptr Word32 -> CSize -> IO CInt
+
+-- void sb_stream_auth (sb_stream *st, uint8_t *tag);
+foreign import ccall unsafe "sb_stream_auth"
+  c_sb_stream_auth :: Ptr SbStreamState -> Ptr Word8 -> IO ()
+
+-- void sb_stream_clear (sb_stream *st);
+foreign import ccall unsafe "sb_stream_clear"
+  c_sb_stream_clear :: Ptr SbStreamState -> IO ()
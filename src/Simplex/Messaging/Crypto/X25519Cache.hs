@@ -0,0 +1,75 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+
+-- |
+-- Module      : Simplex.Messaging.Crypto.X25519Cache
+-- Copyright   : (c) simplex.chat
+-- License     : AGPL-3
+--
+-- Maintainer  : chat@simplex.chat
+-- Stability   : experimental
+-- Portability : non-portable
+--
+-- Bounded LRU cache of X25519 shared secrets for one transport session.
+-- The secrets are stored in locked native memory that is wiped when entries are evicted,
+-- when the cache is cleared at the end of the session, or when it is garbage collected.
+module Simplex.Messaging.Crypto.X25519Cache
+  ( X25519Cache,
+    newX25519Cache,
+    clearX25519Cache,
+    lookupX25519Secret,
+    insertX25519Secret,
+  ) where
+
+import Data.ByteArray (ByteArrayAccess, ScrubbedBytes)
+import qualified Data.ByteArray as BA
+import Foreign
+import Foreign.C
+
+data X25519CacheStruct
+
+-- | Cache of shared secrets keyed by the pair of public keys (peer key, own key).
+newtype X25519Cache = X25519Cache (ForeignPtr X25519CacheStruct)
+
+-- | Creates cache with at most @n@ entries, native memory is only allocated when the first secret is added.
+-- If allocation fails, the cache is disabled and all lookups fail.
+newX25519Cache :: Int -> IO X25519Cache
+newX25519Cache n = X25519Cache <$> (newForeignPtr c_x25519_cache_free_ptr =<< c_x25519_cache_new (fromIntegral n))
+
+clearX25519Cache :: X25519Cache -> IO ()
+clearX25519Cache (X25519Cache c) = withForeignPtr c c_x25519_cache_clear
+
+-- | Shared secret for 32-byte peer and own public keys.
+lookupX25519Secret :: (ByteArrayAccess k, ByteArrayAccess k') => X25519Cache -> k -> k' -> IO (Maybe ScrubbedBytes)
+lookupX25519Secret (X25519Cache c) peerKey ownKey =
+  withForeignPtr c $ \cPtr ->
+    BA.withByteArray peerKey $ \peerPtr ->
+      BA.withByteArray ownKey $ \ownPtr -> do
+        (r, secret) <- BA.allocRet 32 $ c_x25519_cache_get cPtr peerPtr ownPtr
+        pure $ if r == 1 then Just secret else Nothing
+
+insertX25519Secret :: (ByteArrayAccess k, ByteArrayAccess k', ByteArrayAccess s) => X25519Cache -> k -> k' -> s -> IO ()
+insertX25519Secret (X25519Cache c) peerKey ownKey secret =
+  withForeignPtr c $ \cPtr ->
+    BA.withByteArray peerKey $ \peerPtr ->
+      BA.withByteArray ownKey $ \ownPtr ->
+        BA.withByteArray secret $ c_x25519_cache_put cPtr peerPtr ownPtr
+
+-- x25519_cache *x25519_cache_new (uint32_t capacity);
+foreign import ccall unsafe "x25519_cache_new"
+  c_x25519_cache_new :: Word32 -> IO (Ptr X25519CacheStruct)
+
+-- void x25519_cache_free (x25519_cache *c);
+foreign import ccall unsafe "&x25519_cache_free"
+  c_x25519_cache_free_ptr :: FunPtr (Ptr X25519CacheStruct -> IO ())
+
+-- void x25519_cache_clear (x25519_cache *c);
+foreign import ccall unsafe "x25519_cache_clear"
+  c_x25519_cache_clear :: Ptr X25519CacheStruct -> IO ()
+
+-- int x25519_cache_get (x25519_cache *c, const uint8_t *peer_key, const uint8_t *own_key, uint8_t *secret);
+foreign import ccall unsafe "x25519_cache_get"
+  c_x25519_cache_get :: Ptr X25519CacheStruct -> Ptr Word8 -> Ptr Word8 -> Ptr Word8 -> IO CInt
+
+-- void x25519_cache_put (x25519_cache *c, const uint8_t *peer_key, const uint8_t *own_key, const uint8_t *secret);
+foreign import ccall unsafe "x25519_cache_put"
+  c_x25519_cache_put :: Ptr X25519CacheStruct -> Ptr Word8 -> Ptr Word8 -> Ptr Word8 -> IO ()
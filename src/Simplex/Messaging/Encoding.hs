@@ -15,6 +15,7 @@ module Simplex.Messaging.Encoding
     smpEncodeList,
     smpListP,
     lenEncode,
+    pokeWord16,
   )
 where
 
@@ -27,7 +28,9 @@ import Data.ByteString.Internal (c2w, w2c)
 import Data.Int (Int64)
 import qualified Data.List.NonEmpty as L
 import Data.Time.Clock.System (SystemTime (..))
-import Data.Word (Word16, Word32)
+import Data.Word (Word16, Word32, Word8)
+import Foreign.Ptr (Ptr)
+import Foreign.Storable (pokeByteOff)
 import Network.Transport.Internal (decodeWord16, decodeWord32, encodeWord16, encodeWord32)
 import Simplex.Messaging.Parsers (parseAll)
 import Simplex.Messaging.Util ((<$?>))
@@ -107,6 +110,13 @@ lenEncode :: Int -> Char
 lenEncode = w2c . fromIntegral
 {-# INLINE lenEncode #-}
 
+-- | Writes Word16 to the buffer in the same way as smpEncode.
+pokeWord16 :: Ptr Word8 -> Word16 -> IO ()
+pokeWord16 p w = do
+  pokeByteOff p 0 (fromIntegral (w `shiftR` 8) :: Word8)
+  pokeByteOff p 1 (fromIntegral w :: Word8)
+{-# INLINE pokeWord16 #-}
+
 lenP :: Parser Int
 lenP = fromIntegral . c2w <$> A.anyChar
 {-# INLINE lenP #-}
@@ -0,0 +1,66 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+
+-- |
+-- Module      : Simplex.Messaging.Encoding.Base64URL
+-- Copyright   : (c) simplex.chat
+-- License     : AGPL-3
+--
+-- Maintainer  : chat@simplex.chat
+-- Stability   : experimental
+-- Portability : non-portable
+--
+-- Native base64url encoding and decoding, using AVX2 when it is supported by CPU.
+-- It is compatible with "Data.ByteString.Base64.URL", and can be imported qualified instead of it.
+module Simplex.Messaging.Encoding.Base64URL
+  ( encode,
+    encodeUnpadded,
+    decode,
+  ) where
+
+import Data.ByteString (ByteString)
+import qualified Data.ByteString as B
+import qualified Data.ByteString.Internal as BI
+import Data.ByteString.Unsafe (unsafeUseAsCStringLen)
+import Foreign
+import Foreign.C
+import System.IO.Unsafe (unsafeDupablePerformIO)
+
+encode :: ByteString -> ByteString
+encode = encode_ True
+{-# INLINE encode #-}
+
+encodeUnpadded :: ByteString -> ByteString
+encodeUnpadded = encode_ False
+{-# INLINE encodeUnpadded #-}
+
+encode_ :: Bool -> ByteString -> ByteString
+encode_ pad s
+  | B.null s = B.empty
+  | otherwise =
+      unsafeDupablePerformIO . unsafeUseAsCStringLen s $ \(p, len) -> do
+        let pad' = if pad then 1 else 0
+        BI.create (fromIntegral $ c_base64url_encoded_len (fromIntegral len) pad') $ \out ->
+          c_base64url_encode out (castPtr p) (fromIntegral len) pad'
+
+-- | Decodes padded or unpadded string, padding and unused bits of the last character are validated.
+decode :: ByteString -> Either String ByteString
+decode s
+  | B.null s = Right B.empty
+  | otherwise =
+      unsafeDupablePerformIO . unsafeUseAsCStringLen s $ \(p, len) -> do
+        (r, ok) <- BI.createAndTrim' (len `div` 4 * 3 + 2) $ \out -> do
+          n <- c_base64url_decode out (castPtr p) (fromIntegral len)
+          pure $ if n < 0 then (0, 0, False) else (0, fromIntegral n, True)
+        pure $ if ok then Right r else Left "invalid base64url encoding"
+
+-- size_t base64url_encoded_len (size_t len, int pad);
+foreign import ccall unsafe "base64url_encoded_len"
+  c_base64url_encoded_len :: CSize -> CInt -> CSize
+
+-- void base64url_encode (uint8_t *out, const uint8_t *in, size_t len, int pad);
+foreign import ccall unsafe "base64url_encode"
+  c_base64url_encode :: Ptr Word8 -> Ptr Word8 -> CSize -> CInt -> IO ()
+
+-- int64_t base64url_decode (uint8_t *out, const uint8_t *in, size_t len);
+foreign import ccall unsafe "base64url_decode"
+  c_base64url_decode :: Ptr Word8 -> Ptr Word8 -> CSize -> IO Int64
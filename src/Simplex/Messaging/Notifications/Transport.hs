@@ -11,6 +11,7 @@ module Simplex.Messaging.Notifications.Transport where
 
 import Control.Monad (forM)
 import Control.Monad.Except
+import Control.Monad.IO.Class (liftIO)
 import Control.Monad.Trans.Except
 import Data.Attoparsec.ByteString.Char8 (Parser)
 import Data.ByteString.Char8 (ByteString)
@@ -119,7 +120,7 @@ ntfServerHandshake serverSignKey c (k, pk) kh ntfVRange = do
           throwE $ TEHandshake IDENTITY
       | otherwise ->
           case compatibleVRange' ntfVersionRange v of
-            Just (Compatible vr) -> pure $ ntfThHandleServer th v vr pk
+            Just (Compatible vr) -> liftIO $ ntfThHandleServer th v vr pk
             Nothing -> throwE TEVersion
 
 -- | Notifcations server client transport handshake.
@@ -137,18 +138,20 @@ ntfClientHandshake c keyHash ntfVRange = do
           (,(getServerCerts c, signedKey)) <$> (C.x509ToPublic (pubKey, []) >>= C.pubKey)
         let v = maxVersion vr
         sendHandshake th $ NtfClientHandshake {ntfVersion = v, keyHash}
-        pure $ ntfThHandleClient th v vr ck_
+        liftIO $ ntfThHandleClient th v vr ck_
       Nothing -> throwE TEVersion
 
-ntfThHandleServer :: forall c. THandleNTF c 'TServer -> VersionNTF -> VersionRangeNTF -> C.PrivateKeyX25519 -> THandleNTF c 'TServer
-ntfThHandleServer th v vr pk =
-  let thAuth = THAuthServer {serverPrivKey = pk, sessSecret' = Nothing}
-   in ntfThHandle_ th v vr (Just thAuth)
-
-ntfThHandleClient :: forall c. THandleNTF c 'TClient -> VersionNTF -> VersionRangeNTF -> Maybe (C.PublicKeyX25519, (X.CertificateChain, X.SignedExact X.PubKey)) -> THandleNTF c 'TClient
-ntfThHandleClient th v vr ck_ =
-  let thAuth = (\(k, ck) -> THAuthClient {serverPeerPubKey = k, serverCertKey = ck, sessSecret = Nothing}) <$> ck_
-   in ntfThHandle_ th v vr thAuth
+ntfThHandleServer :: forall c. THandleNTF c 'TServer -> VersionNTF -> VersionRangeNTF -> C.PrivateKeyX25519 -> IO (THandleNTF c 'TServer)
+ntfThHandleServer th v vr pk = do
+  dhCache' <- newSessionDhCache
+  let thAuth = THAuthServer {serverPrivKey = pk, sessSecret' = Nothing, dhCache'}
+  pure $ ntfThHandle_ th v vr (Just thAuth)
+
+ntfThHandleClient :: forall c. THandleNTF c 'TClient -> VersionNTF -> VersionRangeNTF -> Maybe (C.PublicKeyX25519, (X.CertificateChain, X.SignedExact X.PubKey)) -> IO (THandleNTF c 'TClient)
+ntfThHandleClient th v vr ck_ = do
+  dhCache <- newSessionDhCache
+  let thAuth = (\(k, ck) -> THAuthClient {serverPeerPubKey = k, serverCertKey = ck, sessSecret = Nothing, dhCache}) <$> ck_
+  pure $ ntfThHandle_ th v vr thAuth
 
 ntfThHandle_ :: forall c p. THandleNTF c p -> VersionNTF -> VersionRangeNTF -> Maybe (THandleAuth p) -> THandleNTF c p
 ntfThHandle_ th@THandle {params} v vr thAuth =
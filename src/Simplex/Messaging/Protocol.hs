@@ -165,7 +165,8 @@ module Simplex.Messaging.Protocol
     toMsgInfo,
 
     -- * TCP transport functions
-    TransportBatch (..),
+    TransportBatch,
+    TransportBatch_ (..),
     tPut,
     tPutLog,
     tGet,
@@ -175,7 +176,6 @@ module Simplex.Messaging.Protocol
     tEncodeBatch1,
     batchTransmissions,
     batchTransmissions',
-    batchTransmissions_,
 
     -- * exports for tests
     CommandTag (..),
@@ -195,6 +195,8 @@ import Data.Bifunctor (first)
 import qualified Data.ByteString.Base64 as B64
 import Data.ByteString.Char8 (ByteString)
 import qualified Data.ByteString.Char8 as B
+import qualified Data.ByteString.Internal as BI
+import Data.ByteString.Unsafe (unsafeUseAsCStringLen)
 import Data.Char (isPrint, isSpace)
 import Data.Constraint (Dict (..))
 import Data.Functor (($>))
@@ -207,8 +209,9 @@ import qualified Data.Text as T
 import Data.Text.Encoding (decodeLatin1, encodeUtf8)
 import Data.Time.Clock.System (SystemTime (..), systemToUTCTime)
 import Data.Type.Equality
-import Data.Word (Word16)
+import Data.Word (Word16, Word8)
 import qualified Data.X509 as X
+import Foreign (Ptr, castPtr, copyBytes, plusPtr, poke)
 import GHC.TypeLits (ErrorMessage (..), TypeError, type (+))
 import qualified GHC.TypeLits as TE
 import qualified GHC.TypeLits as Type
@@ -616,6 +619,24 @@ instance StrEncoding Message where
         msgBody <- strP
         pure Message {msgId, msgTs, msgFlags, msgBody}
 
+-- | Binary encoding used in the server messages snapshot.
+-- Flags are encoded as Bool, because MsgFlags parser allows extension until the next space.
+instance Encoding Message where
+  smpEncode = \case
+    Message {msgId, msgTs, msgFlags = MsgFlags {notification}, msgBody = C.MaxLenBS body} ->
+      smpEncode ('M', msgId, msgTs, notification, Large body)
+    MessageQuota {msgId, msgTs} -> smpEncode ('Q', msgId, msgTs)
+  smpP =
+    A.anyChar >>= \case
+      'M' -> do
+        (msgId, msgTs, notification, Large body) <- smpP
+        msgBody <- either (fail . show) pure $ C.maxLenBS body
+        pure Message {msgId, msgTs, msgFlags = MsgFlags {notification}, msgBody}
+      'Q' -> do
+        (msgId, msgTs) <- smpP
+        pure MessageQuota {msgId, msgTs}
+      _ -> fail "bad Message"
+
 type EncNMsgMeta = ByteString
 
 data SMPMsgMeta = SMPMsgMeta
@@ -1621,65 +1642,109 @@ instance StrEncoding BrokerErrorType where
       _textP = A.space *> (T.unpack . safeDecodeUtf8 <$> A.takeByteString)
 
 -- | Send signed SMP transmission to TCP transport.
+-- Transmissions are written directly to the buffers of the padded transport blocks.
 tPut :: Transport c => THandle v c p -> NonEmpty (Either TransportError SentRawTransmission) -> IO [Either TransportError ()]
-tPut th@THandle {params} = fmap concat . mapM tPutBatch . batchTransmissions (batch params) (blockSize params)
+tPut th@THandle {params} = fmap concat . mapM tPutBatch . blockTransmissions (batch params) (blockSize params) . L.map (,())
   where
-    tPutBatch :: TransportBatch () -> IO [Either TransportError ()]
+    tPutBatch :: TransportBatch_ TransmissionsBlock () -> IO [Either TransportError ()]
     tPutBatch = \case
       TBError e _ -> [Left e] <$ putStrLn "tPut error: large message"
-      TBTransmissions s n _ -> replicate n <$> tPutLog th s
-      TBTransmission s _ -> (: []) <$> tPutLog th s
+      TBTransmissions b n _ -> replicate n <$> tPutBlockLog th b
+      TBTransmission b _ -> (: []) <$> tPutBlockLog th b
 
 tPutLog :: Transport c => THandle v c p -> ByteString -> IO (Either TransportError ())
-tPutLog th s = do
-  r <- tPutBlock th s
+tPutLog th = logTPutError . tPutBlock th
+
+tPutBlockLog :: Transport c => THandle v c p -> TransmissionsBlock -> IO (Either TransportError ())
+tPutBlockLog th (TransmissionsBlock batched len ts) = logTPutError $ tPutBlockWith th len $ pokeTransmissions batched ts
+
+logTPutError :: IO (Either TransportError ()) -> IO (Either TransportError ())
+logTPutError put = do
+  r <- put
   case r of
     Left e -> putStrLn ("tPut error: " <> show e)
     _ -> pure ()
   pure r
 
 -- ByteString in TBTransmissions includes byte with transmissions count
-data TransportBatch r = TBTransmissions ByteString Int [r] | TBTransmission ByteString r | TBError TransportError r
+type TransportBatch = TransportBatch_ ByteString
+
+data TransportBatch_ b r = TBTransmissions b Int [r] | TBTransmission b r | TBError TransportError r
+
+-- | Transmissions of one transport block (as pairs of authorization and transmission) with their encoded length.
+-- Batched blocks include transmissions count and the lengths of transmissions.
+data TransmissionsBlock = TransmissionsBlock Bool Int [(ByteString, ByteString)]
 
 batchTransmissions :: Bool -> Int -> NonEmpty (Either TransportError SentRawTransmission) -> [TransportBatch ()]
 batchTransmissions batch bSize = batchTransmissions' batch bSize . L.map (,())
 
 -- | encodes and batches transmissions into blocks
-batchTransmissions' :: forall r. Bool -> Int -> NonEmpty (Either TransportError SentRawTransmission, r) -> [TransportBatch r]
-batchTransmissions' batch bSize ts
-  | batch = batchTransmissions_ bSize $ L.map (first $ fmap tEncodeForBatch) ts
+batchTransmissions' :: Bool -> Int -> NonEmpty (Either TransportError SentRawTransmission, r) -> [TransportBatch r]
+batchTransmissions' batch bSize = map encodeBatch . blockTransmissions batch bSize
+  where
+    encodeBatch = \case
+      TBTransmissions b n rs -> TBTransmissions (encodeTransmissionsBlock b) n rs
+      TBTransmission b r -> TBTransmission (encodeTransmissionsBlock b) r
+      TBError e r -> TBError e r
+
+encodeTransmissionsBlock :: TransmissionsBlock -> ByteString
+encodeTransmissionsBlock (TransmissionsBlock batched len ts) = BI.unsafeCreate len $ pokeTransmissions batched ts
+
+-- | Pack transmissions into blocks, without encoding them
+blockTransmissions :: forall r. Bool -> Int -> NonEmpty (Either TransportError SentRawTransmission, r) -> [TransportBatch_ TransmissionsBlock r]
+blockTransmissions batch bSize ts
+  | batch = addBatch $ foldr addTransmission ([], 0, 0, [], []) ts
   | otherwise = map mkBatch1 $ L.toList ts
   where
-    mkBatch1 :: (Either TransportError SentRawTransmission, r) -> TransportBatch r
+    mkBatch1 :: (Either TransportError SentRawTransmission, r) -> TransportBatch_ TransmissionsBlock r
     mkBatch1 (t_, r) = case t_ of
       Left e -> TBError e r
       Right t
         -- 2 bytes are reserved for pad size
-        | B.length s <= bSize - 2 -> TBTransmission s r
+        | len <= bSize - 2 -> TBTransmission (TransmissionsBlock False len [t']) r
         | otherwise -> TBError TELargeMsg r
         where
-          s = tEncode t
-
--- | Pack encoded transmissions into batches
-batchTransmissions_ :: Int -> NonEmpty (Either TransportError ByteString, r) -> [TransportBatch r]
-batchTransmissions_ bSize = addBatch . foldr addTransmission ([], 0, 0, [], [])
-  where
+          t' = tAuthPair t
+          len = tEncodedLength t'
     -- 19 = 2 bytes reserved for pad size + 1 for transmission count + 16 auth tag from block encryption
     bSize' = bSize - 19
-    addTransmission :: (Either TransportError ByteString, r) -> ([TransportBatch r], Int, Int, [ByteString], [r]) -> ([TransportBatch r], Int, Int, [ByteString], [r])
-    addTransmission (t_, r) acc@(bs, !len, !n, ss, rs) = case t_ of
+    addTransmission :: (Either TransportError SentRawTransmission, r) -> ([TransportBatch_ TransmissionsBlock r], Int, Int, [(ByteString, ByteString)], [r]) -> ([TransportBatch_ TransmissionsBlock r], Int, Int, [(ByteString, ByteString)], [r])
+    addTransmission (t_, r) acc@(bs, !len, !n, ts', rs) = case t_ of
       Left e -> (TBError e r : addBatch acc, 0, 0, [], [])
-      Right s
-        | len' <= bSize' && n < 255 -> (bs, len', 1 + n, s : ss, r : rs)
-        | sLen <= bSize' -> (addBatch acc, sLen, 1, [s], [r])
+      Right t
+        | len' <= bSize' && n < 255 -> (bs, len', 1 + n, t' : ts', r : rs)
+        | tLen <= bSize' -> (addBatch acc, tLen, 1, [t'], [r])
         | otherwise -> (TBError TELargeMsg r : addBatch acc, 0, 0, [], [])
         where
-          sLen = B.length s
-          len' = len + sLen
-    addBatch :: ([TransportBatch r], Int, Int, [ByteString], [r]) -> [TransportBatch r]
-    addBatch (bs, _len, n, ss, rs) = if n == 0 then bs else TBTransmissions b n rs : bs
-      where
-        b = B.concat $ B.singleton (lenEncode n) : ss
+          t' = tAuthPair t
+          -- 2 bytes for transmission length
+          tLen = 2 + tEncodedLength t'
+          len' = len + tLen
+    addBatch :: ([TransportBatch_ TransmissionsBlock r], Int, Int, [(ByteString, ByteString)], [r]) -> [TransportBatch_ TransmissionsBlock r]
+    addBatch (bs, len, n, ts', rs) = if n == 0 then bs else TBTransmissions (TransmissionsBlock True (1 + len) ts') n rs : bs
+
+tAuthPair :: SentRawTransmission -> (ByteString, ByteString)
+tAuthPair = first tAuthBytes
+{-# INLINE tAuthPair #-}
+
+-- | Length of the transmission encoded with tEncode
+tEncodedLength :: (ByteString, ByteString) -> Int
+tEncodedLength (auth, t) = 1 + B.length auth + B.length t
+{-# INLINE tEncodedLength #-}
+
+-- | Writes transmissions of the block in the same way as they are encoded with tEncodeForBatch (or with tEncode, when not batched).
+pokeTransmissions :: Bool -> [(ByteString, ByteString)] -> Ptr Word8 -> IO ()
+pokeTransmissions batched ts p
+  | batched = poke p (fromIntegral $ length ts :: Word8) >> foldM_ pokeLarge (p `plusPtr` 1) ts
+  | otherwise = foldM_ pokeT p ts
+  where
+    pokeLarge ptr t = do
+      pokeWord16 ptr $ fromIntegral $ tEncodedLength t
+      pokeT (ptr `plusPtr` 2) t
+    pokeT ptr (auth, t) = do
+      poke ptr (fromIntegral $ B.length auth :: Word8)
+      pokeBS (ptr `plusPtr` 1) auth >>= (`pokeBS` t)
+    pokeBS ptr s = unsafeUseAsCStringLen s $ \(sp, len) -> copyBytes ptr (castPtr sp) len $> (ptr `plusPtr` len)
 
 tEncode :: SentRawTransmission -> ByteString
 tEncode (auth, t) = smpEncode (tAuthBytes auth) <> t
@@ -33,6 +33,7 @@ module Simplex.Messaging.Server
     disconnectTransport,
     verifyCmdAuthorization,
     dummyVerifyCmd,
+    dummyKeyX25519,
     randomId,
     AttachHTTP,
   )
@@ -83,6 +84,7 @@ import Simplex.Messaging.Agent.Lock
 import Simplex.Messaging.Client (ProtocolClient (thParams), ProtocolClientError (..), SMPClient, SMPClientError, forwardSMPTransmission, smpProxyError, temporaryClientError)
 import Simplex.Messaging.Client.Agent (OwnServer, SMPClientAgent (..), SMPClientAgentEvent (..), closeSMPClientAgent, getSMPServerClient'', isOwnServer, lookupSMPServerClient, getConnectedSMPServerClient)
 import qualified Simplex.Messaging.Crypto as C
+import Simplex.Messaging.Crypto.SNTRUP761.Bindings.Stats (CallStats (..), SNTRUP761Stats (..), getSNTRUP761Stats, setSNTRUP761Stats)
 import Simplex.Messaging.Encoding
 import Simplex.Messaging.Encoding.String
 import Simplex.Messaging.Protocol
@@ -93,6 +95,7 @@ import Simplex.Messaging.Server.MsgStore
 import Simplex.Messaging.Server.MsgStore.STM
 import Simplex.Messaging.Server.NtfStore
 import Simplex.Messaging.Server.QueueStore
+import Simplex.Messaging.Server.QueueStore.QueueIndex (queueIndexSize)
 import Simplex.Messaging.Server.QueueStore.QueueInfo
 import Simplex.Messaging.Server.QueueStore.STM as QS
 import Simplex.Messaging.Server.Stats
@@ -108,6 +111,7 @@ import System.Exit (exitFailure)
 import System.IO (hPrint, hPutStrLn, hSetNewlineMode, universalNewlineMode)
 import System.Mem.Weak (deRefWeak)
 import UnliftIO (timeout)
+import UnliftIO.Async (mapConcurrently)
 import UnliftIO.Concurrent
 import UnliftIO.Directory (doesFileExist, renameFile)
 import UnliftIO.Exception
@@ -445,7 +449,7 @@ smpServer started cfg@ServerConfig {transports, transportConfig = tCfg} attachHT
           pMsgFwdsRecv' <- atomicSwapIORef pMsgFwdsRecv 0
           qCount' <- readIORef qCount
           qCount'' <- M.size <$> readTVarIO queues
-          notifierCount' <- M.size <$> readTVarIO notifiers
+          notifierCount' <- queueIndexSize notifiers
           msgCount' <- readIORef msgCount
           ntfCount' <- readIORef ntfCount
           hPutStrLn h $
@@ -630,7 +634,7 @@ smpServer started cfg@ServerConfig {transports, transportConfig = tCfg} attachHT
                 putStat "qCount" qCount
                 qCount2 <- M.size <$> readTVarIO queues
                 hPutStrLn h $ "qCount 2: " <> show qCount2
-                notifierCount <- M.size <$> readTVarIO notifiers
+                notifierCount <- queueIndexSize notifiers
                 hPutStrLn h $ "notifiers: " <> show notifierCount
                 putStat "msgCount" msgCount
                 putStat "ntfCount" ntfCount
@@ -646,6 +650,23 @@ smpServer started cfg@ServerConfig {transports, transportConfig = tCfg} attachHT
                 putProxyStat "pMsgFwdsOwn" pMsgFwdsOwn
                 putStat "pMsgFwdsRecv" pMsgFwdsRecv
               CPStatsRTS -> getRTSStats >>= hPrint h
+              CPStatsCrypto (Just on) -> withAdminRole $ do
+                setSNTRUP761Stats on
+                hPutStrLn h $ "crypto stats " <> if on then "enabled" else "disabled"
+              CPStatsCrypto Nothing -> withUserRole $ do
+                SNTRUP761Stats {kemStatsEnabled, timeInCycles, keypairStats, encStats, decStats, multStats, recipStats, sortStats, encodeStats, hashStats, keyGenRetries} <- getSNTRUP761Stats
+                let putCallStats label CallStats {callCount, callTime} = hPutStrLn h $ label <> ": calls=" <> show callCount <> ", time=" <> show callTime
+                hPutStrLn h $ "enabled: " <> show kemStatsEnabled
+                hPutStrLn h $ "time unit: " <> if timeInCycles then "cycles" else "ns"
+                putCallStats "sntrup761_keypair" keypairStats
+                putCallStats "sntrup761_enc" encStats
+                putCallStats "sntrup761_dec" decStats
+                putCallStats "mult" multStats
+                putCallStats "recip" recipStats
+                putCallStats "sort" sortStats
+                putCallStats "encode" encodeStats
+                putCallStats "hash" hashStats
+                hPutStrLn h $ "keyGenRetries: " <> show keyGenRetries
               CPThreads -> withAdminRole $ do
 #if MIN_VERSION_base(4,18,0)
                 threads <- liftIO listThreads
@@ -779,7 +800,7 @@ smpServer started cfg@ServerConfig {transports, transportConfig = tCfg} attachHT
                 hPutStrLn h "saving server state..."
                 unliftIO u $ saveServer True
                 hPutStrLn h "server state saved!"
-              CPHelp -> hPutStrLn h "commands: stats, stats-rts, clients, sockets, socket-threads, threads, server-info, delete, save, help, quit"
+              CPHelp -> hPutStrLn h "commands: stats, stats-rts, stats-crypto, clients, sockets, socket-threads, threads, server-info, delete, save, help, quit"
               CPQuit -> pure ()
               CPSkip -> pure ()
               where
@@ -804,7 +825,7 @@ runClientTransport h@THandle {params = thParams@THandleParams {thVersion, sessio
   clientId <- atomically $ stateTVar nextClientId $ \next -> (next, next + 1)
   atomically $ modifyTVar' active $ IM.insert clientId Nothing
   c <- liftIO $ newClient clientId q thVersion sessionId ts
-  runClientThreads active c clientId `finally` clientDisconnected c
+  runClientThreads active c clientId `finally` clientDisconnected c `finally` liftIO (mapM_ clearSessionDhCache $ thAuth thParams)
   where
     runClientThreads active c clientId = do
       atomically $ modifyTVar' active $ IM.insert clientId $ Just c
@@ -866,7 +887,9 @@ receive h@THandle {params = THandleParams {thAuth}} Client {rcvQ, sndQ, rcvActiv
     ts <- L.toList <$> liftIO (tGet h)
     atomically . (writeTVar rcvActiveAt $!) =<< liftIO getSystemTime
     stats <- asks serverStats
-    (errs, cmds) <- partitionEithers <$> mapM (cmdAction stats) ts
+    checked <- mapM authorizeCmd ts
+    batchVerified <- liftIO $ verifySignatures [(k, s, authorized) | Right (_, ACSignature _ k s authorized, _) <- checked]
+    (errs, cmds) <- partitionEithers <$> mapM (cmdAction stats batchVerified) checked
     updateBatchStats stats cmds
     write sndQ errs
     write rcvQ cmds
@@ -882,22 +905,30 @@ receive h@THandle {params = THandleParams {thAuth}} Client {rcvQ, sndQ, rcvActiv
               _ -> Nothing
         mapM_ (\sel -> incStat $ sel stats) sel_
       [] -> pure ()
-    cmdAction :: ServerStats -> SignedTransmission ErrorType Cmd -> M (Either (Transmission BrokerMsg) (Maybe QueueRec, Transmission Cmd))
-    cmdAction stats (tAuth, authorized, (corrId, entId, cmdOrError)) =
+    authorizeCmd :: SignedTransmission ErrorType Cmd -> M (Either (Transmission BrokerMsg) (Maybe QueueRec, AuthCheck, Transmission Cmd))
+    authorizeCmd (tAuth, authorized, (corrId, entId, cmdOrError)) =
       case cmdOrError of
         Left e -> pure $ Left (corrId, entId, ERR e)
-        Right cmd -> verified =<< verifyTransmission ((,C.cbNonce (bs corrId)) <$> thAuth) tAuth authorized entId cmd
-          where
-            verified = \case
-              VRVerified qr -> pure $ Right (qr, (corrId, entId, cmd))
-              VRFailed -> do
-                case cmd of
-                  Cmd _ SEND {} -> incStat $ msgSentAuth stats
-                  Cmd _ SUB -> incStat $ qSubAuth stats
-                  Cmd _ NSUB -> incStat $ ntfSubAuth stats
-                  Cmd _ GET -> incStat $ msgGetAuth stats
-                  _ -> pure ()
-                pure $ Left (corrId, entId, ERR AUTH)
+        Right cmd -> (\(qr, check) -> Right (qr, check, (corrId, entId, cmd))) <$> authorizeTransmission ((,C.cbNonce (bs corrId)) <$> thAuth) tAuth authorized entId cmd
+    -- Ed25519 signatures of all transmissions in the block are verified in one batch,
+    -- if batch verification fails, each signature is verified separately in authCheckResult.
+    verifySignatures :: [(C.PublicKey 'C.Ed25519, C.Signature 'C.Ed25519, ByteString)] -> IO Bool
+    verifySignatures = \case
+      sigs@(_ : _ : _) -> C.verifyBatch sigs
+      _ -> pure False
+    cmdAction :: ServerStats -> Bool -> Either (Transmission BrokerMsg) (Maybe QueueRec, AuthCheck, Transmission Cmd) -> M (Either (Transmission BrokerMsg) (Maybe QueueRec, Transmission Cmd))
+    cmdAction stats batchVerified = \case
+      Left e -> pure $ Left e
+      Right (qr_, check, t@(corrId, entId, cmd)) -> case verificationResult batchVerified (qr_, check) of
+        VRVerified qr -> pure $ Right (qr, t)
+        VRFailed -> do
+          case cmd of
+            Cmd _ SEND {} -> incStat $ msgSentAuth stats
+            Cmd _ SUB -> incStat $ qSubAuth stats
+            Cmd _ NSUB -> incStat $ ntfSubAuth stats
+            Cmd _ GET -> incStat $ msgGetAuth stats
+            _ -> pure ()
+          pure $ Left (corrId, entId, ERR AUTH)
     write q = mapM_ (atomically . writeTBQueue q) . L.nonEmpty
 
 send :: Transport c => MVar (THandleSMP c 'TServer) -> Client -> IO ()
@@ -951,58 +982,100 @@ disconnectTransport THandle {connection, params = THandleParams {sessionId}} rcv
 
 data VerificationResult = VRVerified (Maybe QueueRec) | VRFailed
 
+-- | Command authorization check.
+-- Ed25519 signature checks are deferred, so that the signatures of all transmissions received in one block
+-- can be verified in one batch.
+data AuthCheck
+  = ACResult Bool
+  | -- | The check succeeds only if the first field is True and the signature is valid.
+    -- It is False when the signature is checked with a dummy key.
+    ACSignature Bool (C.PublicKey 'C.Ed25519) (C.Signature 'C.Ed25519) ByteString
+
+-- | The first parameter is True when all signatures in the batch, including this one, are valid.
+authCheckResult :: Bool -> AuthCheck -> Bool
+authCheckResult batchVerified = \case
+  ACResult r -> r
+  ACSignature r k s authorized -> (batchVerified || C.verify' k s authorized) && r
+
+verificationResult :: Bool -> (Maybe QueueRec, AuthCheck) -> VerificationResult
+verificationResult batchVerified (qr, check) = if authCheckResult batchVerified check then VRVerified qr else VRFailed
+
+verifyTransmission :: Maybe (THandleAuth 'TServer, C.CbNonce) -> Maybe TransmissionAuth -> ByteString -> QueueId -> Cmd -> M VerificationResult
+verifyTransmission auth_ tAuth authorized queueId cmd = verificationResult False <$> authorizeTransmission auth_ tAuth authorized queueId cmd
+
 -- This function verifies queue command authorization, with the objective to have constant time between the three AUTH error scenarios:
 -- - the queue and party key exist, and the provided authorization has type matching queue key, but it is made with the different key.
 -- - the queue and party key exist, but the provided authorization has incorrect type.
 -- - the queue or party key do not exist.
 -- In all cases, the time of the verification should depend only on the provided authorization type,
 -- a dummy key is used to run verification in the last two cases, and failure is returned irrespective of the result.
-verifyTransmission :: Maybe (THandleAuth 'TServer, C.CbNonce) -> Maybe TransmissionAuth -> ByteString -> QueueId -> Cmd -> M VerificationResult
-verifyTransmission auth_ tAuth authorized queueId cmd =
+-- Dummy signature checks are included in the batch together with the real ones.
+authorizeTransmission :: Maybe (THandleAuth 'TServer, C.CbNonce) -> Maybe TransmissionAuth -> ByteString -> QueueId -> Cmd -> M (Maybe QueueRec, AuthCheck)
+authorizeTransmission auth_ tAuth authorized queueId cmd =
   case cmd of
     Cmd SRecipient (NEW k _ _ _ _) -> pure $ Nothing `verifiedWith` k
     Cmd SRecipient _ -> verifyQueue (\q -> Just q `verifiedWith` recipientKey q) <$> get SRecipient
     -- SEND will be accepted without authorization before the queue is secured with KEY or SKEY command
     Cmd SSender (SKEY k) -> verifyQueue (\q -> if maybe True (k ==) (senderKey q) then Just q `verifiedWith` k else dummyVerify) <$> get SSender
-    Cmd SSender SEND {} -> verifyQueue (\q -> Just q `verified` maybe (isNothing tAuth) verify (senderKey q)) <$> get SSender
-    Cmd SSender PING -> pure $ VRVerified Nothing
-    Cmd SSender RFWD {} -> pure $ VRVerified Nothing
+    Cmd SSender SEND {} -> verifyQueue (\q -> (Just q, maybe (ACResult $ isNothing tAuth) verify (senderKey q))) <$> get SSender
+    Cmd SSender PING -> pure (Nothing, ACResult True)
+    Cmd SSender RFWD {} -> pure (Nothing, ACResult True)
     -- NSUB will not be accepted without authorization
     Cmd SNotifier NSUB -> verifyQueue (\q -> maybe dummyVerify (\n -> Just q `verifiedWith` notifierKey n) (notifier q)) <$> get SNotifier
-    Cmd SProxiedClient _ -> pure $ VRVerified Nothing
+    Cmd SProxiedClient _ -> pure (Nothing, ACResult True)
   where
-    verify = verifyCmdAuthorization auth_ tAuth authorized
-    dummyVerify = verify (dummyAuthKey tAuth) `seq` VRFailed
-    verifyQueue :: (QueueRec -> VerificationResult) -> Either ErrorType QueueRec -> VerificationResult
+    verify = cmdAuthorization auth_ tAuth authorized
+    dummyVerify = (Nothing, maybe (ACResult False) (dummyCmdAuthorization auth_ authorized) tAuth)
+    verifyQueue :: (QueueRec -> (Maybe QueueRec, AuthCheck)) -> Either ErrorType QueueRec -> (Maybe QueueRec, AuthCheck)
     verifyQueue = either (const dummyVerify)
-    verified q cond = if cond then VRVerified q else VRFailed
-    verifiedWith q k = q `verified` verify k
+    verifiedWith q k = (q, verify k)
     get :: DirectParty p => SParty p -> M (Either ErrorType QueueRec)
     get party = do
       st <- asks queueStore
       liftIO $ getQueue st party queueId
 
 verifyCmdAuthorization :: Maybe (THandleAuth 'TServer, C.CbNonce) -> Maybe TransmissionAuth -> ByteString -> C.APublicAuthKey -> Bool
-verifyCmdAuthorization auth_ tAuth authorized key = maybe False (verify key) tAuth
+verifyCmdAuthorization auth_ tAuth authorized = authCheckResult False . cmdAuthorization auth_ tAuth authorized
+
+cmdAuthorization :: Maybe (THandleAuth 'TServer, C.CbNonce) -> Maybe TransmissionAuth -> ByteString -> C.APublicAuthKey -> AuthCheck
+cmdAuthorization auth_ tAuth authorized key = maybe (ACResult False) (verify key) tAuth
   where
-    verify :: C.APublicAuthKey -> TransmissionAuth -> Bool
+    verify :: C.APublicAuthKey -> TransmissionAuth -> AuthCheck
     verify (C.APublicAuthKey a k) = \case
       TASignature (C.ASignature a' s) -> case testEquality a a' of
-        Just Refl -> C.verify' k s authorized
-        _ -> C.verify' (dummySignKey a') s authorized `seq` False
-      TAAuthenticator s -> case a of
+        Just Refl -> signatureCheck True a' k s
+        _ -> signatureCheck False a' (dummySignKey a') s
+      TAAuthenticator s -> ACResult $ case a of
         C.SX25519 -> verifyCmdAuth auth_ k s authorized
-        _ -> verifyCmdAuth auth_ dummyKeyX25519 s authorized `seq` False
+        _ -> dummyVerifyCmdAuth auth_ s authorized `seq` False
+    signatureCheck :: C.SignatureAlgorithm a => Bool -> C.SAlgorithm a -> C.PublicKey a -> C.Signature a -> AuthCheck
+    signatureCheck r a k s = case a of
+      C.SEd25519 -> ACSignature r k s authorized
+      C.SEd448 -> ACResult $ C.verify' k s authorized && r
 
 verifyCmdAuth :: Maybe (THandleAuth 'TServer, C.CbNonce) -> C.PublicKeyX25519 -> C.CbAuthenticator -> ByteString -> Bool
 verifyCmdAuth auth_ k authenticator authorized = case auth_ of
-  Just (THAuthServer {serverPrivKey = pk}, nonce) -> C.cbVerify k pk nonce authenticator authorized
+  Just (THAuthServer {serverPrivKey = pk, dhCache'}, nonce) -> C.cbVerifyCached dhCache' k pk nonce authenticator authorized
   Nothing -> False
 
+-- | Authenticator check with the dummy key has the same cost as the failed check with the queue key:
+-- it looks up the session cache and always computes DH secret, as failed checks with the queue key are never cached,
+-- so the response time does not show whether the queue exists.
+dummyVerifyCmdAuth :: Maybe (THandleAuth 'TServer, C.CbNonce) -> C.CbAuthenticator -> ByteString -> Bool
+dummyVerifyCmdAuth auth_ authenticator authorized = case auth_ of
+  Just (THAuthServer {serverPrivKey = pk, dhCache'}, nonce) -> C.cbVerifyUncached dhCache' dummyKeyX25519 pk nonce authenticator authorized
+  Nothing -> False
+
+-- | Authorization check with the dummy key of the same type, it always fails.
+dummyCmdAuthorization :: Maybe (THandleAuth 'TServer, C.CbNonce) -> ByteString -> TransmissionAuth -> AuthCheck
+dummyCmdAuthorization auth_ authorized = \case
+  TASignature (C.ASignature C.SEd25519 s) -> ACSignature False dummyKeyEd25519 s authorized
+  tAuth -> ACResult $ dummyVerifyCmd auth_ authorized tAuth `seq` False
+
 dummyVerifyCmd :: Maybe (THandleAuth 'TServer, C.CbNonce) -> ByteString -> TransmissionAuth -> Bool
 dummyVerifyCmd auth_ authorized = \case
   TASignature (C.ASignature a s) -> C.verify' (dummySignKey a) s authorized
-  TAAuthenticator s -> verifyCmdAuth auth_ dummyKeyX25519 s authorized
+  TAAuthenticator s -> dummyVerifyCmdAuth auth_ s authorized
 
 -- These dummy keys are used with `dummyVerify` function to mitigate timing attacks
 -- by having the same time of the response whether a queue exists or nor, for all valid key/signature sizes
@@ -1011,13 +1084,6 @@ dummySignKey = \case
   C.SEd25519 -> dummyKeyEd25519
   C.SEd448 -> dummyKeyEd448
 
-dummyAuthKey :: Maybe TransmissionAuth -> C.APublicAuthKey
-dummyAuthKey = \case
-  Just (TASignature (C.ASignature a _)) -> case a of
-    C.SEd25519 -> C.APublicAuthKey C.SEd25519 dummyKeyEd25519
-    C.SEd448 -> C.APublicAuthKey C.SEd448 dummyKeyEd448
-  _ -> C.APublicAuthKey C.SX25519 dummyKeyX25519
-
 dummyKeyEd25519 :: C.PublicKey 'C.Ed25519
 dummyKeyEd25519 = "MCowBQYDK2VwAyEA139Oqs4QgpqbAmB0o7rZf6T19ryl7E65k4AYe0kE3Qs="
 
@@ -1527,7 +1593,7 @@ client thParams' clnt@Client {clientId, subscriptions, ntfSubscriptions, rcvQ, s
 
         processForwardedCommand :: EncFwdTransmission -> M BrokerMsg
         processForwardedCommand (EncFwdTransmission s) = fmap (either ERR id) . runExceptT $ do
-          THAuthServer {serverPrivKey, sessSecret'} <- maybe (throwE $ transportErr TENoServerAuth) pure (thAuth thParams')
+          THAuthServer {serverPrivKey, sessSecret', dhCache'} <- maybe (throwE $ transportErr TENoServerAuth) pure (thAuth thParams')
           sessSecret <- maybe (throwE $ transportErr TENoServerAuth) pure sessSecret'
           let proxyNonce = C.cbNonce $ bs corrId
           s' <- liftEitherWith (const CRYPTO) $ C.cbDecryptNoPad sessSecret proxyNonce s
@@ -1540,7 +1606,7 @@ client thParams' clnt@Client {clientId, subscriptions, ntfSubscriptions, rcvQ, s
           t' <- case tParse clntTHParams b of
             t :| [] -> pure $ tDecodeParseValidate clntTHParams t
             _ -> throwE BLOCK
-          let clntThAuth = Just $ THAuthServer {serverPrivKey, sessSecret' = Just clientSecret}
+          let clntThAuth = Just $ THAuthServer {serverPrivKey, sessSecret' = Just clientSecret, dhCache'}
           -- process forwarded command
           r <-
             lift (rejectOrVerify clntThAuth t') >>= \case
@@ -1707,17 +1773,22 @@ saveServerMessages keepMsgs = asks (storeMsgsFile . config) >>= mapM_ saveMessag
     saveMessages f = do
       logInfo $ "saving messages to file " <> T.pack f
       ms <- asks msgStore
-      liftIO . withFile f WriteMode $ \h ->
-        readTVarIO ms >>= mapM_ (saveQueueMsgs h) . M.assocs
+      env <- ask
+      -- messages snapshot uses binary format together with binary store log
+      let binary = maybe False ((SLFBinary ==) . storeLogFormat) $ storeLog (env :: Env)
+          encodeMessages = if binary then encodeMsgQueueBlock else encodeMsgLines
+      liftIO . withFile f WriteMode $ \h -> do
+        when binary $ B.hPut h msgSnapshotHeader
+        readTVarIO ms >>= mapM_ (saveQueueMsgs h encodeMessages) . M.assocs
       logInfo "messages saved"
       where
-        saveQueueMsgs h (rId, q) = BLD.hPutBuilder h . encodeMessages rId =<< atomically (getMessages $ msgQueue q)
+        saveQueueMsgs h encodeMessages (rId, q) = BLD.hPutBuilder h . encodeMessages rId =<< atomically (getMessages $ msgQueue q)
         getMessages = if keepMsgs then snapshotTQueue else flushTQueue
         snapshotTQueue q = do
           msgs <- flushTQueue q
           mapM_ (writeTQueue q) msgs
           pure msgs
-        encodeMessages rId = mconcat . map (\msg -> BLD.byteString (strEncode $ MLRv3 rId msg) <> BLD.char8 '\n')
+        encodeMsgLines rId = mconcat . map (\msg -> BLD.byteString (strEncode $ MLRv3 rId msg) <> BLD.char8 '\n')
 
 restoreServerMessages :: M Int
 restoreServerMessages =
@@ -1730,7 +1801,9 @@ restoreServerMessages =
       ms <- asks msgStore
       quota <- asks $ msgQueueQuota . config
       old_ <- asks (messageExpiration . config) $>>= (liftIO . fmap Just . expireBeforeEpoch)
-      runExceptT (liftIO (LB.readFile f) >>= foldM (\expired -> restoreMsg expired ms quota old_) 0 . LB.lines) >>= \case
+      binary <- liftIO $ (msgSnapshotHeader ==) <$> withFile f ReadMode (`B.hGet` B.length msgSnapshotHeader)
+      let restore = if binary then restoreBlocks else restoreLines
+      runExceptT (restore ms quota old_) >>= \case
         Left e -> do
           logError . T.pack $ "error restoring messages: " <> e
           liftIO exitFailure
@@ -1739,22 +1812,40 @@ restoreServerMessages =
           logInfo "messages restored"
           pure expired
       where
+        restoreLines ms quota old_ = liftIO (LB.readFile f) >>= foldM (\expired -> restoreMsg expired ms quota old_) 0 . LB.lines
         restoreMsg !expired ms quota old_ s' = do
           MLRv3 rId msg <- liftEither . first (msgErr "parsing") $ strDecode s
-          addToMsgQueue rId msg
+          q <- liftIO $ getMsgQueue ms rId quota
+          liftIO $ addToMsgQueue old_ rId q expired msg
           where
             s = LB.toStrict s'
-            addToMsgQueue rId msg = do
-              q <- liftIO $ getMsgQueue ms rId quota
-              (isExpired, logFull) <- liftIO $ case msg of
-                Message {msgTs}
-                  | maybe True (systemSeconds msgTs >=) old_ -> (False,) . isNothing <$> writeMsg q msg
-                  | otherwise -> pure (True, False)
-                MessageQuota {} -> writeMsg q msg $> (False, False)
-              when logFull . logError . decodeLatin1 $ "message queue " <> strEncode rId <> " is full, message not restored: " <> strEncode (messageId msg)
-              pure $ if isExpired then expired + 1 else expired
             msgErr :: Show e => String -> e -> String
             msgErr op e = op <> " error (" <> show e <> "): " <> B.unpack (B.take 100 s)
+        -- queue blocks are split between the available cores, each block is restored to its queue
+        restoreBlocks ms quota old_ = do
+          blocks <- liftEither . first ("parsing error: " <>) . msgQueueBlocks . B.drop (B.length msgSnapshotHeader) =<< liftIO (B.readFile f)
+          n <- getNumCapabilities
+          rs <- liftIO $ mapConcurrently (runExceptT . foldM (restoreBlock ms quota old_) 0) $ groups n blocks
+          sum <$> mapM liftEither rs
+          where
+            groups n bs =
+              let k = max 1 $ (length bs + n - 1) `div` n
+                  go xs = case splitAt k xs of
+                    ([], _) -> []
+                    (g, xs') -> g : go xs'
+               in go bs
+        restoreBlock ms quota old_ !expired b@(MsgQueueBlock rId _ _) = do
+          msgs <- liftEither . first (\e -> "parsing error (" <> e <> "): queue " <> B.unpack (strEncode rId)) $ decodeMsgQueueBlock b
+          q <- liftIO $ getMsgQueue ms rId quota
+          liftIO $ foldM (addToMsgQueue old_ rId q) expired msgs
+        addToMsgQueue old_ rId q !expired msg = do
+          (isExpired, logFull) <- case msg of
+            Message {msgTs}
+              | maybe True (systemSeconds msgTs >=) old_ -> (False,) . isNothing <$> writeMsg q msg
+              | otherwise -> pure (True, False)
+            MessageQuota {} -> writeMsg q msg $> (False, False)
+          when logFull . logError . decodeLatin1 $ "message queue " <> strEncode rId <> " is full, message not restored: " <> strEncode (messageId msg)
+          pure $ if isExpired then expired + 1 else expired
 
 saveServerNtfs :: M ()
 saveServerNtfs = asks (storeNtfsFile . config) >>= mapM_ saveNtfs
@@ -3,7 +3,9 @@
 
 module Simplex.Messaging.Server.Control where
 
+import Control.Applicative (optional, (<|>))
 import qualified Data.Attoparsec.ByteString.Char8 as A
+import Data.Functor (($>))
 import Simplex.Messaging.Encoding.String
 import Simplex.Messaging.Protocol (BasicAuth, SenderId)
 
@@ -17,6 +19,7 @@ data ControlProtocol
   | CPClients
   | CPStats
   | CPStatsRTS
+  | CPStatsCrypto (Maybe Bool)
   | CPThreads
   | CPSockets
   | CPSocketThreads
@@ -35,6 +38,7 @@ instance StrEncoding ControlProtocol where
     CPClients -> "clients"
     CPStats -> "stats"
     CPStatsRTS -> "stats-rts"
+    CPStatsCrypto on_ -> "stats-crypto" <> maybe "" (\on -> if on then " on" else " off") on_
     CPThreads -> "threads"
     CPSockets -> "sockets"
     CPSocketThreads -> "socket-threads"
@@ -52,6 +56,7 @@ instance StrEncoding ControlProtocol where
       "clients" -> pure CPClients
       "stats" -> pure CPStats
       "stats-rts" -> pure CPStatsRTS
+      "stats-crypto" -> CPStatsCrypto <$> optional (A.space *> onOffP)
       "threads" -> pure CPThreads
       "sockets" -> pure CPSockets
       "socket-threads" -> pure CPSocketThreads
@@ -62,3 +67,5 @@ instance StrEncoding ControlProtocol where
       "quit" -> pure CPQuit
       "" -> pure CPSkip
       _ -> fail "bad ControlProtocol command"
+    where
+      onOffP = ("on" $> True) <|> ("off" $> False)
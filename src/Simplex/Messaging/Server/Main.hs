@@ -43,6 +43,7 @@ import Simplex.Messaging.Server.CLI
 import Simplex.Messaging.Server.Env.STM
 import Simplex.Messaging.Server.Expiration
 import Simplex.Messaging.Server.Information
+import Simplex.Messaging.Server.StoreLog (StoreLogFormat (..), convertStoreLog)
 import Simplex.Messaging.Transport (batchCmdsSMPVersion, sendingProxySMPVersion, simplexMQVersion, supportedServerSMPRelayVRange)
 import Simplex.Messaging.Transport.Client (SocksProxy, TransportHost (..), defaultSocksProxy)
 import Simplex.Messaging.Transport.Server (ServerCredentials (..), TransportServerConfig (..), defaultTransportServerConfig)
@@ -83,6 +84,13 @@ smpServerCLI_ generateSite serveStaticFiles attachStaticFiles cfgPath logPath =
       deleteDirIfExists cfgPath
       deleteDirIfExists logPath
       putStrLn "Deleted configuration and log files"
+    ConvertStoreLog fmt ->
+      doesFileExist storeLogFilePath >>= \case
+        True -> do
+          putStrLn $ "Converting " <> storeLogFilePath <> ", the server must be stopped"
+          convertStoreLog fmt storeLogFilePath
+          putStrLn $ "Store log converted, the previous log is saved to " <> storeLogFilePath <> ".bak"
+        _ -> exitError $ "Error: store log " <> storeLogFilePath <> " does not exist."
   where
     iniFile = combine cfgPath "smp-server.ini"
     serverVersion = "SMP server v" <> simplexMQVersion
@@ -519,6 +527,7 @@ data CliCommand
   | OnlineCert CertOptions
   | Start
   | Delete
+  | ConvertStoreLog StoreLogFormat
 
 data InitOptions = InitOptions
   { enableStoreLog :: Bool,
@@ -550,8 +559,18 @@ cliCommandP cfgPath logPath iniFile =
         <> command "cert" (info (OnlineCert <$> certOptionsP) (progDesc $ "Generate new online TLS server credentials (configuration: " <> iniFile <> ")"))
         <> command "start" (info (pure Start) (progDesc $ "Start server (configuration: " <> iniFile <> ")"))
         <> command "delete" (info (pure Delete) (progDesc "Delete configuration and log files"))
+        <> command "store-log" (info (ConvertStoreLog <$> storeLogFormatP) (progDesc "Convert store log to text or binary format"))
     )
   where
+    storeLogFormatP :: Parser StoreLogFormat
+    storeLogFormatP =
+      argument
+        ( maybeReader $ \case
+            "text" -> Just SLFText
+            "binary" -> Just SLFBinary
+            _ -> Nothing
+        )
+        (metavar "FORMAT" <> help "Store log format: text, binary")
     initP :: Parser InitOptions
     initP = do
       enableStoreLog <-
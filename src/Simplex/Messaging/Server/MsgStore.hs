@@ -1,13 +1,57 @@
 {-# LANGUAGE LambdaCase #-}
+{-# LANGUAGE NamedFieldPuns #-}
 {-# LANGUAGE OverloadedStrings #-}
 
 module Simplex.Messaging.Server.MsgStore where
 
+import qualified Data.Attoparsec.ByteString.Char8 as A
+import qualified Data.ByteString.Builder as BLD
+import Data.ByteString.Char8 (ByteString)
+import qualified Data.ByteString.Char8 as B
+import Data.Word (Word32)
+import qualified Simplex.Messaging.Crypto as C
+import Simplex.Messaging.Encoding
 import Simplex.Messaging.Encoding.String
-import Simplex.Messaging.Protocol (Message (..), RecipientId)
+import Simplex.Messaging.Parsers (parseAll)
+import Simplex.Messaging.Protocol (EntityId (..), Message (..), RecipientId)
 
 data MsgLogRecord = MLRv3 RecipientId Message
 
 instance StrEncoding MsgLogRecord where
   strEncode (MLRv3 rId msg) = strEncode (Str "v3", rId, msg)
   strP = "v3 " *> (MLRv3 <$> strP_ <*> strP)
+
+-- | Binary messages snapshot has this header followed by one block per queue:
+-- queue ID, message count and length of the encoded messages (Word32), and the messages.
+-- The blocks are written one queue at a time, and can be restored concurrently.
+msgSnapshotHeader :: ByteString
+msgSnapshotHeader = "#SMPMSG1"
+
+data MsgQueueBlock = MsgQueueBlock RecipientId Int ByteString
+
+encodeMsgQueueBlock :: RecipientId -> [Message] -> BLD.Builder
+encodeMsgQueueBlock rId = \case
+  [] -> mempty
+  msgs ->
+    let ms = map smpEncode msgs
+        count = fromIntegral (length ms) :: Word32
+        len = fromIntegral (sum $ map B.length ms) :: Word32
+     in BLD.byteString (smpEncode (rId, count, len)) <> foldMap BLD.byteString ms
+
+-- | Splits the snapshot (without header) into queue blocks, the messages are parsed with decodeMsgQueueBlock.
+-- The blocks are slices of the snapshot, queue IDs are copied as they are kept in the store.
+msgQueueBlocks :: ByteString -> Either String [MsgQueueBlock]
+msgQueueBlocks = parseAll $ A.many' blockP
+  where
+    blockP = do
+      (EntityId rId, count, len) <- smpP
+      MsgQueueBlock (EntityId $ B.copy rId) (fromIntegral (count :: Word32)) <$> A.take (fromIntegral (len :: Word32))
+
+-- | Message IDs and bodies are copied, otherwise each restored message would keep the whole snapshot in memory.
+decodeMsgQueueBlock :: MsgQueueBlock -> Either String [Message]
+decodeMsgQueueBlock (MsgQueueBlock _ count s) = map copyMessage <$> parseAll (A.count count smpP) s
+  where
+    copyMessage = \case
+      Message {msgId, msgTs, msgFlags, msgBody = C.MaxLenBS body} ->
+        Message {msgId = B.copy msgId, msgTs, msgFlags, msgBody = C.unsafeMaxLenBS $ B.copy body}
+      MessageQuota {msgId, msgTs} -> MessageQuota {msgId = B.copy msgId, msgTs}
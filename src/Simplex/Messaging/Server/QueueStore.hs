@@ -8,6 +8,7 @@ module Simplex.Messaging.Server.QueueStore where
 
 import Data.Int (Int64)
 import Data.Time.Clock.System (SystemTime (..), getSystemTime)
+import Simplex.Messaging.Encoding
 import Simplex.Messaging.Encoding.String
 import Simplex.Messaging.Protocol
 
@@ -31,6 +32,12 @@ data NtfCreds = NtfCreds
   }
   deriving (Show)
 
+instance Encoding NtfCreds where
+  smpEncode NtfCreds {notifierId, notifierKey, rcvNtfDhSecret} = smpEncode (notifierId, notifierKey, rcvNtfDhSecret)
+  smpP = do
+    (notifierId, notifierKey, rcvNtfDhSecret) <- smpP
+    pure NtfCreds {notifierId, notifierKey, rcvNtfDhSecret}
+
 instance StrEncoding NtfCreds where
   strEncode NtfCreds {notifierId, notifierKey, rcvNtfDhSecret} = strEncode (notifierId, notifierKey, rcvNtfDhSecret)
   strP = do
@@ -42,6 +49,10 @@ data ServerQueueStatus = QueueActive | QueueOff deriving (Eq, Show)
 newtype RoundedSystemTime = RoundedSystemTime Int64
   deriving (Eq, Ord, Show)
 
+instance Encoding RoundedSystemTime where
+  smpEncode (RoundedSystemTime t) = smpEncode t
+  smpP = RoundedSystemTime <$> smpP
+
 instance StrEncoding RoundedSystemTime where
   strEncode (RoundedSystemTime t) = strEncode t
   strP = RoundedSystemTime <$> strP
@@ -0,0 +1,93 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+{-# LANGUAGE LambdaCase #-}
+
+-- |
+-- Module      : Simplex.Messaging.Server.QueueStore.QueueIndex
+-- Copyright   : (c) simplex.chat
+-- License     : AGPL-3
+--
+-- Maintainer  : chat@simplex.chat
+-- Stability   : experimental
+-- Portability : non-portable
+--
+-- Native hash index of queue IDs (sender or notifier ID -> recipient ID).
+-- The IDs are stored in fixed-size slots outside of GHC heap, so the index does not add to GC time.
+module Simplex.Messaging.Server.QueueStore.QueueIndex
+  ( QueueIndex,
+    newQueueIndex,
+    insertQueueIndex,
+    lookupQueueIndex,
+    deleteQueueIndex,
+    queueIndexSize,
+  ) where
+
+import Control.Monad (when)
+import qualified Data.ByteString.Internal as BI
+import Data.ByteString.Unsafe (unsafeUseAsCStringLen)
+import Foreign
+import Foreign.C
+import Simplex.Messaging.Protocol (EntityId (..))
+
+data QueueIndexStruct
+
+newtype QueueIndex = QueueIndex (ForeignPtr QueueIndexStruct)
+
+newQueueIndex :: IO QueueIndex
+newQueueIndex = do
+  p <- c_queue_index_new
+  when (p == nullPtr) $ error "newQueueIndex: allocation failed"
+  QueueIndex <$> newForeignPtr c_queue_index_free_ptr p
+
+-- | Returns False if the ID is already in the index.
+-- IDs longer than 24 bytes cannot be added.
+insertQueueIndex :: QueueIndex -> EntityId -> EntityId -> IO Bool
+insertQueueIndex (QueueIndex qi) (EntityId k) (EntityId v) =
+  withForeignPtr qi $ \qiPtr ->
+    unsafeUseAsCStringLen k $ \(kPtr, kLen) ->
+      unsafeUseAsCStringLen v $ \(vPtr, vLen) ->
+        c_queue_index_insert qiPtr (castPtr kPtr) (fromIntegral kLen) (castPtr vPtr) (fromIntegral vLen) >>= \case
+          1 -> pure True
+          0 -> pure False
+          _ -> error "insertQueueIndex: invalid ID length or allocation failed"
+
+lookupQueueIndex :: QueueIndex -> EntityId -> IO (Maybe EntityId)
+lookupQueueIndex (QueueIndex qi) (EntityId k) =
+  withForeignPtr qi $ \qiPtr ->
+    unsafeUseAsCStringLen k $ \(kPtr, kLen) -> do
+      (v, found) <- BI.createAndTrim' 24 $ \vPtr -> do
+        n <- c_queue_index_lookup qiPtr (castPtr kPtr) (fromIntegral kLen) vPtr
+        pure $ if n < 0 then (0, 0, False) else (0, fromIntegral n, True)
+      pure $ if found then Just (EntityId v) else Nothing
+
+deleteQueueIndex :: QueueIndex -> EntityId -> IO ()
+deleteQueueIndex (QueueIndex qi) (EntityId k) =
+  withForeignPtr qi $ \qiPtr ->
+    unsafeUseAsCStringLen k $ \(kPtr, kLen) ->
+      () <$ c_queue_index_delete qiPtr (castPtr kPtr) (fromIntegral kLen)
+
+queueIndexSize :: QueueIndex -> IO Int
+queueIndexSize (QueueIndex qi) = fromIntegral <$> withForeignPtr qi c_queue_index_count
+
+-- queue_index *queue_index_new (void);
+foreign import ccall unsafe "queue_index_new"
+  c_queue_index_new :: IO (Ptr QueueIndexStruct)
+
+-- void queue_index_free (queue_index *qi);
+foreign import ccall unsafe "&queue_index_free"
+  c_queue_index_free_ptr :: FunPtr (Ptr QueueIndexStruct -> IO ())
+
+-- int queue_index_insert (queue_index *qi, const uint8_t *key, size_t key_len, const uint8_t *val, size_t val_len);
+foreign import ccall unsafe "queue_index_insert"
+  c_queue_index_insert :: Ptr QueueIndexStruct -> Ptr Word8 -> CSize -> Ptr Word8 -> CSize -> IO CInt
+
+-- int queue_index_lookup (queue_index *qi, const uint8_t *key, size_t key_len, uint8_t *val);
+foreign import ccall unsafe "queue_index_lookup"
+  c_queue_index_lookup :: Ptr QueueIndexStruct -> Ptr Word8 -> CSize -> Ptr Word8 -> IO CInt
+
+-- int queue_index_delete (queue_index *qi, const uint8_t *key, size_t key_len);
+foreign import ccall unsafe "queue_index_delete"
+  c_queue_index_delete :: Ptr QueueIndexStruct -> Ptr Word8 -> CSize -> IO CInt
+
+-- size_t queue_index_count (queue_index *qi);
+foreign import ccall unsafe "queue_index_count"
+  c_queue_index_count :: Ptr QueueIndexStruct -> IO CSize
@@ -28,33 +28,39 @@ import Control.Monad
 import Data.Functor (($>))
 import Simplex.Messaging.Protocol
 import Simplex.Messaging.Server.QueueStore
+import Simplex.Messaging.Server.QueueStore.QueueIndex
 import Simplex.Messaging.TMap (TMap)
 import qualified Simplex.Messaging.TMap as TM
 import Simplex.Messaging.Util (ifM, ($>>=))
 import UnliftIO.STM
 
+-- | Only the queue records that are updated by commands are kept in GHC heap,
+-- sender and notifier IDs are indexed in native memory.
 data QueueStore = QueueStore
   { queues :: TMap RecipientId (TVar QueueRec),
-    senders :: TMap SenderId RecipientId,
-    notifiers :: TMap NotifierId RecipientId
+    senders :: QueueIndex,
+    notifiers :: QueueIndex
   }
 
 newQueueStore :: IO QueueStore
 newQueueStore = do
   queues <- TM.emptyIO
-  senders <- TM.emptyIO
-  notifiers <- TM.emptyIO
+  senders <- newQueueIndex
+  notifiers <- newQueueIndex
   pure QueueStore {queues, senders, notifiers}
 
 addQueue :: QueueStore -> QueueRec -> IO (Either ErrorType ())
-addQueue QueueStore {queues, senders} q@QueueRec {recipientId = rId, senderId = sId} = atomically $ do
-  ifM hasId (pure $ Left DUPLICATE_) $ do
-    qVar <- newTVar q
-    TM.insert rId qVar queues
-    TM.insert sId rId senders
-    pure $ Right ()
+addQueue QueueStore {queues, senders} q@QueueRec {recipientId = rId, senderId = sId} =
+  ifM (insertQueueIndex senders sId rId) addRcv (pure $ Left DUPLICATE_)
   where
-    hasId = (||) <$> TM.member rId queues <*> TM.member sId senders
+    addRcv = do
+      added <- atomically $ ifM (TM.member rId queues) (pure False) $ do
+        qVar <- newTVar q
+        TM.insert rId qVar queues
+        pure True
+      if added
+        then pure $ Right ()
+        else deleteQueueIndex senders sId $> Left DUPLICATE_
 
 getQueue :: DirectParty p => QueueStore -> SParty p -> QueueId -> IO (Either ErrorType QueueRec)
 getQueue QueueStore {queues, senders, notifiers} party qId =
@@ -62,8 +68,8 @@ getQueue QueueStore {queues, senders, notifiers} party qId =
   where
     getVar = case party of
       SRecipient -> TM.lookupIO qId queues
-      SSender -> TM.lookupIO qId senders $>>= (`TM.lookupIO` queues)
-      SNotifier -> TM.lookupIO qId notifiers $>>= (`TM.lookupIO` queues)
+      SSender -> lookupQueueIndex senders qId $>>= (`TM.lookupIO` queues)
+      SNotifier -> lookupQueueIndex notifiers qId $>>= (`TM.lookupIO` queues)
 
 secureQueue :: QueueStore -> RecipientId -> SndPublicAuthKey -> IO (Either ErrorType QueueRec)
 secureQueue QueueStore {queues} rId sKey = toResult <$> do
@@ -77,23 +83,29 @@ secureQueue QueueStore {queues} rId sKey = toResult <$> do
 addQueueNotifier :: QueueStore -> RecipientId -> NtfCreds -> IO (Either ErrorType (Maybe NotifierId))
 addQueueNotifier QueueStore {queues, notifiers} rId ntfCreds@NtfCreds {notifierId = nId} = do
   TM.lookupIO rId queues >>= \case
-    Just qVar -> atomically $ ifM (TM.member nId notifiers) (pure $ Left DUPLICATE_) $ do
-      q <- readTVar qVar
-      nId_ <- forM (notifier q) $ \NtfCreds {notifierId} -> TM.delete notifierId notifiers $> notifierId
-      let !q' = q {notifier = Just ntfCreds}
-      writeTVar qVar q'
-      TM.insert nId rId notifiers
-      pure $ Right nId_
+    Just qVar -> ifM (insertQueueIndex notifiers nId rId) (replaceNotifier qVar) (pure $ Left DUPLICATE_)
     Nothing -> pure $ Left AUTH
+  where
+    -- the queue can be deleted after it was found, then the new notifier ID is removed from the index
+    replaceNotifier qVar =
+      atomically (ifM (TM.member rId queues) (Just <$> replace) (pure Nothing)) >>= \case
+        Just nId_ -> mapM_ (deleteQueueIndex notifiers) nId_ $> Right nId_
+        Nothing -> deleteQueueIndex notifiers nId $> Left AUTH
+      where
+        replace = do
+          q <- readTVar qVar
+          writeTVar qVar $! q {notifier = Just ntfCreds}
+          pure $ notifierId <$> notifier q
 
 deleteQueueNotifier :: QueueStore -> RecipientId -> IO (Either ErrorType (Maybe NotifierId))
-deleteQueueNotifier QueueStore {queues, notifiers} rId =
-  withQueue rId queues $ \qVar -> do
+deleteQueueNotifier QueueStore {queues, notifiers} rId = do
+  r <- withQueue rId queues $ \qVar -> do
     q <- readTVar qVar
     forM (notifier q) $ \NtfCreds {notifierId} -> do
-      TM.delete notifierId notifiers
       writeTVar qVar $! q {notifier = Nothing}
       pure notifierId
+  forM_ r $ mapM_ $ deleteQueueIndex notifiers
+  pure r
 
 suspendQueue :: QueueStore -> RecipientId -> IO (Either ErrorType ())
 suspendQueue QueueStore {queues} rId =
@@ -104,14 +116,12 @@ updateQueueTime QueueStore {queues} rId t =
   void $ withQueue rId queues (`modifyTVar'` \q -> q {updatedAt = Just t})
 
 deleteQueue :: QueueStore -> RecipientId -> IO (Either ErrorType QueueRec)
-deleteQueue QueueStore {queues, senders, notifiers} rId = atomically $ do
-  TM.lookupDelete rId queues >>= \case
-    Just qVar ->
-      readTVar qVar >>= \q -> do
-        TM.delete (senderId q) senders
-        forM_ (notifier q) $ \NtfCreds {notifierId} -> TM.delete notifierId notifiers
-        pure $ Right q
-    _ -> pure $ Left AUTH
+deleteQueue QueueStore {queues, senders, notifiers} rId = do
+  r <- atomically $ TM.lookupDelete rId queues >>= mapM readTVar
+  forM_ r $ \q -> do
+    deleteQueueIndex senders $ senderId q
+    forM_ (notifier q) $ \NtfCreds {notifierId} -> deleteQueueIndex notifiers notifierId
+  pure $ toResult r
 
 toResult :: Maybe a -> Either ErrorType a
 toResult = maybe (Left AUTH) Right
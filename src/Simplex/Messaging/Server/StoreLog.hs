@@ -5,16 +5,21 @@
 {-# LANGUAGE LambdaCase #-}
 {-# LANGUAGE NamedFieldPuns #-}
 {-# LANGUAGE OverloadedStrings #-}
+{-# LANGUAGE TupleSections #-}
 {-# OPTIONS_GHC -fno-warn-orphans #-}
 
 module Simplex.Messaging.Server.StoreLog
   ( StoreLog, -- constructors are not exported
     StoreLogRecord (..), -- used in tests
+    StoreLogFormat (..),
     openWriteStoreLog,
+    openWriteBinaryStoreLog,
     openReadStoreLog,
     storeLogFilePath,
+    storeLogFormat,
     closeStoreLog,
     writeStoreLogRecord,
+    writeQueueLogRecord,
     logCreateQueue,
     logSecureQueue,
     logAddNotifier,
@@ -23,18 +28,29 @@ module Simplex.Messaging.Server.StoreLog
     logDeleteNotifier,
     logUpdateQueueTime,
     readWriteStoreLog,
+    convertStoreLog,
   )
 where
 
 import Control.Applicative (optional, (<|>))
+import Control.Concurrent (getNumCapabilities)
+import Control.Concurrent.Async (mapConcurrently)
+import qualified Control.Exception as E
 import Control.Monad (foldM, unless, when)
 import qualified Data.Attoparsec.ByteString.Char8 as A
+import Data.ByteString.Char8 (ByteString)
 import qualified Data.ByteString.Char8 as B
 import qualified Data.ByteString.Lazy.Char8 as LB
 import Data.Functor (($>))
+import Data.List (foldl')
 import Data.Map.Strict (Map)
 import qualified Data.Map.Strict as M
+import Data.Maybe (fromMaybe)
+import Data.Word (Word32)
+import qualified Simplex.Messaging.Crypto as C
+import Simplex.Messaging.Encoding
 import Simplex.Messaging.Encoding.String
+import Simplex.Messaging.Parsers (parseAll)
 import Simplex.Messaging.Protocol
 import Simplex.Messaging.Server.QueueStore
 import Simplex.Messaging.Transport.Buffer (trimCR)
@@ -46,7 +62,15 @@ import System.IO
 -- constructors are not exported, openWriteStoreLog and openReadStoreLog should be used instead
 data StoreLog (a :: IOMode) where
   ReadStoreLog :: FilePath -> Handle -> StoreLog 'ReadMode
-  WriteStoreLog :: FilePath -> Handle -> StoreLog 'WriteMode
+  WriteStoreLog :: FilePath -> StoreLogFormat -> Handle -> StoreLog 'WriteMode
+
+-- | Text log has one record per line.
+-- Binary log has a header followed by segments, each segment has record count and payload length (Word32),
+-- 8 bytes of SHA256 hash of the payload and the records in binary encoding.
+-- The compacted log is written in large segments that are parsed concurrently on startup,
+-- each new record is appended as a separate segment.
+data StoreLogFormat = SLFText | SLFBinary
+  deriving (Eq, Show)
 
 data StoreLogRecord
   = CreateQueue QueueRec
@@ -95,6 +119,34 @@ instance StrEncoding QueueRec where
     updatedAt <- optional $ " updated_at=" *> strP
     pure QueueRec {recipientId, recipientKey, rcvDhSecret, senderId, senderKey, sndSecure, notifier, status = QueueActive, updatedAt}
 
+instance Encoding QueueRec where
+  smpEncode QueueRec {recipientId, recipientKey, rcvDhSecret, senderId, senderKey, sndSecure, notifier, updatedAt} =
+    smpEncode (recipientId, recipientKey, rcvDhSecret, senderId, senderKey, sndSecure, notifier, updatedAt)
+  smpP = do
+    (recipientId, recipientKey, rcvDhSecret, senderId, senderKey, sndSecure, notifier, updatedAt) <- smpP
+    pure QueueRec {recipientId, recipientKey, rcvDhSecret, senderId, senderKey, sndSecure, notifier, status = QueueActive, updatedAt}
+
+instance Encoding SLRTag where
+  smpEncode = \case
+    CreateQueue_ -> "C"
+    SecureQueue_ -> "S"
+    AddNotifier_ -> "N"
+    SuspendQueue_ -> "O"
+    DeleteQueue_ -> "D"
+    DeleteNotifier_ -> "X"
+    UpdateTime_ -> "T"
+
+  smpP =
+    A.anyChar >>= \case
+      'C' -> pure CreateQueue_
+      'S' -> pure SecureQueue_
+      'N' -> pure AddNotifier_
+      'O' -> pure SuspendQueue_
+      'D' -> pure DeleteQueue_
+      'X' -> pure DeleteNotifier_
+      'T' -> pure UpdateTime_
+      c -> fail $ "invalid log record tag: " <> show c
+
 instance StrEncoding SLRTag where
   strEncode = \case
     CreateQueue_ -> "CREATE"
@@ -136,11 +188,63 @@ instance StrEncoding StoreLogRecord where
       DeleteNotifier_ -> DeleteNotifier <$> strP
       UpdateTime_ -> UpdateTime <$> strP_ <*> strP
 
+instance Encoding StoreLogRecord where
+  smpEncode = \case
+    CreateQueue q -> smpEncode (CreateQueue_, q)
+    SecureQueue rId sKey -> smpEncode (SecureQueue_, rId, sKey)
+    AddNotifier rId ntfCreds -> smpEncode (AddNotifier_, rId, ntfCreds)
+    SuspendQueue rId -> smpEncode (SuspendQueue_, rId)
+    DeleteQueue rId -> smpEncode (DeleteQueue_, rId)
+    DeleteNotifier rId -> smpEncode (DeleteNotifier_, rId)
+    UpdateTime rId t -> smpEncode (UpdateTime_, rId, t)
+
+  smpP =
+    smpP >>= \case
+      CreateQueue_ -> CreateQueue <$> smpP
+      SecureQueue_ -> SecureQueue <$> smpP <*> smpP
+      AddNotifier_ -> AddNotifier <$> smpP <*> smpP
+      SuspendQueue_ -> SuspendQueue <$> smpP
+      DeleteQueue_ -> DeleteQueue <$> smpP
+      DeleteNotifier_ -> DeleteNotifier <$> smpP
+      UpdateTime_ -> UpdateTime <$> smpP <*> smpP
+
+binaryLogHeader :: ByteString
+binaryLogHeader = "#SMPLOG1"
+
+-- | records per segment in the compacted binary log
+segmentRecords :: Int
+segmentRecords = 4096
+
+segmentHeaderSize :: Int
+segmentHeaderSize = 16
+
+segmentHash :: ByteString -> ByteString
+segmentHash = B.take 8 . C.sha256Hash
+
+encodeSegment :: [ByteString] -> ByteString
+encodeSegment rs = smpEncode (count, len) <> segmentHash payload <> payload
+  where
+    payload = B.concat rs
+    count = fromIntegral (length rs) :: Word32
+    len = fromIntegral (B.length payload) :: Word32
+
 openWriteStoreLog :: FilePath -> IO (StoreLog 'WriteMode)
-openWriteStoreLog f = do
+openWriteStoreLog = openWriteStoreLog_ SLFText
+
+openWriteBinaryStoreLog :: FilePath -> IO (StoreLog 'WriteMode)
+openWriteBinaryStoreLog = openWriteStoreLog_ SLFBinary
+
+openWriteStoreLog_ :: StoreLogFormat -> FilePath -> IO (StoreLog 'WriteMode)
+openWriteStoreLog_ fmt f = do
   h <- openFile f WriteMode
-  hSetBuffering h LineBuffering
-  pure $ WriteStoreLog f h
+  case fmt of
+    SLFText -> hSetBuffering h LineBuffering
+    SLFBinary -> do
+      hSetBinaryMode h True
+      hSetBuffering h $ BlockBuffering Nothing
+      B.hPut h binaryLogHeader
+      hFlush h
+  pure $ WriteStoreLog f fmt h
 
 openReadStoreLog :: FilePath -> IO (StoreLog 'ReadMode)
 openReadStoreLog f = do
@@ -149,71 +253,160 @@ openReadStoreLog f = do
 
 storeLogFilePath :: StoreLog a -> FilePath
 storeLogFilePath = \case
-  WriteStoreLog f _ -> f
+  WriteStoreLog f _ _ -> f
   ReadStoreLog f _ -> f
 
+storeLogFormat :: StoreLog 'WriteMode -> StoreLogFormat
+storeLogFormat (WriteStoreLog _ fmt _) = fmt
+
 closeStoreLog :: StoreLog a -> IO ()
 closeStoreLog = \case
-  WriteStoreLog _ h -> hClose h
+  WriteStoreLog _ _ h -> hClose h
   ReadStoreLog _ h -> hClose h
 
+-- | Writes the record to the text log, it should not be used with the binary log.
 writeStoreLogRecord :: StrEncoding r => StoreLog 'WriteMode -> r -> IO ()
-writeStoreLogRecord (WriteStoreLog _ h) r = do
+writeStoreLogRecord (WriteStoreLog _ _ h) r = do
   B.hPut h $ strEncode r `B.snoc` '\n' -- hPutStrLn makes write non-atomic for length > 1024
   hFlush h
 
+writeQueueLogRecord :: StoreLog 'WriteMode -> StoreLogRecord -> IO ()
+writeQueueLogRecord s@(WriteStoreLog _ fmt h) r = case fmt of
+  SLFText -> writeStoreLogRecord s r
+  SLFBinary -> do
+    B.hPut h $ encodeSegment [smpEncode r]
+    hFlush h
+
 logCreateQueue :: StoreLog 'WriteMode -> QueueRec -> IO ()
-logCreateQueue s = writeStoreLogRecord s . CreateQueue
+logCreateQueue s = writeQueueLogRecord s . CreateQueue
 
 logSecureQueue :: StoreLog 'WriteMode -> QueueId -> SndPublicAuthKey -> IO ()
-logSecureQueue s qId sKey = writeStoreLogRecord s $ SecureQueue qId sKey
+logSecureQueue s qId sKey = writeQueueLogRecord s $ SecureQueue qId sKey
 
 logAddNotifier :: StoreLog 'WriteMode -> QueueId -> NtfCreds -> IO ()
-logAddNotifier s qId ntfCreds = writeStoreLogRecord s $ AddNotifier qId ntfCreds
+logAddNotifier s qId ntfCreds = writeQueueLogRecord s $ AddNotifier qId ntfCreds
 
 logSuspendQueue :: StoreLog 'WriteMode -> QueueId -> IO ()
-logSuspendQueue s = writeStoreLogRecord s . SuspendQueue
+logSuspendQueue s = writeQueueLogRecord s . SuspendQueue
 
 logDeleteQueue :: StoreLog 'WriteMode -> QueueId -> IO ()
-logDeleteQueue s = writeStoreLogRecord s . DeleteQueue
+logDeleteQueue s = writeQueueLogRecord s . DeleteQueue
 
 logDeleteNotifier :: StoreLog 'WriteMode -> QueueId -> IO ()
-logDeleteNotifier s = writeStoreLogRecord s . DeleteNotifier
+logDeleteNotifier s = writeQueueLogRecord s . DeleteNotifier
 
 logUpdateQueueTime :: StoreLog 'WriteMode -> QueueId -> RoundedSystemTime -> IO ()
-logUpdateQueueTime s qId t = writeStoreLogRecord s $ UpdateTime qId t
+logUpdateQueueTime s qId t = writeQueueLogRecord s $ UpdateTime qId t
 
+-- | Reads the log and writes the compacted log in the same format.
 readWriteStoreLog :: FilePath -> IO (Map RecipientId QueueRec, StoreLog 'WriteMode)
-readWriteStoreLog f = do
-  qs <- ifM (doesFileExist f) readQS (pure M.empty)
-  s <- openWriteStoreLog f
+readWriteStoreLog = readWriteStoreLog_ Nothing
+
+-- | Compacts the log converting it to the passed format, the server must not be running.
+convertStoreLog :: StoreLogFormat -> FilePath -> IO ()
+convertStoreLog fmt f = readWriteStoreLog_ (Just fmt) f >>= closeStoreLog . snd
+
+readWriteStoreLog_ :: Maybe StoreLogFormat -> FilePath -> IO (Map RecipientId QueueRec, StoreLog 'WriteMode)
+readWriteStoreLog_ fmt_ f = do
+  (qs, fmt) <- ifM (doesFileExist f) readQS (pure (M.empty, SLFText))
+  s <- openWriteStoreLog_ (fromMaybe fmt fmt_) f
   writeQueues s qs
   pure (qs, s)
   where
     readQS = readQueues f <* renameFile f (f <> ".bak")
 
 writeQueues :: StoreLog 'WriteMode -> Map RecipientId QueueRec -> IO ()
-writeQueues s = mapM_ $ \q -> when (active q) $ logCreateQueue s q
+writeQueues s@(WriteStoreLog _ fmt h) qs = case fmt of
+  SLFText -> mapM_ (logCreateQueue s) qs'
+  SLFBinary -> do
+    mapM_ (B.hPut h . encodeSegment) $ segments $ map (smpEncode . CreateQueue) qs'
+    hFlush h
   where
+    qs' = filter active $ M.elems qs
     active QueueRec {status} = status == QueueActive
+    segments rs = case splitAt segmentRecords rs of
+      ([], _) -> []
+      (seg, rs') -> seg : segments rs'
+
+readQueues :: FilePath -> IO (Map RecipientId QueueRec, StoreLogFormat)
+readQueues f = do
+  hdr <- withFile f ReadMode (`B.hGet` B.length binaryLogHeader)
+  if hdr == binaryLogHeader
+    then (,SLFBinary) <$> readBinaryQueues f
+    else (,SLFText) <$> readTextQueues f
 
-readQueues :: FilePath -> IO (Map RecipientId QueueRec)
-readQueues f = foldM processLine M.empty . LB.lines =<< LB.readFile f
+readTextQueues :: FilePath -> IO (Map RecipientId QueueRec)
+readTextQueues f = foldM processLine M.empty . LB.lines =<< LB.readFile f
   where
     processLine :: Map RecipientId QueueRec -> LB.ByteString -> IO (Map RecipientId QueueRec)
     processLine m s' = case strDecode $ trimCR s of
-      Right r -> pure $ procLogRecord r
+      Right r -> pure $ procLogRecord m r
       Left e -> printError e $> m
       where
         s = LB.toStrict s'
-        procLogRecord :: StoreLogRecord -> Map RecipientId QueueRec
-        procLogRecord = \case
-          CreateQueue q -> M.insert (recipientId q) q m
-          SecureQueue qId sKey -> M.adjust (\q -> q {senderKey = Just sKey}) qId m
-          AddNotifier qId ntfCreds -> M.adjust (\q -> q {notifier = Just ntfCreds}) qId m
-          SuspendQueue qId -> M.adjust (\q -> q {status = QueueOff}) qId m
-          DeleteQueue qId -> M.delete qId m
-          DeleteNotifier qId -> M.adjust (\q -> q {notifier = Nothing}) qId m
-          UpdateTime qId t -> M.adjust (\q -> q {updatedAt = Just t}) qId m
         printError :: String -> IO ()
         printError e = B.putStrLn $ "Error parsing log: " <> B.pack e <> " - " <> s
+
+-- | The file is read into one buffer, and the records are parsed from its slices,
+-- with the segments split between the available cores.
+readBinaryQueues :: FilePath -> IO (Map RecipientId QueueRec)
+readBinaryQueues f = do
+  (segs, err_) <- splitSegments . B.drop (B.length binaryLogHeader) <$> B.readFile f
+  mapM_ (printError "incomplete log segment") err_
+  n <- getNumCapabilities
+  rss <- mapConcurrently (mapM (E.evaluate . decodeSegment)) $ groups n segs
+  foldM processSegment M.empty $ concat rss
+  where
+    groups n segs =
+      let k = max 1 $ (length segs + n - 1) `div` n
+          go xs = case splitAt k xs of
+            ([], _) -> []
+            (g, xs') -> g : go xs'
+       in go segs
+    processSegment m = \case
+      Right rs -> pure $ foldl' procLogRecord m rs
+      Left e -> printError "error parsing log segment" e $> m
+    printError :: String -> String -> IO ()
+    printError s e = putStrLn $ s <> ": " <> e
+
+-- | Splits the log into segments (record count, hash and payload),
+-- returning the error if the last segment is incomplete, e.g. when the server was interrupted while writing.
+splitSegments :: ByteString -> ([(Int, ByteString, ByteString)], Maybe String)
+splitSegments = go []
+  where
+    go acc s
+      | B.null s = (reverse acc, Nothing)
+      | B.length s < segmentHeaderSize = (reverse acc, Just "no segment header")
+      | otherwise = case smpDecode (B.take 8 s) :: Either String (Word32, Word32) of
+          Right (count, len)
+            | B.length s' >= len' -> go ((fromIntegral count, B.take 8 s'', B.take len' s') : acc) (B.drop len' s')
+            | otherwise -> (reverse acc, Just "no segment payload")
+            where
+              s'' = B.drop 8 s
+              s' = B.drop 8 s''
+              len' = fromIntegral len
+          Left e -> (reverse acc, Just e)
+
+decodeSegment :: (Int, ByteString, ByteString) -> Either String [StoreLogRecord]
+decodeSegment (count, hash, payload)
+  | segmentHash payload /= hash = Left "invalid segment hash"
+  | otherwise = map copyIds <$> parseAll (A.count count smpP) payload
+  where
+    -- parsed IDs are slices of the whole log, they are copied as they are kept in the queue map
+    copyIds = \case
+      CreateQueue q@QueueRec {recipientId, senderId, notifier} ->
+        CreateQueue q {recipientId = copyId recipientId, senderId = copyId senderId, notifier = copyNtfId <$> notifier}
+      AddNotifier qId ntfCreds -> AddNotifier qId $ copyNtfId ntfCreds
+      r -> r
+    copyNtfId c@NtfCreds {notifierId} = c {notifierId = copyId notifierId}
+    copyId (EntityId s) = EntityId $ B.copy s
+
+procLogRecord :: Map RecipientId QueueRec -> StoreLogRecord -> Map RecipientId QueueRec
+procLogRecord m = \case
+  CreateQueue q -> M.insert (recipientId q) q m
+  SecureQueue qId sKey -> M.adjust (\q -> q {senderKey = Just sKey}) qId m
+  AddNotifier qId ntfCreds -> M.adjust (\q -> q {notifier = Just ntfCreds}) qId m
+  SuspendQueue qId -> M.adjust (\q -> q {status = QueueOff}) qId m
+  DeleteQueue qId -> M.delete qId m
+  DeleteNotifier qId -> M.adjust (\q -> q {notifier = Nothing}) qId m
+  UpdateTime qId t -> M.adjust (\q -> q {updatedAt = Just t}) qId m
@@ -74,12 +74,15 @@ module Simplex.Messaging.Transport
     THandle (..),
     THandleParams (..),
     THandleAuth (..),
+    newSessionDhCache,
+    clearSessionDhCache,
     TSbChainKeys (..),
     TransportError (..),
     HandshakeError (..),
     smpServerHandshake,
     smpClientHandshake,
     tPutBlock,
+    tPutBlockWith,
     tGetBlock,
     sendHandshake,
     getHandshake,
@@ -89,7 +92,7 @@ where
 
 import Control.Applicative (optional)
 import Control.Concurrent.STM
-import Control.Monad (forM, (<$!>))
+import Control.Monad (forM, forM_, (<$!>))
 import Control.Monad.Except
 import Control.Monad.IO.Class
 import Control.Monad.Trans.Except (throwE)
@@ -100,13 +103,16 @@ import Data.Bifunctor (bimap, first)
 import Data.Bitraversable (bimapM)
 import Data.ByteString.Char8 (ByteString)
 import qualified Data.ByteString.Char8 as B
+import qualified Data.ByteString.Internal as BI
 import qualified Data.ByteString.Lazy.Char8 as LB
+import Data.ByteString.Unsafe (unsafeUseAsCString, unsafeUseAsCStringLen)
 import Data.Default (def)
 import Data.Functor (($>))
 import Data.Tuple (swap)
 import Data.Typeable (Typeable)
 import Data.Version (showVersion)
 import Data.Word (Word16)
+import Foreign (Ptr, Word8, castPtr, copyBytes, fillBytes, plusPtr)
 import qualified Data.X509 as X
 import qualified Data.X509.Validation as XV
 import GHC.IO.Handle.Internals (ioe_EOF)
@@ -115,6 +121,8 @@ import qualified Network.TLS as T
 import qualified Network.TLS.Extra as TE
 import qualified Paths_simplexmq as SMQ
 import qualified Simplex.Messaging.Crypto as C
+import Simplex.Messaging.Crypto.SecretBoxStream (sbStreamAuth, sbStreamEncrypt, withSbStream)
+import Simplex.Messaging.Crypto.X25519Cache (X25519Cache, clearX25519Cache, newX25519Cache)
 import Simplex.Messaging.Encoding
 import Simplex.Messaging.Parsers (dropPrefix, parseRead1, sumTypeJSON)
 import Simplex.Messaging.Transport.Buffer
@@ -418,15 +426,31 @@ data THandleAuth (p :: TransportPeer) where
   THAuthClient ::
     { serverPeerPubKey :: C.PublicKeyX25519, -- used by the client to combine with client's private per-queue key
       serverCertKey :: (X.CertificateChain, X.SignedExact X.PubKey), -- the key here is serverPeerPubKey signed with server certificate
-      sessSecret :: Maybe C.DhSecretX25519 -- session secret (will be used in SMP proxy only)
+      sessSecret :: Maybe C.DhSecretX25519, -- session secret (will be used in SMP proxy only)
+      dhCache :: X25519Cache -- shared secrets of serverPeerPubKey with client's per-queue keys
     } ->
     THandleAuth 'TClient
   THAuthServer ::
     { serverPrivKey :: C.PrivateKeyX25519, -- used by the server to combine with client's public per-queue key
-      sessSecret' :: Maybe C.DhSecretX25519 -- session secret (will be used in SMP proxy only)
+      sessSecret' :: Maybe C.DhSecretX25519, -- session secret (will be used in SMP proxy only)
+      dhCache' :: X25519Cache -- shared secrets of serverPrivKey with client's per-queue keys
     } ->
     THandleAuth 'TServer
 
+-- | The maximum number of X25519 shared secrets cached per session.
+-- Cache memory is allocated on demand, so it only grows to this size in the sessions with many queues.
+sessionDhCacheSize :: Int
+sessionDhCacheSize = 1024
+
+newSessionDhCache :: IO X25519Cache
+newSessionDhCache = newX25519Cache sessionDhCacheSize
+
+-- | Wipes cached shared secrets, it should be called when the session ends.
+clearSessionDhCache :: THandleAuth p -> IO ()
+clearSessionDhCache = \case
+  THAuthClient {dhCache} -> clearX25519Cache dhCache
+  THAuthServer {dhCache'} -> clearX25519Cache dhCache'
+
 data TSbChainKeys = TSbChainKeys
   { sndKey :: TVar C.SbChainKey,
     rcvKey :: TVar C.SbChainKey
@@ -534,13 +558,29 @@ instance Encoding TransportError where
 
 -- | Pad and send block to SMP transport.
 tPutBlock :: Transport c => THandle v c p -> ByteString -> IO (Either TransportError ())
-tPutBlock THandle {connection = c, params = THandleParams {blockSize, encryptBlock}} block = do
-  block_ <- case encryptBlock of
-    Just TSbChainKeys {sndKey} -> do
-      (sk, nonce) <- atomically $ stateTVar sndKey C.sbcHkdf
-      pure $ C.sbEncrypt sk nonce block (blockSize - 16)
-    Nothing -> pure $ C.pad block blockSize
-  bimapM (const $ pure TELargeMsg) (cPut c) block_
+tPutBlock th s = tPutBlockWith th (B.length s) $ \p ->
+  unsafeUseAsCStringLen s $ \(sp, len) -> copyBytes p (castPtr sp) len
+
+-- | Send block to SMP transport, the content of the given length is written by the passed function
+-- directly to the buffer of the padded block, which is then encrypted in place.
+-- The same block is sent as by tPutBlock with the content as ByteString.
+tPutBlockWith :: Transport c => THandle v c p -> Int -> (Ptr Word8 -> IO ()) -> IO (Either TransportError ())
+tPutBlockWith THandle {connection = c, params = THandleParams {blockSize, encryptBlock}} len write
+  | len > paddedLen - 2 = pure $ Left TELargeMsg
+  | otherwise = do
+      block <- BI.create blockSize $ \p -> do
+        let msgPtr = p `plusPtr` tagLen
+        pokeWord16 msgPtr $ fromIntegral len
+        write $ msgPtr `plusPtr` 2
+        fillBytes (msgPtr `plusPtr` (2 + len)) (BI.c2w '#') (paddedLen - 2 - len)
+        forM_ encryptBlock $ \TSbChainKeys {sndKey} -> do
+          (sk, nonce) <- atomically $ stateTVar sndKey C.sbcHkdf
+          tag <- withSbStream sk nonce $ \st -> sbStreamEncrypt st msgPtr paddedLen >> sbStreamAuth st
+          unsafeUseAsCString tag $ \tagPtr -> copyBytes p (castPtr tagPtr) tagLen
+      Right <$> cPut c block
+  where
+    tagLen = maybe 0 (const C.authTagSize) encryptBlock
+    paddedLen = blockSize - tagLen
 
 -- | Receive block from SMP transport.
 tGetBlock :: Transport c => THandle v c p -> IO (Either TransportError ByteString)
@@ -601,13 +641,15 @@ smpClientHandshake c ks_ keyHash@(C.KeyHash kh) smpVRange = do
 
 smpTHandleServer :: forall c. THandleSMP c 'TServer -> VersionSMP -> VersionRangeSMP -> C.PrivateKeyX25519 -> Maybe C.PublicKeyX25519 -> IO (THandleSMP c 'TServer)
 smpTHandleServer th v vr pk k_ = do
-  let thAuth = Just THAuthServer {serverPrivKey = pk, sessSecret' = (`C.dh'` pk) <$!> k_}
+  dhCache' <- newSessionDhCache
+  let thAuth = Just THAuthServer {serverPrivKey = pk, sessSecret' = (`C.dh'` pk) <$!> k_, dhCache'}
   be <- blockEncryption th v thAuth
   pure $ smpTHandle_ th v vr thAuth $ uncurry TSbChainKeys <$> be
 
 smpTHandleClient :: forall c. THandleSMP c 'TClient -> VersionSMP -> VersionRangeSMP -> Maybe C.PrivateKeyX25519 -> Maybe (C.PublicKeyX25519, (X.CertificateChain, X.SignedExact X.PubKey)) -> IO (THandleSMP c 'TClient)
 smpTHandleClient th v vr pk_ ck_ = do
-  let thAuth = (\(k, ck) -> THAuthClient {serverPeerPubKey = k, serverCertKey = forceCertChain ck, sessSecret = C.dh' k <$!> pk_}) <$!> ck_
+  dhCache <- newSessionDhCache
+  let thAuth = (\(k, ck) -> THAuthClient {serverPeerPubKey = k, serverCertKey = forceCertChain ck, sessSecret = C.dh' k <$!> pk_, dhCache}) <$!> ck_
   be <- blockEncryption th v thAuth
   -- swap is needed to use client's sndKey as server's rcvKey and vice versa
   pure $ smpTHandle_ th v vr thAuth $ uncurry TSbChainKeys . swap <$> be
@@ -14,15 +14,19 @@ fileBlockSize :: Int
 fileBlockSize = 16384
 
 hReceiveFile :: (Int -> IO ByteString) -> Handle -> Word32 -> IO Int64
-hReceiveFile _ _ 0 = pure 0
-hReceiveFile getBody h size = get $ fromIntegral size
+hReceiveFile getBody h = receiveFileBlocks getBody (B.hPut h)
+
+-- | Passes received blocks to the action, returns the difference between received and expected sizes.
+receiveFileBlocks :: (Int -> IO ByteString) -> (ByteString -> IO ()) -> Word32 -> IO Int64
+receiveFileBlocks _ _ 0 = pure 0
+receiveFileBlocks getBody action size = get $ fromIntegral size
   where
     get sz = do
       ch <- getBody fileBlockSize
       let chSize = fromIntegral $ B.length ch
       if
         | chSize > sz -> pure (chSize - sz)
-        | chSize > 0 -> B.hPut h ch >> get (sz - chSize)
+        | chSize > 0 -> action ch >> get (sz - chSize)
         | otherwise -> pure (-sz)
 
 hSendFile :: Handle -> (Builder -> IO ()) -> Word32 -> IO ()
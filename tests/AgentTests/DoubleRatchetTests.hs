@@ -22,6 +22,7 @@ import Data.Aeson (FromJSON, ToJSON, (.=))
 import qualified Data.Aeson as J
 import Data.ByteString.Char8 (ByteString)
 import qualified Data.ByteString.Char8 as B
+import qualified Data.ByteString.Lazy as LB
 import qualified Data.Map.Strict as M
 import Data.Type.Equality
 import Simplex.Messaging.Crypto (Algorithm (..), AlgorithmI, CryptoError, DhAlgorithm)
@@ -46,6 +47,9 @@ doubleRatchetTests = do
       testAlgs testRatchetJSON
       testVersionJSON
     it "should decode v2 Ratchet with default field values" $ testDecodeV2RatchetJSON
+    it "should encode/decode ratchet in binary format" $ do
+      testAlgs $ testRatchetBinary initRatchets
+      testAlgs $ testRatchetBinary initRatchetsKEMAccepted
     it "should agree the same ratchet parameters" $ testAlgs testX3dh
     it "should agree the same ratchet parameters with version 1" $ testAlgs testX3dhV1
   describe "post-quantum hybrid KEM double-ratchet algorithm" $ do
@@ -152,10 +156,6 @@ deriving instance Eq (SndRatchet a)
 
 deriving instance Eq RcvRatchet
 
-deriving instance Eq RatchetKEM
-
-deriving instance Eq RatchetKEMAccepted
-
 deriving instance Eq RatchetInitParams
 
 deriving instance Eq RatchetKey
@@ -348,6 +348,21 @@ testRatchetJSON _ = do
   testEncodeDecode alice
   testEncodeDecode bob
 
+testRatchetBinary :: forall a. (AlgorithmI a, DhAlgorithm a) => IO (Ratchet a, Ratchet a, Encrypt a, Decrypt a, EncryptDecryptSpec a) -> C.SAlgorithm a -> IO ()
+testRatchetBinary initRatchets_ _ = do
+  (alice, bob, _, _, _) <- initRatchets_
+  testDecode alice
+  testDecode bob
+  -- JSON saved by the previous versions
+  decodeRatchet (LB.toStrict $ J.encode alice) `shouldBe` Right alice
+  where
+    testDecode rc = do
+      smpDecode (smpEncode rc) `shouldBe` Right rc
+      decodeRatchet (smpEncode rc) `shouldBe` Right rc
+      let rc' = rc {rcKEM = Nothing}
+      smpDecode (smpEncode rc') `shouldBe` Right rc'
+      smpDecode (smpEncode $ rcKEM rc) `shouldBe` Right (rcKEM rc)
+
 testVersionJSON :: IO ()
 testVersionJSON = do
   testEncodeDecode $ rv 1 1
@@ -10,21 +10,25 @@
 {-# LANGUAGE RecordWildCards #-}
 {-# LANGUAGE ScopedTypeVariables #-}
 {-# LANGUAGE StandaloneDeriving #-}
+{-# LANGUAGE TypeApplications #-}
 {-# OPTIONS_GHC -Wno-orphans #-}
 {-# OPTIONS_GHC -fno-warn-ambiguous-fields #-}
 
 module AgentTests.SQLiteTests where
 
+import AgentTests.DoubleRatchetTests (initRatchets, initRatchetsKEMAccepted)
 import AgentTests.EqInstances ()
 import Control.Concurrent.Async (concurrently_)
 import Control.Concurrent.MVar
 import Control.Concurrent.STM
 import Control.Exception (SomeException)
-import Control.Monad (replicateM_)
+import Control.Monad (forM_, replicateM_)
 import Control.Monad.Trans.Except
 import Crypto.Random (ChaChaDRG)
+import qualified Data.Aeson as J
 import Data.ByteArray (ScrubbedBytes)
 import Data.ByteString.Char8 (ByteString)
+import qualified Data.ByteString.Lazy as LB
 import Data.List (isInfixOf)
 import qualified Data.Text as T
 import Data.Text.Encoding (encodeUtf8)
@@ -49,6 +53,7 @@ import qualified Simplex.Messaging.Crypto as C
 import Simplex.Messaging.Crypto.File (CryptoFile (..))
 import Simplex.Messaging.Crypto.Ratchet (InitialKeys (..), pattern PQSupportOn)
 import qualified Simplex.Messaging.Crypto.Ratchet as CR
+import Simplex.Messaging.Encoding (smpEncode)
 import Simplex.Messaging.Encoding.String (StrEncoding (..))
 import Simplex.Messaging.Protocol (EntityId (..), SubscriptionMode (..), pattern VersionSMPC)
 import qualified Simplex.Messaging.Protocol as SMP
@@ -126,6 +131,9 @@ storeTests = do
           describe "setSndQueueStatus" $ do
             testSetSndQueueStatus
           testSetQueueStatusDuplex
+      describe "Ratchets" $ do
+        testStoreRatchetJSON
+        testStoreRatchetBinary
       describe "Msg management" $ do
         describe "create Msg" $ do
           testCreateRcvMsg
@@ -495,6 +503,63 @@ testSetQueueStatusDuplex =
     getConn db "conn1"
       `shouldReturn` Right (SomeConn SCDuplex (DuplexConnection cData1 [rq'] [sq']))
 
+testStoreRatchetJSON :: SpecWith SQLiteStore
+testStoreRatchetJSON =
+  it "should save ratchet state with KEM state as JSON" . withStoreTransaction $ \db -> do
+    g <- C.newRandom
+    Right (connId, _) <- createRcvConn db g cData1 rcvQueue1 SCMInvitation
+    (rc, rc2, _, _, _) <- initRatchetsKEMAccepted @C.X448
+    createRatchet db connId rc
+    getRatchet db connId `shouldReturn` Right rc
+    getRatchetState db connId `shouldReturn` (LB.toStrict $ J.encode rc, Nothing)
+    let rc' = rc {CR.rcKEM = CR.rcKEM rc2}
+    updateRatchet db connId rc' CR.SMDNoChange
+    getRatchet db connId `shouldReturn` Right rc'
+    getRatchetState db connId `shouldReturn` (LB.toStrict $ J.encode rc', Nothing)
+    let rc'' = rc' {CR.rcKEM = Nothing}
+    updateRatchet db connId rc'' CR.SMDNoChange
+    getRatchet db connId `shouldReturn` Right rc''
+    getRatchetState db connId `shouldReturn` (LB.toStrict $ J.encode rc'', Nothing)
+
+testStoreRatchetBinary :: SpecWith SQLiteStore
+testStoreRatchetBinary =
+  it "should read ratchets saved in binary format with KEM state saved separately" . withStoreTransaction $ \db -> do
+    g <- C.newRandom
+    Right (connId, _) <- createRcvConn db g cData1 rcvQueue1 SCMInvitation
+    (rc, _, _, _, _) <- initRatchetsKEMAccepted @C.X448
+    (rcNoKEM, _, _, _, _) <- initRatchets @C.X448
+    createRatchet db connId rc
+    saveBinaryState db connId rc
+    getRatchet db connId `shouldReturn` Right rc
+    -- KEM state is only used with binary state
+    createRatchet db connId rcNoKEM
+    getRatchet db connId `shouldReturn` Right rcNoKEM
+    saveBinaryState db connId rcNoKEM
+    getRatchet db connId `shouldReturn` Right rcNoKEM
+    -- saved as JSON on update
+    updateRatchet db connId rc CR.SMDNoChange
+    getRatchet db connId `shouldReturn` Right rc
+    fst <$> getRatchetState db connId `shouldReturn` LB.toStrict (J.encode rc)
+  where
+    saveBinaryState db connId rc = do
+      DB.execute db "UPDATE ratchets SET ratchet_state = ? WHERE conn_id = ?" (smpEncode rc {CR.rcKEM = Nothing}, connId)
+      DB.execute db "DELETE FROM ratchet_kem_states WHERE conn_id = ?" (Only connId)
+      forM_ (CR.rcKEM rc) $ \kem -> DB.execute db "INSERT INTO ratchet_kem_states (conn_id, kem_state) VALUES (?, ?)" (connId, kem)
+
+getRatchetState :: DB.Connection -> ConnId -> IO (ByteString, Maybe ByteString)
+getRatchetState db connId = do
+  [(state, kem_)] <-
+    DB.query
+      db
+      [sql|
+        SELECT r.ratchet_state, k.kem_state
+        FROM ratchets r
+        LEFT JOIN ratchet_kem_states k ON k.conn_id = r.conn_id
+        WHERE r.conn_id = ?
+      |]
+      (Only connId)
+  pure (state, kem_)
+
 hw :: ByteString
 hw = encodeUtf8 "Hello world!"
 
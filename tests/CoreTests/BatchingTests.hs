@@ -14,6 +14,7 @@ import Control.Monad
 import Crypto.Random (ChaChaDRG)
 import qualified Data.ByteString as B
 import Data.ByteString.Char8 (ByteString)
+import Data.Either (rights)
 import qualified Data.List.NonEmpty as L
 import Data.Time.Clock.System (SystemTime, getSystemTime)
 import qualified Data.X509 as X
@@ -37,6 +38,7 @@ batchingTests = do
       it "should batch with 136 subscriptions per batch" testBatchSubscriptions
       it "should break on message that does not fit" testBatchWithMessage
       it "should break on large message" testBatchWithLargeMessage
+      it "should encode transmissions in the same way as tEncode" testBatchEncoding
   describe "batchTransmissions'" $ do
     describe "SMP v6 (previous)" $ do
       it "should batch with 106 subscriptions per batch" testClientBatchSubscriptionsV6
@@ -75,6 +77,22 @@ testBatchSubscriptions = do
   (n1, n2, n3) `shouldBe` (28, 136, 136)
   all lenOk [s1, s2, s3] `shouldBe` True
 
+testBatchEncoding :: IO ()
+testBatchEncoding = do
+  sessId <- atomically . C.randomBytes 32 =<< C.newRandom
+  subs1 <- replicateM 100 $ randomSUB sessId
+  send <- randomSEND sessId 8000
+  subs2 <- replicateM 200 $ randomSUB sessId
+  let cmds = subs1 <> [send] <> subs2
+      ts = rights cmds
+      batches1 = batchTransmissions False smpBlockSize $ L.fromList cmds
+  [s | TBTransmission s _ <- batches1] `shouldBe` map tEncode ts
+  let batches = batchTransmissions True smpBlockSize $ L.fromList cmds
+      ss = [s | TBTransmissions s _ _ <- batches]
+  length ss `shouldBe` length batches
+  map B.head ss `shouldBe` [fromIntegral n | TBTransmissions _ n _ <- batches]
+  B.concat (map B.tail ss) `shouldBe` B.concat (map (smpEncode . Large . tEncode) ts)
+
 testBatchWithMessageV6 :: IO ()
 testBatchWithMessageV6 = do
   sessId <- atomically . C.randomBytes 32 =<< C.newRandom
@@ -393,7 +411,8 @@ testTHandleAuth v g (C.APublicAuthKey a serverPeerPubKey) = case a of
     signKey <- either error pure $ C.x509ToPrivate (serverKey, []) >>= C.privKey @C.APrivateSignKey
     (serverAuthPub, _) <- atomically $ C.generateKeyPair @'C.X25519 g
     let serverCertKey = (X.CertificateChain [serverCert, ca], C.signX509 signKey $ C.toPubKey C.publicToX509 serverAuthPub)
-    pure $ Just THAuthClient {serverPeerPubKey, serverCertKey, sessSecret = Nothing}
+    dhCache <- newSessionDhCache
+    pure $ Just THAuthClient {serverPeerPubKey, serverCertKey, sessSecret = Nothing, dhCache}
   _ -> pure Nothing
 
 randomSENDCmdV6 :: ProtocolClient SMPVersion ErrorType BrokerMsg -> Int -> IO (PCTransmission ErrorType BrokerMsg)
@@ -0,0 +1,43 @@
+{-# LANGUAGE OverloadedStrings #-}
+
+module CoreTests.CompressionTests where
+
+import Control.Concurrent.Async (forConcurrently_)
+import qualified Data.ByteString.Char8 as B
+import Simplex.Messaging.Compression
+import Simplex.Messaging.Encoding
+import Simplex.Messaging.Parsers (parseAll)
+import Test.Hspec
+
+compressionTests :: Spec
+compressionTests = do
+  it "should pass through short messages" $ do
+    roundTrip "hello" (compress1 "hello") (const Nothing)
+    case compress1 "hello" of
+      Passthrough s -> s `shouldBe` "hello"
+      _ -> expectationFailure "expected passthrough"
+  it "should compress and decompress with reused contexts" $
+    forConcurrently_ [1 .. 32 :: Int] $ \i -> do
+      let msg = jsonMsg i
+          c = compress1 msg
+      B.length (smpEncode c) < B.length msg `shouldBe` True
+      roundTrip msg c (const Nothing)
+  it "should compress and decompress with dictionary" $ do
+    dict <- mkCompressionDict 1 $ B.concat $ map jsonMsg [100 .. 110]
+    let msg = jsonMsg 1
+        c = compressWithDict dict msg
+        getDict dId = if dId == dictId dict then Just dict else Nothing
+    B.length (smpEncode c) < B.length (smpEncode $ compress1 msg) `shouldBe` True
+    roundTrip msg c getDict
+    decompress1 c `shouldBe` Left "unknown compression dictionary: 1"
+  it "should decompress frame without content size to empty string" $
+    -- frame header: magic number, descriptor without content size, window descriptor
+    decompress1 (Compressed $ Large "\x28\xb5\x2f\xfd\x00\x00") `shouldBe` Right ""
+  where
+    jsonMsg :: Int -> B.ByteString
+    jsonMsg i = "{\"v\":\"1-2\",\"event\":\"x.msg.new\",\"params\":{\"content\":{\"type\":\"text\",\"text\":\"message " <> B.pack (show i) <> "\"},\"msgId\":\"" <> B.replicate 24 'a' <> "\"}}" <> B.replicate 100 ' '
+    roundTrip msg c getDict = do
+      let s = smpEncode c
+      Right c' <- pure $ parseAll smpP s
+      smpEncode (c' :: Compressed) `shouldBe` s
+      decompressWithDict getDict c' `shouldBe` Right msg
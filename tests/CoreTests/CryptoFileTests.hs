@@ -7,12 +7,17 @@ import Control.Concurrent.STM
 import Control.Monad.Except
 import Control.Monad.IO.Class
 import Crypto.Random (ChaChaDRG)
+import qualified Data.ByteString.Char8 as B
 import qualified Data.ByteString.Lazy as LB
 import GHC.IO.IOMode (IOMode (..))
+import Simplex.FileTransfer.Crypto (decryptVerifyChunks, encryptFile)
+import Simplex.FileTransfer.Types (FileHeader (..), authTagSize)
 import qualified Simplex.Messaging.Crypto as C
 import Simplex.Messaging.Crypto.File (CryptoFile (..), FTCryptoError (..))
 import qualified Simplex.Messaging.Crypto.File as CF
-import System.Directory (getFileSize)
+import qualified Simplex.Messaging.Crypto.Lazy as LC
+import Simplex.Messaging.Encoding
+import System.Directory (doesFileExist, getFileSize, removeFile)
 import Test.Hspec
 
 cryptoFileTests :: Spec
@@ -22,6 +27,7 @@ cryptoFileTests = do
   it "should write/get file" testWriteGetFile
   it "should put/read file" testPutReadFile
   it "should fail reading empty or small file" testSmallFile
+  it "should encrypt file for upload and decrypt it from chunks" testEncryptDecryptChunks
 
 testFilePath :: FilePath
 testFilePath = "tests/tmp/testcryptofile"
@@ -100,5 +106,39 @@ testSmallFile = do
   LB.writeFile testFilePath "123"
   runExceptT (CF.readFile file) `shouldReturn` Left FTCEInvalidFileSize
 
+testEncryptDecryptChunks :: IO ()
+testEncryptDecryptChunks = do
+  g <- C.newRandom
+  s <- atomically $ LB.fromStrict <$> C.randomBytes 2500001 g
+  srcFile <- atomically $ mkCryptoFile g
+  key <- atomically $ C.randomSbKey g
+  nonce <- atomically $ C.randomCbNonce g
+  let fileHdr = smpEncode FileHeader {fileName = "testfile", fileExtra = Nothing}
+      fileSize' = fromIntegral (B.length fileHdr) + LB.length s
+      encSize = 8 + fileSize' + 100003 + authTagSize
+      encFile = "tests/tmp/testencfile"
+      chunkPaths = ["tests/tmp/testencfile.1", "tests/tmp/testencfile.2"]
+      destFile = CF.plain "tests/tmp/testdecfile"
+  runRight_ $ do
+    CF.writeFile srcFile s
+    encryptFile srcFile fileHdr key nonce fileSize' encSize encFile
+  -- the same as sequential encryption
+  Right encrypted <- pure $ LC.sbEncryptTailTag key nonce (LB.fromStrict fileHdr <> s) fileSize' (encSize - authTagSize)
+  LB.readFile encFile `shouldReturn` encrypted
+  let (ch1, ch2) = LB.splitAt 1000000 encrypted
+  mapM_ (uncurry LB.writeFile) $ zip chunkPaths [ch1, ch2]
+  runRight_ $ do
+    CryptoFile path _ <- decryptVerifyChunks encSize chunkPaths (Just $ LC.sha512Hash encrypted) key nonce $ \_ -> pure destFile
+    liftIO $ LB.readFile path `shouldReturn` s
+  doesFileExist "tests/tmp/testdecfile.tmp" `shouldReturn` False
+  removeFile "tests/tmp/testdecfile"
+  runExceptT (decryptVerifyChunks encSize chunkPaths (Just "bad digest") key nonce $ \_ -> pure destFile) `shouldReturn` Left FTCEInvalidDigest
+  doesFileExist "tests/tmp/testdecfile" `shouldReturn` False
+  doesFileExist "tests/tmp/testdecfile.tmp" `shouldReturn` False
+  LB.writeFile (chunkPaths !! 1) $ LB.init ch2 <> LB.singleton (LB.last ch2 + 1)
+  runExceptT (decryptVerifyChunks encSize chunkPaths Nothing key nonce $ \_ -> pure destFile) `shouldReturn` Left FTCEInvalidAuthTag
+  doesFileExist "tests/tmp/testdecfile" `shouldReturn` False
+  doesFileExist "tests/tmp/testdecfile.tmp" `shouldReturn` False
+
 mkCryptoFile :: TVar ChaChaDRG -> STM CryptoFile
 mkCryptoFile g = CryptoFile testFilePath . Just <$> CF.randomArgs g
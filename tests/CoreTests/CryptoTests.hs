@@ -1,16 +1,30 @@
+{-# LANGUAGE DataKinds #-}
 {-# LANGUAGE GADTs #-}
 {-# LANGUAGE OverloadedStrings #-}
 {-# LANGUAGE ScopedTypeVariables #-}
+{-# LANGUAGE TupleSections #-}
+{-# LANGUAGE TypeApplications #-}
 {-# OPTIONS_GHC -Wno-orphans #-}
 
 module CoreTests.CryptoTests (cryptoTests) where
 
+import Control.Concurrent.Async (forConcurrently_)
 import Control.Concurrent.STM
+import Control.Monad (forM, forM_, replicateM)
 import Control.Monad.Except
+import Crypto.Cipher.AES (AES256)
+import qualified Crypto.Cipher.Types as AES
+import qualified Crypto.Error as CE
+import Crypto.Hash (SHA512)
+import qualified Crypto.KDF.HKDF as H
+import qualified Crypto.PubKey.Ed25519 as Ed25519
+import qualified Data.ByteArray as BA
+import Data.ByteArray.Encoding (Base (..), convertFromBase)
 import qualified Data.ByteString.Char8 as B
 import qualified Data.ByteString.Lazy.Char8 as LB
 import Data.Either (isRight)
 import Data.Int (Int64)
+import Data.Maybe (fromJust, isJust)
 import qualified Data.Text as T
 import Data.Text.Encoding (encodeUtf8)
 import qualified Data.Text.Lazy as LT
@@ -19,10 +33,17 @@ import Data.Type.Equality
 import qualified Data.X509 as X
 import qualified Data.X509.CertificateStore as XS
 import qualified Data.X509.Validation as XV
+import Foreign.Ptr (plusPtr)
 import qualified SMPClient
 import qualified Simplex.Messaging.Crypto as C
+import Simplex.Messaging.Crypto.HKDF
+import Simplex.Messaging.Crypto.HashStream
+import Simplex.Messaging.Crypto.KeySlab
 import qualified Simplex.Messaging.Crypto.Lazy as LC
 import Simplex.Messaging.Crypto.SNTRUP761.Bindings
+import Simplex.Messaging.Crypto.SNTRUP761.Bindings.Stats
+import Simplex.Messaging.Crypto.SecretBoxStream
+import Simplex.Messaging.Crypto.X25519Cache
 import Simplex.Messaging.Transport.Client
 import Test.Hspec
 import Test.Hspec.QuickCheck (modifyMaxSuccess)
@@ -82,15 +103,24 @@ cryptoTests = do
   describe "Ed signatures" $ do
     describe "Ed25519" $ testSignature C.SEd25519
     describe "Ed448" $ testSignature C.SEd448
+    it "should verify Ed25519 signatures in batch" testVerifyBatch
   describe "DH X25519 + cryptobox" testDHCryptoBox
+  it "should cache DH X25519 secrets" testDhCache
   describe "secretbox" testSecretBox
   describe "lazy secretbox" $ do
     testLazySecretBox
     testLazySecretBoxFile
     testLazySecretBoxTailTag
     testLazySecretBoxFileTailTag
+    it "native stream should encrypt in place in the same way" testSecretBoxStream
+  it "should compute SHA256 and SHA512 incrementally" testHashStream
+  describe "HKDF" $ do
+    it "should derive the same keys as crypton HKDF" testHKDF
+    it "should derive chain keys in one call" testHKDFChain
   describe "AES GCM" $ do
     testAESGCM
+    it "should encrypt padded message in the same way as crypton" testAESGCMPadded
+    it "should decrypt with the first matching key" testAESGCMDecryptAny
   describe "X509 key encoding" $ do
     describe "Ed25519" $ testEncoding C.SEd25519
     describe "Ed448" $ testEncoding C.SEd448
@@ -98,8 +128,10 @@ cryptoTests = do
     describe "X448" $ testEncoding C.SX448
   describe "X509 chains" $ do
     it "should validate certificates" testValidateX509
-  describe "sntrup761" $
+  describe "sntrup761" $ do
     it "should enc/dec key" testSNTRUP761
+    it "should count calls when stats are enabled" testSNTRUP761Stats
+    it "should allocate keys in locked memory" testKeySlab
 
 instance Eq C.APublicKey where
   C.APublicKey a k == C.APublicKey a' k' = case testEquality a a' of
@@ -128,6 +160,33 @@ testSignature alg = it "should sign / verify string" . ioProperty $ do
   (k, pk) <- atomically $ C.generateSignatureKeyPair alg g
   pure $ \s -> let b = encodeUtf8 $ T.pack s in C.verify k (C.sign pk b) b
 
+testVerifyBatch :: IO ()
+testVerifyBatch = do
+  g <- C.newRandom
+  sigs@((k, sig, _) : s2@(k', sig', msg') : sigs') <- replicateM 10 $ do
+    (k, pk) <- atomically $ C.generateKeyPair @'C.Ed25519 g
+    msg <- atomically $ C.randomBytes 100 g
+    pure (k, C.sign' pk msg, msg)
+  C.verifyBatch sigs `shouldReturn` True
+  C.verifyBatch [s2] `shouldReturn` True
+  C.verifyBatch ((k, sig, "bad") : s2 : sigs') `shouldReturn` False
+  C.verifyBatch ((k, sig', msg') : s2 : sigs') `shouldReturn` False
+  C.verifyBatch (sigs <> [(k', sig, msg')]) `shouldReturn` False
+  -- R has a component of order 4: the signature passes cofactored verification, but not cofactorless
+  let hex = either error id . convertFromBase Base16 :: B.ByteString -> B.ByteString
+      k'' = C.PublicKeyEd25519 . CE.throwCryptoError . Ed25519.publicKey $ hex "8df88fff746355ff842294b1784f4ce0fe24a11ce9a8b0433c22f6e876869a5d"
+      sig'' = C.SignatureEd25519 . CE.throwCryptoError . Ed25519.signature $ hex "2b5321134cc97ace97c6cf60a969a0c22a030fe4bf284c6d0a0fa4ac41f0c5eedcee385521862b9e2d76354ef643702e21756a4bd33d7bfc8ae52f23ab17dc0d"
+  C.verify' k'' sig'' "hello" `shouldBe` False
+  C.verifyBatch [(k'', sig'', "hello"), s2] `shouldReturn` False
+  C.verifyBatch ((k'', sig'', "hello") : sigs) `shouldReturn` False
+  -- R of both signatures has a component of order 2: each fails verification, and they cancel out in the sum
+  let k3 = C.PublicKeyEd25519 . CE.throwCryptoError . Ed25519.publicKey $ hex "fdd07d0bb562760cdb1ce08a937535c048a62e41bf2d1f5eb2b7701a78e1347c"
+      sig3 = C.SignatureEd25519 . CE.throwCryptoError . Ed25519.signature $ hex "bddc482f7afefca46dd5fe6c555d4991fe9292f0695dff9b1e37d44808d85b1612d1bd104974cbd3dbdf5ef7cb06a530f750f0d5fc919c2c1c55ea0abe6c9a05"
+      sig4 = C.SignatureEd25519 . CE.throwCryptoError . Ed25519.signature $ hex "204eb59fefa684a355c1f6477db3d102a64cc5c6fbaa5f183be77ce29593b2021cad11b6bd8ee736b2b0d5ea8b4cb1ef59822eee87ddd23bdd4f0a37b6c37004"
+  C.verify' k3 sig3 "hello" `shouldBe` False
+  C.verify' k3 sig4 "world" `shouldBe` False
+  forM_ [1 .. 20 :: Int] $ \_ -> C.verifyBatch [(k3, sig3, "hello"), (k3, sig4, "world")] `shouldReturn` False
+
 testDHCryptoBox :: Spec
 testDHCryptoBox = it "should encrypt / decrypt string with asymmetric DH keys" . ioProperty $ do
   g <- C.newRandom
@@ -141,6 +200,69 @@ testDHCryptoBox = it "should encrypt / decrypt string with asymmetric DH keys" .
         plain = C.cbDecrypt (C.dh' sk rpk) nonce =<< cipher
      in isRight cipher && cipher /= plain && Right b == plain
 
+testDhCache :: IO ()
+testDhCache = do
+  g <- C.newRandom
+  cache <- newX25519Cache 32
+  (k, _) <- atomically $ C.generateKeyPair @'C.X25519 g
+  keys <- replicateM 40 . atomically $ C.generateKeyPair @'C.X25519 g
+  forM_ [1 :: Int, 2] $ \_ -> forM_ keys $ \(_, pk) -> C.dhCached cache k pk `shouldBe` C.dh' k pk
+  (k', pk') : _ <- pure keys
+  C.PublicKeyX25519 peerKey <- pure k
+  C.PublicKeyX25519 ownKey <- pure k'
+  let nonce = C.cbNonce "nonce"
+      auth = C.cbAuthenticateCached cache k pk' nonce "message"
+  auth `shouldBe` C.cbAuthenticate k pk' nonce "message"
+  C.cbVerifyCached cache k' pk' nonce auth "message" `shouldBe` False
+  C.cbVerify k' pk' nonce auth "message" `shouldBe` False
+  -- failed check does not add the secret to the cache
+  isJust <$> lookupX25519Secret cache ownKey ownKey `shouldReturn` False
+  C.cbVerifyUncached cache k' pk' nonce (C.cbAuthenticate k' pk' nonce "message") "message" `shouldBe` True
+  isJust <$> lookupX25519Secret cache ownKey ownKey `shouldReturn` False
+  (k'', pk'') <- atomically $ C.generateKeyPair @'C.X25519 g
+  C.PublicKeyX25519 ownKey'' <- pure k''
+  C.cbVerifyCached cache k' pk'' nonce (C.cbAuthenticate k' pk'' nonce "message") "message" `shouldBe` True
+  isJust <$> lookupX25519Secret cache ownKey ownKey'' `shouldReturn` True
+  isJust <$> lookupX25519Secret cache peerKey ownKey `shouldReturn` True
+  clearX25519Cache cache
+  isJust <$> lookupX25519Secret cache peerKey ownKey `shouldReturn` False
+  C.dhCached cache k pk' `shouldBe` C.dh' k pk'
+
+testSecretBoxStream :: IO ()
+testSecretBoxStream = do
+  g <- C.newRandom
+  (k, pk) <- atomically $ C.generateKeyPair @'C.X25519 g
+  nonce <- atomically $ C.randomCbNonce g
+  s <- atomically $ C.randomBytes 100000 g
+  let secret = C.dh' k pk
+  Right st <- pure $ LC.cbInit secret nonce
+  let (c, st') = LC.sbEncryptChunk st s
+      tag :: B.ByteString = BA.convert $ LC.sbAuth st'
+  (c', tag') <- withCbStream secret nonce $ \sb -> do
+    c' <- BA.copy s $ \p -> forM_ [(0, 1000), (1000, 30001), (31001, 100000 - 31001)] $ \(off, len) -> sbStreamEncrypt sb (p `plusPtr` off) len
+    tag' <- sbStreamAuth sb
+    pure (c', tag')
+  c' `shouldBe` c
+  tag' `shouldBe` tag
+  withCbStream secret nonce (\sb -> BA.copy c $ \p -> sbStreamDecrypt sb p 100000) `shouldReturn` s
+  (s', tag'') <- withCbStream secret nonce $ \sb -> do
+    s' <- BA.copy c $ \p -> do
+      sbStreamAuthUpdate sb p 100000
+      forConcurrently_ [(0, 70000), (70000, 3), (70003, 100000 - 70003)] $ \(off, len) -> sbStreamXorAt sb (fromIntegral off) (p `plusPtr` off) len
+    (s',) <$> sbStreamAuth sb
+  s' `shouldBe` s
+  tag'' `shouldBe` tag
+
+testHashStream :: IO ()
+testHashStream = do
+  g <- C.newRandom
+  s <- atomically $ C.randomBytes 100000 g
+  let hashParts withStream = withStream $ \hs -> do
+        BA.withByteArray s $ \p -> forM_ [(0, 1), (1, 64), (65, 99935)] $ \(off, len) -> hashStreamUpdate hs (p `plusPtr` off) len
+        hashStreamDigest hs
+  hashParts withSHA256Stream `shouldReturn` C.sha256Hash s
+  hashParts withSHA512Stream `shouldReturn` C.sha512Hash s
+
 testSecretBox :: Spec
 testSecretBox = it "should encrypt / decrypt string with a random symmetric key" . ioProperty $ do
   g <- C.newRandom
@@ -222,6 +344,37 @@ testAESGCM = it "should encrypt / decrypt string with a random symmetric key" $
   cipher `shouldNotBe` plain
   s `shouldBe` plain
 
+testAESGCMPadded :: IO ()
+testAESGCMPadded = do
+  g <- C.newRandom
+  k@(C.Key key) <- atomically $ C.randomAesKey g
+  iv@(C.IV ivBytes) <- atomically $ C.IV <$> C.randomBytes 16 g
+  forM_ [0, 1, 100, 253] $ \len -> do
+    s <- atomically $ C.randomBytes len g
+    Right (C.AuthTag tag, cipher) <- runExceptT $ C.encryptAEAD k iv 255 "ad" s
+    CE.CryptoPassed aead <- pure $ do
+      cipher <- AES.cipherInit key
+      AES.aeadInit AES.AEAD_GCM (cipher :: AES256) (fromJust $ AES.makeIV ivBytes)
+    Right padded <- pure $ C.pad s 255
+    AES.aeadSimpleEncrypt aead ("ad" :: B.ByteString) padded 16 `shouldBe` (tag, cipher)
+    runExceptT (C.decryptAEAD k iv "ad" cipher (C.AuthTag tag)) `shouldReturn` Right s
+    runExceptT (C.decryptAEAD k iv "bad" cipher (C.AuthTag tag)) `shouldReturn` Left C.AESDecryptError
+  s <- atomically $ C.randomBytes 254 g
+  runExceptT (C.encryptAEAD k iv 255 "ad" s) `shouldReturn` Left C.CryptoLargeMsgError
+
+testAESGCMDecryptAny :: IO ()
+testAESGCMDecryptAny = do
+  g <- C.newRandom
+  ks <- replicateM 5 . atomically $ C.randomAesKey g
+  iv <- atomically $ C.IV <$> C.randomBytes 16 g
+  s <- atomically $ C.randomBytes 100 g
+  Right (tag, cipher) <- runExceptT $ C.encryptAEAD (ks !! 3) iv 256 "ad" s
+  runExceptT (C.decryptAEADAny ks iv "ad" cipher tag) `shouldReturn` Right (3, s)
+  runExceptT (C.decryptAEADAny (ks <> ks) iv "ad" cipher tag) `shouldReturn` Right (3, s)
+  runExceptT (C.decryptAEADAny (C.Key "invalid" : ks) iv "ad" cipher tag) `shouldReturn` Right (4, s)
+  runExceptT (C.decryptAEADAny (take 3 ks) iv "ad" cipher tag) `shouldReturn` Left C.AESDecryptError
+  runExceptT (C.decryptAEADAny ks iv "bad" cipher tag) `shouldReturn` Left C.AESDecryptError
+
 testEncoding :: C.AlgorithmI a => C.SAlgorithm a -> Spec
 testEncoding alg = it "should encode / decode key" . ioProperty $ do
   g <- C.newRandom
@@ -270,3 +423,51 @@ testSNTRUP761 = do
   (c, KEMSharedKey k) <- sntrup761Enc drg pk
   KEMSharedKey k' <- sntrup761Dec c sk
   k' `shouldBe` k
+
+testKeySlab :: IO ()
+testKeySlab = do
+  drg <- C.newRandom
+  ks <- forM [0, 1, 32, 33, 1763, 2049, 5000] $ \len -> (BA.convert :: B.ByteString -> LockedBytes) <$> atomically (C.randomBytes len drg)
+  keySlabCount >>= (`shouldSatisfy` (>= 7))
+  forM_ ks $ \k -> do
+    let s = BA.convert k :: B.ByteString
+    BA.length k `shouldBe` B.length s
+    (BA.convert s :: LockedBytes) `shouldBe` k
+    forM_ ks $ \k' -> compare k k' `shouldBe` compare s (BA.convert k')
+  (KEMSecretKey sk, KEMSecretKey sk') <- (,) <$> (snd <$> sntrup761Keypair drg) <*> (snd <$> sntrup761Keypair drg)
+  sk `shouldNotBe` sk'
+  BA.length (sk <> sk') `shouldBe` 2 * BA.length sk
+
+testSNTRUP761Stats :: IO ()
+testSNTRUP761Stats = do
+  setSNTRUP761Stats True
+  s <- getSNTRUP761Stats
+  kemStatsEnabled s `shouldBe` True
+  testSNTRUP761
+  s' <- getSNTRUP761Stats
+  setSNTRUP761Stats False
+  let calls f = callCount (f s') - callCount (f s)
+  calls keypairStats `shouldSatisfy` (>= 1)
+  calls encStats `shouldSatisfy` (>= 1)
+  calls decStats `shouldSatisfy` (>= 1)
+  calls multStats `shouldSatisfy` (>= 4)
+  calls hashStats `shouldSatisfy` (>= 6)
+  callTime (decStats s') `shouldSatisfy` (> callTime (decStats s))
+
+testHKDF :: Property
+testHKDF = property $ \(salt, ikm, info, Positive len) ->
+  let salt' = B.pack salt
+      ikm' = B.pack ikm
+      info' = B.pack info
+      len' = min len 1000
+      prk = H.extract salt' ikm' :: H.PRK SHA512
+   in hkdf salt' ikm' info' len' === H.expand prk info' len'
+
+testHKDFChain :: IO ()
+testHKDFChain = do
+  g <- C.newRandom
+  ck <- atomically $ C.randomBytes 32 g
+  let steps = hkdfChain "info" 96 10 ck
+      steps' = take 10 . tail $ iterate (\s -> hkdf "" (B.take 32 s) "info" 96) ck
+  length steps `shouldBe` 10
+  steps `shouldBe` steps'
@@ -5,7 +5,10 @@
 
 module CoreTests.EncodingTests where
 
+import Control.Monad (forM_)
+import Data.Bifunctor (first)
 import Data.Bits (shiftR)
+import qualified Data.ByteString.Base64.URL as B64
 import Data.ByteString.Char8 (ByteString)
 import qualified Data.ByteString.Char8 as B
 import Data.ByteString.Internal (w2c)
@@ -13,6 +16,7 @@ import Data.Int (Int64)
 import Data.Time.Clock.System (SystemTime (..), getSystemTime, utcToSystemTime)
 import Data.Time.ISO8601 (parseISO8601)
 import Simplex.Messaging.Encoding
+import qualified Simplex.Messaging.Encoding.Base64URL as U
 import Simplex.Messaging.Encoding.String
 import Simplex.Messaging.Parsers (parseAll)
 import Simplex.Messaging.Transport.Client (TransportHost (..))
@@ -66,7 +70,38 @@ encodingTests = modifyMaxSuccess (const 1000) $ do
         THDomainName "192.256.0.1" #==# "192.256.0.1"
         THDomainName "192.168.0.-1" #==# "192.168.0.-1"
         shouldNotParse @TransportHost "192.168.0.0.1" "endOfInput"
+  describe "base64url" $ do
+    it "should encode and decode the same as base64-bytestring" . property $ \bytes ->
+      let s = B.pack $ map w2c bytes
+       in U.encode s == B64.encode s
+            && U.encodeUnpadded s == B64.encodeUnpadded s
+            && U.decode (U.encode s) == Right s
+            && U.decode (U.encodeUnpadded s) == Right s
+    it "should encode and decode keys" $
+      forM_ [32, 1158, 1763, 16384] $ \n -> do
+        let s = B.pack $ map (w2c . fromIntegral) [n .. n * 2]
+        U.encode s `shouldBe` B64.encode s
+        U.decode (U.encode s) `shouldBe` Right s
+    it "should validate the same as base64-bytestring" . property . forAll (listOf $ elements "AZaz09-_=+/ \200") $ \str ->
+      let s = B.pack str
+       in first (const ()) (U.decode s) == first (const ()) (B64.decode s)
+    it "should reject padding when length is not a multiple of 4" $
+      forM_ ["AA=", "QA=", "Aaz9AA=", "AAAAA="] $ \s -> do
+        first (const ()) (U.decode s) `shouldBe` Left ()
+        first (const ()) (B64.decode s) `shouldBe` Left ()
+    it "should validate padded and malformed strings the same as base64-bytestring" . property . forAll malformedBase64 $ \s ->
+      first (const ()) (U.decode s) == first (const ()) (B64.decode s)
   where
+    -- valid unpadded encoding with possibly changed last character, removed characters and added padding
+    malformedBase64 :: Gen ByteString
+    malformedBase64 = do
+      s <- B64.encodeUnpadded . B.pack . map w2c <$> arbitrary
+      c <- elements "AQgw_-z9"
+      s' <- elements [s, B.snoc (dropEnd 1 s) c, dropEnd 1 s, dropEnd 2 s]
+      pad <- choose (0, 3)
+      pure $ s' <> B.replicate pad '='
+      where
+        dropEnd n b = B.take (B.length b - n) b
     testSystemTime :: SystemTime -> Expectation
     testSystemTime t = do
       smpEncode t `shouldBe` smpEncode (systemSeconds t)
@@ -0,0 +1,132 @@
+{-# LANGUAGE DataKinds #-}
+{-# LANGUAGE LambdaCase #-}
+{-# LANGUAGE NamedFieldPuns #-}
+{-# LANGUAGE OverloadedStrings #-}
+{-# LANGUAGE TupleSections #-}
+
+module CoreTests.QueueStoreTests where
+
+import Control.Concurrent.Async (concurrently_, forConcurrently_)
+import Control.Monad
+import CoreTests.StoreLogTests (testNewQueueRec, testNtfCreds)
+import qualified Data.ByteString.Char8 as B
+import Data.Functor (($>))
+import qualified Data.Map.Strict as M
+import qualified Simplex.Messaging.Crypto as C
+import Simplex.Messaging.Protocol
+import Simplex.Messaging.Server.QueueStore
+import Simplex.Messaging.Server.QueueStore.QueueIndex
+import Simplex.Messaging.Server.QueueStore.STM
+import Test.Hspec
+import Test.Hspec.QuickCheck (modifyMaxSuccess)
+import Test.QuickCheck
+
+queueStoreTests :: Spec
+queueStoreTests = do
+  describe "queue index" $ do
+    it "should add, find and delete IDs" testQueueIndex
+    it "should add, find and delete IDs concurrently while growing" testQueueIndexConcurrent
+    modifyMaxSuccess (const 100) $ it "should be equivalent to Map" $ property prop_queueIndexMap
+  describe "queue store" $ do
+    it "should find queues by sender and notifier IDs" testQueueStoreIds
+    it "should not keep notifier IDs of the queues deleted concurrently" testAddNotifierDeleteQueue
+
+testQueueIndex :: IO ()
+testQueueIndex = do
+  qi <- newQueueIndex
+  insertQueueIndex qi (EntityId "abcd") (EntityId "efgh") `shouldReturn` True
+  insertQueueIndex qi (EntityId "abcd") (EntityId "ijkl") `shouldReturn` False
+  insertQueueIndex qi NoEntity (EntityId "empty") `shouldReturn` True
+  lookupQueueIndex qi (EntityId "abcd") `shouldReturn` Just (EntityId "efgh")
+  lookupQueueIndex qi NoEntity `shouldReturn` Just (EntityId "empty")
+  lookupQueueIndex qi (EntityId "abc") `shouldReturn` Nothing
+  lookupQueueIndex qi (EntityId $ B.replicate 32 'a') `shouldReturn` Nothing
+  queueIndexSize qi `shouldReturn` 2
+  deleteQueueIndex qi (EntityId "abcd")
+  lookupQueueIndex qi (EntityId "abcd") `shouldReturn` Nothing
+  queueIndexSize qi `shouldReturn` 1
+  -- grows and rehashes past the initial capacity
+  let ids = map (EntityId . B.pack . show) [1 .. 5000 :: Int]
+  forM_ ids $ \i -> insertQueueIndex qi i i `shouldReturn` True
+  forM_ (take 2500 ids) $ deleteQueueIndex qi
+  forM_ (take 2500 ids) $ \i -> lookupQueueIndex qi i `shouldReturn` Nothing
+  forM_ (drop 2500 ids) $ \i -> lookupQueueIndex qi i `shouldReturn` Just i
+  queueIndexSize qi `shouldReturn` 2501
+
+testQueueIndexConcurrent :: IO ()
+testQueueIndexConcurrent = do
+  qi <- newQueueIndex
+  forConcurrently_ [1 .. 4 :: Int] $ \t -> do
+    let ids = map (\i -> EntityId . B.pack $ show t <> "_" <> show i) [1 .. 20000 :: Int]
+    forM_ (zip3 [0 :: Int ..] ids $ replicate 1000 Nothing <> map Just ids) $ \(n, i, prev_) -> do
+      insertQueueIndex qi i i `shouldReturn` True
+      -- earlier keys may still be in the table that is being moved
+      forM_ prev_ $ \prev -> when (even n) $ deleteQueueIndex qi prev
+    forM_ (zip [0 :: Int ..] ids) $ \(n, i) ->
+      lookupQueueIndex qi i `shouldReturn` (if even n && n < 19000 then Nothing else Just i)
+  queueIndexSize qi `shouldReturn` 42000
+
+data IndexOp = IIns EntityId EntityId | IDel EntityId
+  deriving (Show)
+
+instance Arbitrary IndexOp where
+  arbitrary = oneof [IIns <$> genId <*> genId, IDel <$> genId]
+    where
+      -- few short IDs, so that operations collide
+      genId = EntityId . B.pack <$> (choose (0, 2) >>= (`vectorOf` elements "abc"))
+
+prop_queueIndexMap :: [IndexOp] -> Property
+prop_queueIndexMap ops = ioProperty $ do
+  qi <- newQueueIndex
+  (ok, m) <- foldM (applyOp qi) (True, M.empty) ops
+  found <- mapM (\k -> (k,) <$> lookupQueueIndex qi k) allIds
+  n <- queueIndexSize qi
+  pure $ ok && all (\(k, v) -> v == M.lookup k m) found && n == M.size m
+  where
+    allIds = map (EntityId . B.pack) $ "" : concatMap (\n -> replicateM n "abc") [1, 2]
+    applyOp qi (ok, m) = \case
+      IIns k v -> do
+        added <- insertQueueIndex qi k v
+        pure (ok && added == M.notMember k m, M.insertWith (\_ old -> old) k v m)
+      IDel k -> deleteQueueIndex qi k $> (ok, M.delete k m)
+
+testQueueStoreIds :: IO ()
+testQueueStoreIds = do
+  g <- C.newRandom
+  st <- newQueueStore
+  q@QueueRec {recipientId = rId, senderId = sId} <- testNewQueueRec g True
+  addQueue st q `shouldReturn` Right ()
+  q' <- testNewQueueRec g True
+  addQueue st q' {senderId = sId} `shouldReturn` Left DUPLICATE_
+  addQueue st q' {recipientId = rId} `shouldReturn` Left DUPLICATE_
+  -- failed addition does not leave sender ID in the index
+  addQueue st q' `shouldReturn` Right ()
+  getQueue st SSender sId `shouldReturn` Right q
+  nc@NtfCreds {notifierId = nId} <- testNtfCreds g
+  addQueueNotifier st rId nc `shouldReturn` Right Nothing
+  addQueueNotifier st (recipientId q') nc `shouldReturn` Left DUPLICATE_
+  getQueue st SNotifier nId `shouldReturn` Right q {notifier = Just nc}
+  let nId' = EntityId "mnop"
+  addQueueNotifier st rId nc {notifierId = nId'} `shouldReturn` Right (Just nId)
+  getQueue st SNotifier nId `shouldReturn` Left AUTH
+  getQueue st SNotifier nId' `shouldReturn` Right q {notifier = Just nc {notifierId = nId'}}
+  deleteQueueNotifier st rId `shouldReturn` Right (Just nId')
+  getQueue st SNotifier nId' `shouldReturn` Left AUTH
+  void $ addQueueNotifier st rId nc
+  void $ deleteQueue st rId
+  getQueue st SSender sId `shouldReturn` Left AUTH
+  getQueue st SNotifier nId `shouldReturn` Left AUTH
+  getQueue st SSender (senderId q') `shouldReturn` Right q'
+
+testAddNotifierDeleteQueue :: IO ()
+testAddNotifierDeleteQueue = do
+  g <- C.newRandom
+  st@QueueStore {notifiers} <- newQueueStore
+  replicateM_ 1000 $ do
+    q@QueueRec {recipientId = rId} <- testNewQueueRec g True
+    addQueue st q `shouldReturn` Right ()
+    nc@NtfCreds {notifierId = nId} <- testNtfCreds g
+    concurrently_ (void $ addQueueNotifier st rId nc) (void $ deleteQueue st rId)
+    lookupQueueIndex notifiers nId `shouldReturn` Nothing
+    addQueueNotifier st rId nc `shouldReturn` Left AUTH
+  queueIndexSize notifiers `shouldReturn` 0
@@ -109,11 +109,24 @@ storeLogTests =
 
 testSMPStoreLog :: String -> [SMPStoreLogTestCase] -> Spec
 testSMPStoreLog testSuite tests =
-  describe testSuite $ forM_ tests $ \t@SLTC {name, saved} -> it name $ do
-    l <- openWriteStoreLog testStoreLogFile
-    mapM_ (writeStoreLogRecord l) saved
-    closeStoreLog l
-    replicateM_ 3 $ testReadWrite t
+  describe testSuite $ forM_ tests $ \t@SLTC {name, saved} -> do
+    it name $ do
+      l <- openWriteStoreLog testStoreLogFile
+      mapM_ (writeStoreLogRecord l) saved
+      closeStoreLog l
+      replicateM_ 3 $ testReadWrite t
+      convertStoreLog SLFBinary testStoreLogFile
+      testReadWriteBinary t
+    it (name <> ", binary log") $ do
+      l <- openWriteBinaryStoreLog testStoreLogFile
+      mapM_ (writeQueueLogRecord l) saved
+      closeStoreLog l
+      replicateM_ 3 $ testReadWriteBinary t
+      -- incomplete last segment is ignored
+      B.appendFile testStoreLogFile "\0\0\0\1\0\0"
+      testReadWriteBinary t
+      convertStoreLog SLFText testStoreLogFile
+      testReadWrite t
   where
     testReadWrite SLTC {compacted, state} = do
       (state', l) <- readWriteStoreLog testStoreLogFile
@@ -121,3 +134,8 @@ testSMPStoreLog testSuite tests =
       closeStoreLog l
       ([], compacted') <- partitionEithers . map strDecode . B.lines <$> B.readFile testStoreLogFile
       compacted' `shouldBe` compacted
+    testReadWriteBinary SLTC {state} = do
+      (state', l) <- readWriteStoreLog testStoreLogFile
+      state' `shouldBe` state
+      closeStoreLog l
+      B.readFile testStoreLogFile >>= (`shouldSatisfy` ("#SMPLOG1" `B.isPrefixOf`))
@@ -27,17 +27,21 @@ import Data.ByteString.Char8 (ByteString)
 import qualified Data.ByteString.Char8 as B
 import Data.Hashable (hash)
 import qualified Data.IntSet as IS
+import Data.Maybe (isJust)
 import Data.Type.Equality
 import GHC.Stack (withFrozenCallStack)
 import SMPClient
 import qualified Simplex.Messaging.Crypto as C
+import Simplex.Messaging.Crypto.X25519Cache (insertX25519Secret, lookupX25519Secret)
 import Simplex.Messaging.Encoding
 import Simplex.Messaging.Encoding.String
 import Simplex.Messaging.Parsers (parseAll)
 import Simplex.Messaging.Protocol
+import Simplex.Messaging.Server (dummyKeyX25519, dummyVerifyCmd, verifyCmdAuthorization)
 import Simplex.Messaging.Server.Env.STM (ServerConfig (..))
 import Simplex.Messaging.Server.Expiration
 import Simplex.Messaging.Server.Stats (PeriodStatsData (..), ServerStatsData (..))
+import Simplex.Messaging.Server.StoreLog (StoreLogFormat (..), convertStoreLog)
 import Simplex.Messaging.Transport
 import Simplex.Messaging.Version (mkVersionRange)
 import System.Directory (removeFile)
@@ -66,7 +70,10 @@ serverTests t@(ATransport t') = do
   describe "Store log" $ testWithStoreLog t
   describe "Restore messages" $ testRestoreMessages t
   describe "Restore messages (old / v2)" $ testRestoreExpireMessages t
-  describe "Timing of AUTH error" $ testTiming t
+  describe "Restore messages (binary)" $ testRestoreMessagesBinary t
+  describe "Timing of AUTH error" $ do
+    testTiming t
+    it "should not use DH cache for failed and dummy key checks" testDummyAuthNoCache
   describe "Message notifications" $ testMessageNotifications t
   describe "Message expiration" $ do
     testMsgExpireOnSend t'
@@ -807,6 +814,48 @@ testRestoreExpireMessages at@(ATransport t) =
     runClient :: Transport c => TProxy c -> (THandleSMP c 'TClient -> IO ()) -> Expectation
     runClient _ test' = testSMPClient test' `shouldReturn` ()
 
+testRestoreMessagesBinary :: ATransport -> Spec
+testRestoreMessagesBinary at@(ATransport t) =
+  it "should store messages in binary snapshot with binary store log" $ do
+    removeFileIfExists testStoreLogFile
+    removeFileIfExists testStoreMsgsFile
+    removeFileIfExists testServerStatsBackupFile
+    convertStoreLog SLFBinary testStoreLogFile
+    g <- C.newRandom
+    (sPub, sKey) <- atomically $ C.generateAuthKeyPair C.SEd25519 g
+    queue <- newEmptyTMVarIO
+
+    withSmpServerStoreMsgLogOn at testPort . runTest t $ \h -> do
+      runClient t $ \h1 -> createAndSecureQueue h1 sPub >>= atomically . putTMVar queue
+      (sId, _, _, _) <- atomically $ readTMVar queue
+      Resp "1" _ OK <- signSendRecv h sKey ("1", sId, _SEND "hello 1")
+      Resp "2" _ OK <- signSendRecv h sKey ("2", sId, _SEND "hello 2")
+      pure ()
+
+    msgs <- B.readFile testStoreMsgsFile
+    ("#SMPMSG1" `B.isPrefixOf` msgs) `shouldBe` True
+
+    withSmpServerStoreMsgLogOn at testPort . runTest t $ \h -> do
+      (_, rId, rKey, dh) <- atomically $ readTMVar queue
+      Resp "3" _ (Msg mId1 msg1) <- signSendRecv h rKey ("3", rId, SUB)
+      (decryptMsgV3 dh mId1 msg1, Right "hello 1") #== "restored message delivered"
+      Resp "4" _ (Msg mId2 msg2) <- signSendRecv h rKey ("4", rId, ACK mId1)
+      (decryptMsgV3 dh mId2 msg2, Right "hello 2") #== "restored message delivered"
+      Resp "5" _ OK <- signSendRecv h rKey ("5", rId, ACK mId2)
+      pure ()
+
+    removeFile testStoreLogFile
+    removeFile testStoreMsgsFile
+    removeFile testServerStatsBackupFile
+  where
+    runTest :: Transport c => TProxy c -> (THandleSMP c 'TClient -> IO ()) -> ThreadId -> Expectation
+    runTest _ test' server = do
+      testSMPClient test' `shouldReturn` ()
+      killThread server
+
+    runClient :: Transport c => TProxy c -> (THandleSMP c 'TClient -> IO ()) -> Expectation
+    runClient _ test' = testSMPClient test' `shouldReturn` ()
+
 createAndSecureQueue :: Transport c => THandleSMP c 'TClient -> SndPublicAuthKey -> IO (SenderId, RecipientId, RcvPrivateAuthKey, RcvDhSecret)
 createAndSecureQueue h sPub = do
   g <- C.newRandom
@@ -818,6 +867,30 @@ createAndSecureQueue h sPub = do
   (rId', rId) #== "same queue ID"
   pure (sId, rId, rKey, dhShared)
 
+testDummyAuthNoCache :: IO ()
+testDummyAuthNoCache = do
+  g <- C.newRandom
+  (srvPub, srvPriv@(C.PrivateKeyX25519 _ srvKey)) <- atomically $ C.generateKeyPair @'C.X25519 g
+  (clntPub, clntPriv) <- atomically $ C.generateKeyPair @'C.X25519 g
+  nonce <- atomically $ C.randomCbNonce g
+  cache <- newSessionDhCache
+  let auth_ = Just (THAuthServer {serverPrivKey = srvPriv, sessSecret' = Nothing, dhCache' = cache}, nonce)
+      tAuth = TAAuthenticator $ C.cbAuthenticate srvPub clntPriv nonce "hello"
+      dummyKey = C.APublicAuthKey C.SX25519 dummyKeyX25519
+  C.PublicKeyX25519 dummyPub <- pure dummyKeyX25519
+  C.DhSecretX25519 clntSecret <- pure $ C.dh' clntPub srvPriv
+  -- the secret for the client key is cached for the dummy key, so the check reading from cache would succeed
+  insertX25519Secret cache dummyPub srvKey clntSecret
+  verifyCmdAuthorization auth_ (Just tAuth) "hello" dummyKey `shouldBe` True
+  dummyVerifyCmd auth_ "hello" tAuth `shouldBe` False
+  -- the secret is only cached after the successful check with the queue key
+  let clntKey = C.APublicAuthKey C.SX25519 clntPub
+  C.PublicKeyX25519 clntPubKey <- pure clntPub
+  verifyCmdAuthorization auth_ (Just tAuth) "bye" clntKey `shouldBe` False
+  isJust <$> lookupX25519Secret cache clntPubKey srvKey `shouldReturn` False
+  verifyCmdAuthorization auth_ (Just tAuth) "hello" clntKey `shouldBe` True
+  isJust <$> lookupX25519Secret cache clntPubKey srvKey `shouldReturn` True
+
 testTiming :: ATransport -> Spec
 testTiming (ATransport t) =
   describe "should have similar time for auth error, whether queue exists or not, for all key types" $
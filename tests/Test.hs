@@ -8,9 +8,11 @@ import Control.Concurrent (threadDelay)
 import qualified Control.Exception as E
 import Control.Logger.Simple
 import CoreTests.BatchingTests
+import CoreTests.CompressionTests
 import CoreTests.CryptoFileTests
 import CoreTests.CryptoTests
 import CoreTests.EncodingTests
+import CoreTests.QueueStoreTests
 import CoreTests.RetryIntervalTests
 import CoreTests.SOCKSSettings
 import CoreTests.StoreLogTests
@@ -49,7 +51,9 @@ main = do
         describe "Agent SQLite schema dump" schemaDumpTest
         describe "Core tests" $ do
           describe "Batching tests" batchingTests
+          describe "Compression tests" compressionTests
           describe "Encoding tests" encodingTests
+          describe "Queue store tests" queueStoreTests
           describe "Version range" versionRangeTests
           describe "Encryption tests" cryptoTests
           describe "Encrypted files tests" cryptoFileTests